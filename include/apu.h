@@ -0,0 +1,117 @@
+#ifndef OLDNES_APU_H
+#define OLDNES_APU_H
+
+#include "definitions.h"
+#include "blip.h"
+
+#define APU_CLOCK_RATE  1789773.0
+#define APU_SAMPLE_RATE 48000
+#define APU_VOLUME      24000.0f
+
+// No timer is ever this far away; a channel that is not stepping parks its timer here
+#define APU_TIMER_IDLE  UINT32_MAX
+
+struct Emulator;
+
+typedef struct Envelope {
+    bool start;
+    bool loop;
+    bool constant;
+    byte volume;
+    byte divider;
+    byte decay;
+} Envelope;
+
+typedef struct Pulse {
+    bool enabled;
+    byte index;
+    byte duty;
+    byte step;
+    byte length;
+    word period;
+    uint32_t timer;
+    struct Envelope envelope;
+
+    bool sweep_enabled;
+    bool sweep_negate;
+    bool sweep_reload;
+    byte sweep_period;
+    byte sweep_shift;
+    byte sweep_divider;
+} Pulse;
+
+typedef struct Triangle {
+    bool enabled;
+    bool control;
+    bool linear_reload;
+    byte linear_period;
+    byte linear;
+    byte length;
+    byte step;
+    word period;
+    uint32_t timer;
+} Triangle;
+
+typedef struct Noise {
+    bool enabled;
+    bool mode;
+    byte length;
+    byte period;
+    word shift;
+    uint32_t timer;
+    struct Envelope envelope;
+} Noise;
+
+typedef struct DMC {
+    bool irq_enabled;
+    bool irq;
+    bool loop;
+    byte rate;
+    byte level;
+    word sample_address;
+    word sample_length;
+    word address;
+    word remaining;
+    byte buffer;
+    bool buffer_full;
+    byte shifter;
+    byte bits;
+    bool silence;
+    uint32_t timer;
+} DMC;
+
+// Channels are not clocked every cycle. sync_apu catches everything up to a CPU cycle by jumping
+// from one timer expiry to the next, and is only called when a register is touched, when a
+// scheduled event comes due (frame counter steps and the end of a DMC sample) and at frame end.
+typedef struct APU {
+    struct Pulse pulse[2];
+    struct Triangle triangle;
+    struct Noise noise;
+    struct DMC dmc;
+
+    bool five_step;
+    bool irq_inhibit;
+    bool frame_irq;
+    byte frame_step;
+    uint32_t frame_timer;
+
+    uint64_t cycle;
+    uint64_t frame_cycle;
+    float amplitude;
+
+    // Links, not part of save states. Without a blip buffer the APU still runs, silently
+    struct Blip* blip;
+    struct Emulator* emulator;
+} APU;
+
+bool init_apu(struct Emulator* emulator);
+void free_apu(struct APU* apu);
+
+void sync_apu(struct APU* apu, uint64_t cycle);
+void end_apu_frame(struct APU* apu);
+uint64_t next_apu_event(const struct APU* apu);
+
+byte read_apu_status(struct APU* apu);
+void write_apu(struct APU* apu, word address, byte value);
+
+#endif //OLDNES_APU_H
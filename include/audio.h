@@ -0,0 +1,45 @@
+#ifndef OLDNES_AUDIO_H
+#define OLDNES_AUDIO_H
+
+#include <SDL2/SDL.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "definitions.h"
+
+#define AUDIO_RING_SIZE       16384
+#define AUDIO_DEFAULT_LATENCY 64
+#define AUDIO_MAX_ADJUST      0.005
+
+// Samples travel from the emulation thread to the SDL callback through a single-producer,
+// single-consumer ring. The producer resamples by up to AUDIO_MAX_ADJUST either way to hold
+// the ring at the target fill, so neither side's clock drifting away from the other is audible.
+typedef struct AudioContext {
+    SDL_AudioDeviceID device;
+    int sample_rate;
+    usize target;
+    bool playing;
+
+    // Producer side
+    double position;
+    double step;
+    sword last;
+    usize overruns;
+
+    // The indices only ever grow; each lives on its own cache line
+    alignas(64) atomic_size_t write;
+    alignas(64) atomic_size_t read;
+    atomic_uint underruns;
+    sword ring[AUDIO_RING_SIZE];
+} AudioContext;
+
+bool init_audio(struct AudioContext* audio, int sample_rate, unsigned latency_ms);
+void free_audio(struct AudioContext* audio);
+
+void queue_audio(struct AudioContext* audio, const sword* samples, usize count);
+void pause_audio(struct AudioContext* audio, bool pause);
+void wait_for_audio(struct AudioContext* audio);
+void report_audio(const struct AudioContext* audio, FILE* out);
+
+#endif //OLDNES_AUDIO_H
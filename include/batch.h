@@ -0,0 +1,42 @@
+#ifndef OLDNES_BATCH_H
+#define OLDNES_BATCH_H
+
+#include "definitions.h"
+#include "thread_pool.h"
+
+// Each worker gets a few chunks per step, so an instance that runs long does not hold up the rest
+#define BATCH_CHUNKS_PER_WORKER 4
+
+struct Emulator;
+struct Batch;
+
+// A contiguous run of instances stepped by one task
+typedef struct BatchChunk {
+    struct Batch* batch;
+    usize first;
+    usize count;
+} BatchChunk;
+
+// Steps many emulators at once for training loops. Chunks are allocated up front and the step's
+// arguments are read in place, so a step allocates nothing and writes each observation once,
+// straight into the caller's buffers.
+typedef struct Batch {
+    struct ThreadPool pool;
+    struct BatchChunk* chunks;
+    usize chunk_capacity;
+
+    struct Emulator* const* envs;
+    const byte* actions;
+    usize frames;
+    void* observations;
+    bool rgb;
+    byte* ram;
+} Batch;
+
+bool init_batch(struct Batch* batch, usize workers);
+void free_batch(struct Batch* batch);
+
+void step_batch(struct Batch* batch, struct Emulator* const* envs, usize count, const byte* actions, usize frames,
+                void* observations, bool rgb, byte* ram);
+
+#endif //OLDNES_BATCH_H
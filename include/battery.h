@@ -0,0 +1,23 @@
+#ifndef OLDNES_BATTERY_H
+#define OLDNES_BATTERY_H
+
+#include "definitions.h"
+#include "page.h"
+
+// A .sav file mapped into memory. Battery RAM itself stays in the CPU bus page table so forks
+// and save states treat it like any other memory; pages written since the last flush are copied
+// into the mapping at the end of the frame, and only then is the file synced.
+typedef struct Battery {
+    char* path;
+    byte* data;
+    usize size;
+    uint64_t flushes;
+} Battery;
+
+struct Battery* open_battery(const char* path, usize size);
+void close_battery(struct Battery* battery, const struct PageTable* ram);
+
+void load_battery(const struct Battery* battery, struct PageTable* ram);
+void flush_battery(struct Battery* battery, const struct PageTable* ram, usize* dirty, bool wait);
+
+#endif //OLDNES_BATTERY_H
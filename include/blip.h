@@ -0,0 +1,33 @@
+#ifndef OLDNES_BLIP_H
+#define OLDNES_BLIP_H
+
+#include "definitions.h"
+
+#define BLIP_PHASE_BITS  5
+#define BLIP_PHASES      (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS        16
+#define BLIP_BUFFER_SIZE 4096
+#define BLIP_FRAC_BITS   32
+
+// Band-limited step synthesis. Amplitude changes are added as deltas at the clock they happen on,
+// each spread over BLIP_TAPS output samples by a windowed-sinc kernel picked by sub-sample phase,
+// and the running sum of the deltas is the signal.
+typedef struct Blip {
+    uint64_t factor;
+    uint64_t offset;
+    float integrator;
+    float highpass;
+    float buffer[BLIP_BUFFER_SIZE + BLIP_TAPS];
+
+    // Samples finished by the last end_blip_frame
+    sword samples[BLIP_BUFFER_SIZE];
+    usize count;
+} Blip;
+
+void init_blip(struct Blip* blip, double clock_rate, double sample_rate);
+void clear_blip(struct Blip* blip);
+
+void add_blip_delta(struct Blip* blip, usize clock, float delta);
+usize end_blip_frame(struct Blip* blip, usize clocks);
+
+#endif //OLDNES_BLIP_H
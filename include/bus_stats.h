@@ -0,0 +1,55 @@
+#ifndef OLDNES_BUS_STATS_H
+#define OLDNES_BUS_STATS_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+
+#define BUS_STATS_MAGIC   0x53425342 // "BSBS"
+#define BUS_STATS_VERSION 1
+
+#define CPU_BUS_PAGES 0x100
+#define PPU_BUS_PAGES 0x40
+#define IO_REGISTERS  0x28
+
+// $2000-$2007 take the first 8 slots, $4000-$401F the rest
+static inline byte to_io_slot(word address) {
+    return address < 0x4000 ? (address & 0x07) : 0x08 + (address & 0x1f);
+}
+
+typedef struct BusCounts {
+    uint64_t reads;
+    uint64_t writes;
+} BusCounts;
+
+// Per-frame peaks are kept for the I/O registers only, memory pages are only ever summed
+typedef struct BusStats {
+    struct BusCounts cpu_pages[CPU_BUS_PAGES];
+    struct BusCounts ppu_pages[PPU_BUS_PAGES];
+    struct BusCounts io[IO_REGISTERS];
+    struct BusCounts io_frame[IO_REGISTERS];
+    struct BusCounts io_peak[IO_REGISTERS];
+    uint64_t frames;
+
+    // Back-to-back accesses to one register with no other I/O in between. Repeated PPUSTAT reads
+    // are a title spinning on vblank, a run of PPUDATA accesses is one transfer
+    byte last_io;
+    bool last_write;
+    uint64_t stat_spins;
+    uint64_t ppudata_bursts;
+    uint64_t ppudata_longest;
+    uint64_t ppudata_run;
+} BusStats;
+
+struct BusStats* create_bus_stats(void);
+void free_bus_stats(struct BusStats* stats);
+void clear_bus_stats(struct BusStats* stats);
+
+void count_cpu_access(struct BusStats* stats, word address, bool write);
+void count_ppu_access(struct BusStats* stats, word address, bool write);
+void end_bus_stats_frame(struct BusStats* stats);
+
+void report_bus_stats(const struct BusStats* stats, FILE* out);
+bool save_bus_stats(const struct BusStats* stats, const char* path);
+
+#endif //OLDNES_BUS_STATS_H
@@ -0,0 +1,55 @@
+#ifndef OLDNES_CAPTURE_H
+#define OLDNES_CAPTURE_H
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "definitions.h"
+#include "blip.h"
+#include "ppu.h"
+
+#define CAPTURE_SLOTS 64
+
+// NTSC frame rate as an exact fraction: 39375000 / 655171 = 60.0988 Hz
+#define CAPTURE_RATE_NUMERATOR   39375000
+#define CAPTURE_RATE_DENOMINATOR 655171
+
+struct Emulator;
+
+// One emulated frame as handed to the writer: raw palette indices and the samples made alongside them
+typedef struct CaptureSlot {
+    byte pixels[SCREEN_SIZE];
+    sword samples[BLIP_BUFFER_SIZE];
+    usize count;
+} CaptureSlot;
+
+// Frames go through a bounded queue to a writer thread, which converts the picture to YUV 4:2:0
+// and appends it to a .y4m file, and the sound to a 16-bit mono .wav file. The emulation thread
+// only copies; it waits (and counts the wait) only if the writer falls CAPTURE_SLOTS frames behind.
+typedef struct Capture {
+    FILE* video;
+    FILE* audio;
+    int sample_rate;
+
+    struct CaptureSlot* slots;
+    usize head;
+    usize tail;
+    usize queued;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    pthread_t thread;
+
+    uint64_t frames;
+    uint64_t samples;
+    uint64_t waits;
+    bool failed;
+} Capture;
+
+bool start_capture(struct Capture* capture, const char* video_path, const char* audio_path, int sample_rate);
+void capture_frame(struct Capture* capture, const struct Emulator* emulator);
+void stop_capture(struct Capture* capture);
+void report_capture(const struct Capture* capture, FILE* out);
+
+#endif //OLDNES_CAPTURE_H
@@ -0,0 +1,13 @@
+#ifndef OLDNES_CHECKSUM_H
+#define OLDNES_CHECKSUM_H
+
+#include "definitions.h"
+
+#define SHA1_SIZE 20
+
+// The checksums ROM databases are keyed by. Unlike hash64 these are fixed by outside formats,
+// so results match zlib's crc32() and any SHA-1 tool. A running CRC starts from zero.
+uint32_t crc32_checksum(const void* data, usize size, uint32_t crc);
+void sha1_digest(const void* data, usize size, byte digest[SHA1_SIZE]);
+
+#endif //OLDNES_CHECKSUM_H
@@ -1,8 +1,6 @@
 #ifndef OLDNES_CONTROLLER_H
 #define OLDNES_CONTROLLER_H
 
-#include <SDL2/SDL.h>
-
 #include "definitions.h"
 
 typedef enum Button {
@@ -26,8 +24,6 @@ typedef struct Controller {
 void init_controller(struct Controller* controller, byte player);
 byte read_controller(struct Controller* controller);
 void write_controller(struct Controller* controller, byte value);
-void update_controller(struct Controller* controller, const SDL_Event* event);
-
-void keyboard_mapper(struct Controller* controller, const SDL_Event* event);
+void set_controller(struct Controller* controller, byte buttons);
 
 #endif //OLDNES_CONTROLLER_H
@@ -11,6 +11,8 @@
 #define STACK_RESET 0xfd
 
 struct Emulator;
+struct Profiler;
+struct TraceRing;
 
 typedef union StatusFlags {
     struct {
@@ -42,18 +44,34 @@ typedef enum InterruptType {
     NMI,
 } InterruptType;
 
+// Level-triggered IRQ sources, held on the line until their device acknowledges them
+typedef enum IRQSource {
+    IRQ_FRAME  = 1 << 0,
+    IRQ_DMC    = 1 << 1,
+    IRQ_MAPPER = 1 << 2,
+} IRQSource;
+
 typedef struct CPU {
     word pc;
     byte sp;
     byte a, x, y;
     StatusFlags status;
 
-    word cycles;
+    uint64_t cycles;
     word skip_cycles;
     byte pending_nmi;
     byte pending_irq;
+    byte irq_line;
+
+    // Devices clocked lazily are caught up once the CPU passes this cycle
+    uint64_t event_cycle;
 
+    // Links, not part of save states
     struct CPUBus* bus;
+    struct TraceRing* trace;
+#ifdef OLDNES_PROFILE
+    struct Profiler* profiler;
+#endif
 } CPU;
 
 void init_cpu(struct Emulator* emulator);
@@ -61,5 +79,6 @@ void init_cpu(struct Emulator* emulator);
 void reset_cpu(struct CPU* cpu);
 void execute_cpu(struct CPU* cpu);
 void interrupt_cpu(struct CPU* cpu, InterruptType type);
+void set_irq_line(struct CPU* cpu, IRQSource source, bool active);
 
 #endif //OLDNES_CPU_H
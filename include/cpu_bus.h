@@ -4,9 +4,11 @@
 #include "definitions.h"
 #include "controller.h"
 #include "mapper.h"
+#include "page.h"
 
 
-#define RAM_SIZE 0x0800
+#define RAM_SIZE     0x0800
+#define PRG_RAM_SIZE 0x2000
 
 typedef enum IORegisters {
     PPUCTRL = 0x2000,
@@ -18,25 +20,42 @@ typedef enum IORegisters {
     PPUADDR = 0x2006,
     PPUDATA = 0x2007,
     OAMDMA  = 0x4014,
+    APUSTAT = 0x4015,
     JOYPAD1 = 0x4016,
     JOYPAD2 = 0x4017,
 } IORegisters;
 
 struct Emulator;
+struct BusStats;
+struct Battery;
 
 typedef struct CPUBus {
-    byte ram[RAM_SIZE];
     struct Controller pad1;
     struct Controller pad2;
 
+    // Paged memory and links, not part of the plain section of save states
+    struct PageTable ram;
+    struct PageTable prg_ram;
     struct Mapper*   mapper;
     struct Emulator* emulator;
+
+    // Optional .sav backing for battery RAM, flushed at frame end when prg_ram_dirty has page bits set
+    struct Battery*  battery;
+    usize            prg_ram_dirty;
+#ifdef OLDNES_BUS_STATS
+    struct BusStats* stats;
+#endif
 } CPUBus;
 
 void init_cpu_bus(struct Emulator* emulator);
 
 byte read_cpu_memory(struct CPUBus* bus, word address);
 void write_cpu_memory(struct CPUBus* bus, word address, byte value);
+byte peek_cpu_memory(const struct CPUBus* bus, word address);
 const byte* get_page_ptr(const struct CPUBus* bus, word address);
+void free_cpu_bus(struct CPUBus* bus);
+
+bool attach_battery(struct CPUBus* bus, const char* path);
+void flush_prg_ram(struct CPUBus* bus);
 
 #endif //OLDNES_CPU_BUS_H
@@ -27,5 +27,10 @@ typedef struct Instruction {
 } Instruction;
 
 extern const Instruction INSTRUCTIONS[0x100];
+extern const char* const OPERATION_NAMES[XXX + 1];
+extern const char* const ADDRESS_MODE_NAMES[IMP + 1];
+extern const byte OPERAND_SIZES[IMP + 1];
+
+void disassemble(char* out, usize size, word pc, const byte* bytes);
 
 #endif //OLDNES_CPU_OPCODES_H
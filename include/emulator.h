@@ -3,9 +3,11 @@
 
 #include "cpu.h"
 #include "ppu.h"
-#include "graphics.h"
+#include "apu.h"
 #include "cpu_bus.h"
+#include "ppu_bus.h"
 #include "mapper.h"
+#include "timing.h"
 
 #define NES_VIDEO_WIDTH  256
 #define NES_VIDEO_HEIGHT 240
@@ -13,17 +15,23 @@
 typedef struct Emulator {
     struct CPU cpu;
     struct PPU ppu;
+    struct APU apu;
     struct CPUBus cpu_bus;
     struct PPUBus ppu_bus;
     struct Mapper mapper;
-    struct GraphicsContext gfx;
-    byte exit;
-    byte pause;
+
+    // Optional, splits the time spent in run_frame between CPU and PPU
+    struct FrameTiming* timing;
 } Emulator;
 
-void init_emulator(struct Emulator* emulator, int argc, char* argv[]);
+bool init_emulator(struct Emulator* emulator, struct RomImage* rom);
 void free_emulator(struct Emulator* emulator);
+struct Emulator* fork_emulator(struct Emulator* parent);
+bool is_out_of_memory(const struct Emulator* emulator);
+
+void run_frame(struct Emulator* emulator);
 
-void run_emulator(struct Emulator* emulator);
+void run_scheduled_events(struct Emulator* emulator);
+void schedule_events(struct Emulator* emulator);
 
 #endif //OLDNES_EMULATOR_H
@@ -0,0 +1,56 @@
+#ifndef OLDNES_FLEET_H
+#define OLDNES_FLEET_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+#include "rom.h"
+#include "thread_pool.h"
+
+#define FLEET_SLICE_FRAMES 60
+
+struct Emulator;
+struct Fleet;
+
+// Controller state held from the given frame onwards
+typedef struct InputEvent {
+    usize frame;
+    byte pad1;
+    byte pad2;
+} InputEvent;
+
+typedef struct FleetInstance {
+    usize id;
+    struct RomImage* rom;
+    struct InputEvent* inputs;
+    usize input_count;
+    usize next_input;
+
+    usize frames;
+    usize frames_done;
+    double seconds;
+
+    struct Emulator* emulator;
+    struct Fleet* fleet;
+} FleetInstance;
+
+typedef struct Fleet {
+    struct FleetInstance** instances;
+    usize count;
+    struct RomCache roms;
+
+    usize slice_frames;
+    double seconds;
+    struct ThreadPool pool;
+} Fleet;
+
+bool init_fleet(struct Fleet* fleet, usize workers, usize slice_frames);
+void free_fleet(struct Fleet* fleet);
+
+bool add_fleet_instance(struct Fleet* fleet, const char* rom_path, usize frames, const char* input_path);
+bool load_fleet_config(struct Fleet* fleet, const char* path);
+
+void run_fleet(struct Fleet* fleet);
+void report_fleet(const struct Fleet* fleet, FILE* out);
+
+#endif //OLDNES_FLEET_H
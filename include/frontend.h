@@ -0,0 +1,36 @@
+#ifndef OLDNES_FRONTEND_H
+#define OLDNES_FRONTEND_H
+
+#include "emulator.h"
+#include "graphics.h"
+#include "audio.h"
+#include "rewind.h"
+#include "run_ahead.h"
+#include "movie.h"
+#include "timing.h"
+
+typedef struct Frontend {
+    struct Emulator emulator;
+    struct GraphicsContext gfx;
+    struct AudioContext audio;
+    bool audio_sync;
+    byte* quick_state;
+    usize quick_state_size;
+    struct RewindBuffer rewind;
+    bool rewinding;
+    struct RunAhead run_ahead;
+    struct Movie movie;
+    const char* movie_path;
+    const char* trace_path;
+    struct FrameTiming timing;
+    bool show_timing;
+    byte exit;
+    byte pause;
+} Frontend;
+
+bool init_frontend(struct Frontend* frontend, int argc, char* argv[]);
+void free_frontend(struct Frontend* frontend);
+
+void run_frontend(struct Frontend* frontend);
+
+#endif //OLDNES_FRONTEND_H
@@ -3,6 +3,11 @@
 
 #include <SDL2/SDL.h>
 
+#include "timing.h"
+
+#define TIMING_BAR_WIDTH     2
+#define TIMING_BUDGET_HEIGHT 48
+
 typedef struct GraphicsContext {
     SDL_Window*   window;
     SDL_Renderer* renderer;
@@ -10,11 +15,15 @@ typedef struct GraphicsContext {
     int width;
     int height;
     float scale;
+    bool vsync;
 } GraphicsContext;
 
 void init_graphics(struct GraphicsContext* gfx, uint32_t systems);
 void free_graphics(struct GraphicsContext* gfx);
 
 void render_graphics(struct GraphicsContext* gfx, const uint32_t* buffer);
+void draw_graphics(struct GraphicsContext* gfx, const uint32_t* buffer);
+void draw_timing_overlay(struct GraphicsContext* gfx, const struct FrameTiming* timing);
+void present_graphics(struct GraphicsContext* gfx);
 
 #endif //OLDNES_GRAPHICS_H
@@ -0,0 +1,9 @@
+#ifndef OLDNES_HASH_H
+#define OLDNES_HASH_H
+
+#include "definitions.h"
+
+uint64_t hash64(const void* data, usize size, uint64_t seed);
+uint64_t hash64_wide(const void* data, usize size, uint64_t seed);
+
+#endif //OLDNES_HASH_H
@@ -3,16 +3,63 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 
 #define PRINTF(...) printf(__VA_ARGS__)
 
 enum LogLevel {
     DEBUG = 0,
-    ERROR,
     INFO,
-
+    ERROR,
 };
 
-void LOG(enum LogLevel level, const char* fmt, ...);
+// Calls below this level compile to nothing. Override with -DOLDNES_LOG_LEVEL=<level>
+#ifndef OLDNES_LOG_LEVEL
+#ifdef NDEBUG
+#define OLDNES_LOG_LEVEL INFO
+#else
+#define OLDNES_LOG_LEVEL DEBUG
+#endif
+#endif
+
+// Each call site may log LOG_BURST messages per second, the rest are counted and reported later
+#define LOG_BURST        8
+#define LOG_MESSAGE_SIZE 240
+#define LOG_RING_SIZE    1024
+
+typedef enum LogFormat {
+    LOG_TEXT,
+    LOG_BINARY,
+} LogFormat;
+
+// Rate limiting state for one LOG() call site
+typedef struct LogSite {
+    atomic_uint_fast64_t window;
+    atomic_uint count;
+    atomic_uint suppressed;
+} LogSite;
+
+// Binary log entries are this header followed by length bytes of text
+typedef struct LogEntryHeader {
+    uint64_t time;
+    uint8_t  level;
+    uint8_t  reserved;
+    uint16_t length;
+} LogEntryHeader;
+
+#define LOG(level, ...) do { \
+    if ((level) >= OLDNES_LOG_LEVEL) { \
+        static struct LogSite log_site; \
+        write_log(&log_site, (level), __VA_ARGS__); \
+    } \
+} while (0)
+
+void write_log(struct LogSite* site, enum LogLevel level, const char* fmt, ...);
+
+// Until a writer is started, and after it stops, messages are written synchronously to stdout.
+// A .bin path selects LOG_BINARY output, NULL means text on stdout
+bool start_log_writer(const char* path);
+void stop_log_writer(void);
 
 #endif //OLDNES_LOG_H
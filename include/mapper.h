@@ -2,6 +2,11 @@
 #define OLDNES_MAPPER_H
 
 #include "definitions.h"
+#include "rom.h"
+#include "page.h"
+
+#define CHR_RAM_SIZE 0x2000
+#define MAPPER_REGISTERS 16
 
 typedef enum Mirroring {
     VERTICAL,
@@ -22,29 +27,64 @@ typedef enum MapperID {
     GNROM = 66,
 } MapperID;
 
+struct Emulator;
+
+// Bank, mirroring and IRQ registers, kept together so save states copy them in one go.
+// irq_cycle is the CPU cycle the IRQ counter was last brought up to date at.
+typedef struct MapperState {
+    Mirroring mirroring;
+    byte registers[MAPPER_REGISTERS];
+    byte irq_counter;
+    byte irq_latch;
+    bool irq_enabled;
+    bool irq_reload;
+    uint64_t irq_cycle;
+} MapperState;
+
+// chr_size is the size of whichever CHR memory the cartridge has: a whole number of 1KB banks of ROM,
+// or RAM rounded up to a power of two that its addresses are masked to
 typedef struct Mapper {
-    byte* prg_rom;
-    byte* chr_rom;
-    byte  prg_banks;
-    byte  chr_banks;
+    struct MapperState state;
+
+    struct RomImage* rom;
+    const byte* prg_rom;
+    const byte* chr_rom;
+    struct PageTable chr_ram;
+    usize prg_banks;
+    usize chr_banks;
+    usize chr_size;
     usize clamp;
 
-    MapperID  mapper_id;
-    Mirroring mirroring;
+    // Derived from the bank registers by restore. Every mapper fills chr_offsets, which the PPU bus maps
+    // its pattern table pages from; prg_offsets only matter to mappers that switch 8KB PRG banks.
+    usize prg_offsets[4];
+    usize chr_offsets[8];
+    struct Emulator* emulator;
+
+    MapperID mapper_id;
+    byte     submapper;
 
     byte (*read_prg)(const struct Mapper* mapper, word address);
     byte (*read_chr)(const struct Mapper* mapper, word address);
     void (*write_prg)(struct Mapper* mapper, word address, byte value);
     void (*write_chr)(struct Mapper* mapper, word address, byte value);
 
-    void (*scanline_irq)(struct Mapper* mapper);
+    word (*prg_bank)(const struct Mapper* mapper, word address);
+    void (*restore)(struct Mapper* mapper);
+
+    // Mapper IRQs are predicted rather than polled: sync catches the IRQ state up to the current
+    // CPU cycle and next_event gives the cycle the next IRQ is due at, or UINT64_MAX for none
+    void (*sync)(struct Mapper* mapper);
+    uint64_t (*next_event)(const struct Mapper* mapper);
 } Mapper;
 
-void load_mapper(const char* filename, struct Mapper* mapper);
+RomError load_mapper(struct RomImage* rom, struct Mapper* mapper);
 void free_mapper(struct Mapper* mapper);
+bool is_mapper_supported(word mapper_id);
 
 void load_UXROM(struct Mapper* mapper);
 void load_MMC1(struct Mapper* mapper);
 void load_CNROM(struct Mapper* mapper);
+bool load_MMC3(struct Mapper* mapper);
 
 #endif //OLDNES_MAPPER_H
@@ -0,0 +1,75 @@
+#ifndef OLDNES_MOVIE_H
+#define OLDNES_MOVIE_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+
+#define MOVIE_MAGIC   0x564d4e4f // "ONMV"
+#define MOVIE_VERSION 2
+
+// Fields are written one by one, little-endian, so these are the sizes on disk rather than in memory.
+// A run is pad 1, pad 2 and the number of frames they were held for.
+#define MOVIE_HEADER_SIZE 32
+#define MOVIE_RUN_SIZE    4
+#define MOVIE_CHECK_SIZE  27
+
+// Checks are kept once a second, enough to catch a desync early without one per frame dwarfing the inputs
+#define MOVIE_CHECK_INTERVAL 60
+
+struct Emulator;
+
+typedef enum MovieFlags {
+    MOVIE_CHECKS = 1,
+} MovieFlags;
+
+typedef struct MovieHeader {
+    usize    magic;
+    word     version;
+    word     flags;
+    uint64_t rom_hash;
+    usize    frames;
+    usize    runs;
+    usize    state_size;
+    usize    check_interval;
+} MovieHeader;
+
+// What the emulator looked like after a checked frame, so playback can point at the first difference
+typedef struct MovieCheck {
+    uint64_t hash;
+    word pc;
+    byte a, x, y, sp, status;
+    byte fine_x;
+    byte ctrl, mask, stat;
+    word vram, temp;
+    word scanline, cycle;
+} MovieCheck;
+
+typedef struct Movie {
+    uint64_t rom_hash;
+    byte* initial_state;
+    usize initial_state_size;
+
+    // One input per frame in memory: pad1 in the low byte, pad2 in the high byte. Check i is of
+    // frame i * check_interval.
+    word* inputs;
+    struct MovieCheck* checks;
+    usize frames;
+    usize capacity;
+    usize check_interval;
+} Movie;
+
+void init_movie(struct Movie* movie);
+void free_movie(struct Movie* movie);
+
+bool save_movie(const struct Movie* movie, const char* path);
+bool load_movie(struct Movie* movie, const char* path);
+
+bool start_recording(struct Movie* movie, const struct Emulator* emulator);
+bool record_frame(struct Movie* movie, const struct Emulator* emulator);
+
+bool start_playback(struct Movie* movie, struct Emulator* emulator);
+void apply_movie_input(const struct Movie* movie, usize frame, struct Emulator* emulator);
+bool verify_frame(const struct Movie* movie, usize frame, const struct Emulator* emulator, FILE* out);
+
+#endif //OLDNES_MOVIE_H
@@ -0,0 +1,47 @@
+#ifndef OLDNES_OLDNES_H
+#define OLDNES_OLDNES_H
+
+#include "definitions.h"
+#include "state.h"
+
+#define OLDNES_RAM_SIZE     0x0800
+#define OLDNES_FRAME_WIDTH  256
+#define OLDNES_FRAME_HEIGHT 240
+
+struct Emulator;
+struct RomImage;
+struct RewindBuffer;
+struct Batch;
+
+struct Emulator* oldnes_create(void);
+void oldnes_destroy(struct Emulator* emulator);
+struct Emulator* oldnes_fork(struct Emulator* parent);
+
+bool oldnes_load_rom(struct Emulator* emulator, const byte* data, usize size);
+bool oldnes_load_rom_image(struct Emulator* emulator, struct RomImage* rom);
+void oldnes_set_input(struct Emulator* emulator, byte player, byte buttons);
+void oldnes_run_frame(struct Emulator* emulator);
+bool oldnes_out_of_memory(const struct Emulator* emulator);
+
+const usize* oldnes_get_framebuffer(struct Emulator* emulator);
+void oldnes_read_ram(const struct Emulator* emulator, byte buffer[OLDNES_RAM_SIZE]);
+struct FrameHash oldnes_hash_frame(const struct Emulator* emulator);
+
+usize oldnes_state_size(const struct Emulator* emulator);
+usize oldnes_save_state(const struct Emulator* emulator, byte* buffer, usize capacity);
+bool oldnes_load_state(struct Emulator* emulator, const byte* buffer, usize size);
+
+struct RewindBuffer* oldnes_create_rewind(usize budget);
+void oldnes_destroy_rewind(struct RewindBuffer* rewind);
+void oldnes_capture_rewind(struct RewindBuffer* rewind, const struct Emulator* emulator);
+bool oldnes_rewind(struct RewindBuffer* rewind, struct Emulator* emulator);
+
+// Steps count distinct emulators by frames each, holding actions[i][0] and [1] on the pads of instance i.
+// Observations land in [count][240][256] bytes of palette indices, or 0xRRGGBB pixels of usize when rgb
+// is set, and RAM in [count][2048] bytes; either buffer may be NULL. workers 0 uses every core.
+struct Batch* oldnes_create_batch(usize workers);
+void oldnes_destroy_batch(struct Batch* batch);
+void oldnes_batch_step(struct Batch* batch, struct Emulator* const* envs, usize count, const byte* actions,
+                       usize frames, void* observations, bool rgb, byte ram[][OLDNES_RAM_SIZE]);
+
+#endif //OLDNES_OLDNES_H
@@ -0,0 +1,64 @@
+#ifndef OLDNES_PAGE_H
+#define OLDNES_PAGE_H
+
+#include <stdatomic.h>
+
+#include "definitions.h"
+
+#define PAGE_SIZE  0x100
+#define PAGE_SHIFT 8
+#define PAGE_MASK  0xff
+#define MAX_PAGES  32
+
+// 256 bytes of memory, shared by forked emulators until one of them writes to it
+typedef struct Page {
+    atomic_uint refs;
+    byte data[PAGE_SIZE];
+} Page;
+
+// A block of memory split into pages. Bit i of owned is set once page i is private to this instance.
+// failed is set once a write was dropped because a shared page could not be copied.
+typedef struct PageTable {
+    struct Page* pages[MAX_PAGES];
+    usize count;
+    usize owned;
+    bool failed;
+} PageTable;
+
+void init_page_table(struct PageTable* table, usize size);
+void free_page_table(struct PageTable* table);
+void share_page_table(struct PageTable* table, struct PageTable* parent);
+void clear_page_table(struct PageTable* table);
+
+byte* claim_page(struct PageTable* table, usize index);
+
+void read_pages(const struct PageTable* table, byte* buffer);
+void write_pages(struct PageTable* table, const byte* buffer);
+
+static inline usize get_page_table_size(const struct PageTable* table) {
+    return table->count * PAGE_SIZE;
+}
+
+static inline const byte* get_page(const struct PageTable* table, usize index) {
+    return table->pages[index]->data;
+}
+
+static inline byte* get_writable_page(struct PageTable* table, usize index) {
+    if (table->owned & (1u << index)) {
+        return table->pages[index]->data;
+    }
+    return claim_page(table, index);
+}
+
+static inline byte read_page_table(const struct PageTable* table, usize address) {
+    return table->pages[address >> PAGE_SHIFT]->data[address & PAGE_MASK];
+}
+
+static inline void write_page_table(struct PageTable* table, usize address, byte value) {
+    byte* page = get_writable_page(table, address >> PAGE_SHIFT);
+    if (page != NULL) {
+        page[address & PAGE_MASK] = value;
+    }
+}
+
+#endif //OLDNES_PAGE_H
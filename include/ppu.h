@@ -3,6 +3,7 @@
 
 #include "definitions.h"
 #include "ppu_bus.h"
+#include "page.h"
 
 #define SCANLINE_CYCLE_LENGTH 341
 #define SCANLINE_CYCLE_END    340
@@ -31,14 +32,14 @@ typedef union PPUCtrl {
 
 typedef union PPUMask {
     struct {
-        byte grey_scale      : 1;
-        byte hide_background : 1;
-        byte hide_sprites    : 1;
-        byte show_background : 1;
-        byte show_sprites    : 1;
-        byte emphasize_red   : 1;
-        byte emphasize_green : 1;
-        byte emphasize_blue  : 1;
+        byte grey_scale           : 1;
+        byte show_background_left : 1;
+        byte show_sprites_left    : 1;
+        byte show_background      : 1;
+        byte show_sprites         : 1;
+        byte emphasize_red        : 1;
+        byte emphasize_green      : 1;
+        byte emphasize_blue       : 1;
     };
     byte value;
 } PPUMask;
@@ -78,10 +79,21 @@ typedef struct Sprite {
 
 struct Emulator;
 
+// Palette indices as rendered, shared by forked emulators until one of them draws a line
+typedef struct Frame {
+    atomic_uint refs;
+    byte pixels[SCREEN_SIZE];
+} Frame;
+
 typedef struct PPU {
-    usize screen_buffer[SCREEN_SIZE];
+    // Output, not part of save states. RGBA is only produced on request. Lines are not drawn while
+    // the frame is shared and a copy of it could not be allocated, which sets out_of_memory.
+    struct Frame* frame;
+    usize* screen_buffer;
+    bool   frame_owned;
+    bool   screen_dirty;
+    bool   out_of_memory;
 
-    byte oam[OAM_SIZE];
     byte oam_cache[OAM_CACHE_SIZE];
     byte oam_cache_len;
 
@@ -102,27 +114,24 @@ typedef struct PPU {
     bool render;
     bool even_frame;
 
+    // Paged memory and links, not part of the plain section of save states
+    struct PageTable oam;
     struct PPUBus*   bus;
     struct Emulator* emulator;
 } PPU;
 
-static const usize PALETTE[0x40] = {
-        0xff545454, 0xff001e74, 0xff081090, 0xff300088, 0xff440064, 0xff5c0030, 0xff540400, 0xff3c1800,
-        0xff202a00, 0xff083a00, 0xff004000, 0xff003c00, 0xff00323c, 0xff000000, 0xff000000, 0xff000000,
-        0xff989698, 0xff084cc4, 0xff3032ec, 0xff5c1ee4, 0xff8814b0, 0xffa01464, 0xff982220, 0xff783c00,
-        0xff545a00, 0xff287200, 0xff087c00, 0xff007628, 0xff006678, 0xff000000, 0xff000000, 0xff000000,
-        0xffeceeec, 0xff4c9aec, 0xff787cec, 0xffb062ec, 0xffe454ec, 0xffec58b4, 0xffec6a64, 0xffd48820,
-        0xffa0aa00, 0xff74c400, 0xff4cd020, 0xff38cc6c, 0xff38b4cc, 0xff3c3c3c, 0xff000000, 0xff000000,
-        0xffeceeec, 0xffa8ccec, 0xffbcbcec, 0xffd4b2ec, 0xffecaeec, 0xffecaed4, 0xffecb4b0, 0xffe4c490,
-        0xffccd278, 0xffb4de78, 0xffa8e290, 0xff98e2b4, 0xffa0d6e4, 0xffa0a2a0, 0xff000000, 0xff000000,
-};
+extern const usize PALETTE[0x40];
 
 void init_ppu(struct Emulator* emulator);
+void free_ppu(struct PPU* ppu);
+void share_ppu_frame(struct PPU* ppu, struct PPU* parent);
 
 void reset_ppu(struct PPU* ppu);
 void execute_ppu(struct PPU* ppu);
 
-void dma(struct PPU* ppu, byte address);
+void dma(struct PPU* ppu, byte page);
+
+const usize* get_screen_buffer(struct PPU* ppu);
 
 byte read_ppu(struct PPU* ppu);
 byte read_status(struct PPU* ppu);
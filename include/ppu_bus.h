@@ -3,19 +3,48 @@
 
 #include "definitions.h"
 #include "mapper.h"
+#include "page.h"
+
+#define VRAM_SIZE             0x0800
+#define FOUR_SCREEN_VRAM_SIZE 0x1000
+
+// Pages of PPU address space below the palette, which mirrors within its own page
+#define PPU_PAGES 0x3f
 
 struct Emulator;
+struct BusStats;
 
 typedef struct PPUBus {
-    byte vram[0x800];
     byte palette[0x20];
     word nametable[4];
+
+    // Paged memory and links, not part of the plain section of save states
+    struct PageTable vram;
     struct Mapper* mapper;
+
+    // Where each page of pattern tables and nametables currently reads from, with mirroring and
+    // banking already applied. Rebuilt by map_ppu_pages whenever either changes or a page is claimed.
+    const byte* pages[PPU_PAGES];
+#ifdef OLDNES_BUS_STATS
+    struct BusStats* stats;
+#endif
 } PPUBus;
 
 void init_ppu_bus(struct Emulator* emulator);
+void free_ppu_bus(struct PPUBus* bus);
+void set_mirroring(struct PPUBus* bus);
+void map_ppu_pages(struct PPUBus* bus);
 
 byte read_ppu_memory(const struct PPUBus* bus, word address);
 void write_ppu_memory(struct PPUBus* bus, word address, byte value);
 
+// Rendering fetches, which never touch the palette
+static inline byte fetch_ppu_memory(const struct PPUBus* bus, word address) {
+#ifdef OLDNES_BUS_STATS
+    return read_ppu_memory(bus, address);
+#else
+    return bus->pages[address >> PAGE_SHIFT][address & PAGE_MASK];
+#endif
+}
+
 #endif //OLDNES_PPU_BUS_H
@@ -0,0 +1,39 @@
+#ifndef OLDNES_PROFILER_H
+#define OLDNES_PROFILER_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+
+#define PROFILE_SLOTS 0x10000
+#define PROFILE_TOP   40
+
+struct CPU;
+
+// Instructions seen at one PC in one PRG bank, with the bytes they had when first seen
+typedef struct ProfileEntry {
+    usize key;
+    byte bytes[3];
+    uint64_t count;
+    uint64_t cycles;
+} ProfileEntry;
+
+typedef struct Profiler {
+    uint64_t opcode_count[0x100];
+    uint64_t opcode_cycles[0x100];
+    uint64_t total_count;
+    uint64_t total_cycles;
+
+    struct ProfileEntry* entries;
+    usize used;
+    uint64_t dropped;
+} Profiler;
+
+struct Profiler* create_profiler(void);
+void free_profiler(struct Profiler* profiler);
+void clear_profiler(struct Profiler* profiler);
+
+void record_instruction(struct Profiler* profiler, const struct CPU* cpu, word pc, byte opcode, byte cycles);
+void report_profile(const struct Profiler* profiler, FILE* out, usize top);
+
+#endif //OLDNES_PROFILER_H
@@ -0,0 +1,46 @@
+#ifndef OLDNES_REWIND_H
+#define OLDNES_REWIND_H
+
+#include "definitions.h"
+
+#define REWIND_DEFAULT_BUDGET   (64 * 1024 * 1024)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+struct Emulator;
+
+typedef struct RewindEntry {
+    usize offset;
+    usize length;
+    usize state_size;
+    bool keyframe;
+} RewindEntry;
+
+// Frames are stored as run-length coded XOR deltas against the keyframe that opens their group
+typedef struct RewindBuffer {
+    byte* data;
+    usize capacity;
+    usize write_offset;
+
+    struct RewindEntry* entries;
+    usize entry_capacity;
+    usize first_entry;
+    usize entry_count;
+
+    byte* keyframe;
+    usize keyframe_size;
+    byte* state;
+    byte* delta;
+    byte* encoded;
+    usize state_capacity;
+
+    usize keyframe_interval;
+    usize frames_since_keyframe;
+} RewindBuffer;
+
+bool init_rewind(struct RewindBuffer* rewind, usize budget, usize keyframe_interval);
+void free_rewind(struct RewindBuffer* rewind);
+
+void capture_rewind(struct RewindBuffer* rewind, const struct Emulator* emulator);
+bool rewind_emulator(struct RewindBuffer* rewind, struct Emulator* emulator);
+
+#endif //OLDNES_REWIND_H
@@ -0,0 +1,94 @@
+#ifndef OLDNES_ROM_H
+#define OLDNES_ROM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "definitions.h"
+
+#define INES_HEADER_SIZE 0x10
+#define TRAINER_SIZE     0x200
+
+typedef enum RomError {
+    ROM_OK = 0,
+    ROM_NOT_FOUND,
+    ROM_IO_ERROR,
+    ROM_OUT_OF_MEMORY,
+    ROM_BAD_MAGIC,
+    ROM_TRUNCATED,
+    ROM_UNSUPPORTED_MAPPER,
+    ROM_TOO_LARGE,
+    ROM_UNSUPPORTED_SIZE,
+} RomError;
+
+typedef enum RomFormat {
+    FORMAT_INES,
+    FORMAT_NES20,
+} RomFormat;
+
+typedef enum RomTiming {
+    TIMING_NTSC,
+    TIMING_PAL,
+    TIMING_MULTI,
+    TIMING_DENDY,
+} RomTiming;
+
+// Cartridge description decoded from an iNES 1.0 or NES 2.0 header
+typedef struct RomInfo {
+    RomFormat format;
+    word mapper_id;
+    byte submapper;
+    RomTiming timing;
+    byte console_type;
+
+    bool vertical_mirroring;
+    bool four_screen;
+    bool battery;
+    bool trainer;
+
+    usize prg_rom_size;
+    usize chr_rom_size;
+    usize prg_ram_size;
+    usize prg_nvram_size;
+    usize chr_ram_size;
+    usize chr_nvram_size;
+
+    usize trainer_offset;
+    usize prg_offset;
+    usize chr_offset;
+} RomInfo;
+
+struct RomCache;
+
+// Immutable ROM file contents shared by every emulator running it
+typedef struct RomImage {
+    char* path;
+    const byte* data;
+    usize size;
+    bool mapped;
+    struct RomInfo info;
+
+    atomic_size_t refs;
+    struct RomCache* cache;
+    struct RomImage* next;
+} RomImage;
+
+typedef struct RomCache {
+    pthread_mutex_t lock;
+    struct RomImage* images;
+} RomCache;
+
+void init_rom_cache(struct RomCache* cache);
+void free_rom_cache(struct RomCache* cache);
+
+struct RomImage* acquire_rom_image(struct RomCache* cache, const char* path, RomError* error);
+struct RomImage* load_rom_image(const char* path, RomError* error);
+struct RomImage* create_rom_image(const byte* data, usize size, RomError* error);
+
+struct RomImage* retain_rom_image(struct RomImage* image);
+void release_rom_image(struct RomImage* image);
+
+RomError parse_rom_header(const byte* data, usize size, struct RomInfo* info);
+const char* rom_error_string(RomError error);
+
+#endif //OLDNES_ROM_H
@@ -0,0 +1,93 @@
+#ifndef OLDNES_ROM_INDEX_H
+#define OLDNES_ROM_INDEX_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+#include "checksum.h"
+#include "rom.h"
+
+#define ROM_INDEX_MAGIC   0x58494e4f // "ONIX"
+#define ROM_INDEX_VERSION 1
+
+typedef enum RomFixFields {
+    FIX_MAPPER    = 1 << 0,
+    FIX_SUBMAPPER = 1 << 1,
+    FIX_MIRRORING = 1 << 2,
+    FIX_BATTERY   = 1 << 3,
+    FIX_TIMING    = 1 << 4,
+    FIX_PRG_RAM   = 1 << 5,
+} RomFixFields;
+
+// Header fields to override for a dump whose CRC32 matches. Sizes and offsets are never corrected,
+// since a header that gets those wrong does not parse in the first place.
+typedef struct RomFix {
+    usize crc32;
+    usize fields;
+    word mapper_id;
+    byte submapper;
+    bool vertical_mirroring;
+    bool four_screen;
+    bool battery;
+    RomTiming timing;
+    usize prg_ram_size;
+} RomFix;
+
+// One ROM file as of its last scan. CRC32 and SHA-1 cover everything after the 16-byte header,
+// which is how ROM databases identify dumps. info is what the header says, fix what to change.
+typedef struct RomIndexEntry {
+    usize path;
+    usize crc32;
+    byte sha1[SHA1_SIZE];
+    uint64_t size;
+    int64_t mtime;
+    RomError status;
+    bool supported;
+    struct RomInfo info;
+    struct RomFix fix;
+} RomIndexEntry;
+
+// File layout: this header, the entries sorted by path, then the NUL-terminated paths they point into.
+// Entries are written as the structs above, so an index is only read by the build that wrote it.
+typedef struct RomIndexHeader {
+    usize magic;
+    word  version;
+    word  entry_size;
+    usize count;
+    usize strings_size;
+} RomIndexHeader;
+
+// A read-only mapping of an index file
+typedef struct RomIndex {
+    const byte* data;
+    usize size;
+    const struct RomIndexEntry* entries;
+    usize count;
+    const char* strings;
+} RomIndex;
+
+typedef struct RomIndexStats {
+    usize files;
+    usize reused;
+    usize hashed;
+    usize fixed;
+    usize unsupported;
+    uint64_t bytes;
+    double seconds;
+} RomIndexStats;
+
+bool open_rom_index(struct RomIndex* index, const char* path);
+void close_rom_index(struct RomIndex* index);
+
+const struct RomIndexEntry* find_rom_index_entry(const struct RomIndex* index, const char* path);
+const char* get_rom_index_path(const struct RomIndex* index, const struct RomIndexEntry* entry);
+bool apply_rom_index(const struct RomIndex* index, struct RomImage* image);
+
+bool load_rom_fixes(const char* path, struct RomFix** fixes, usize* count);
+void apply_rom_fix(const struct RomFix* fix, struct RomInfo* info);
+
+bool update_rom_index(const char* index_path, const char* directory, const struct RomFix* fixes, usize fix_count,
+                      usize workers, struct RomIndexStats* stats);
+void report_rom_index(const struct RomIndex* index, FILE* out);
+
+#endif //OLDNES_ROM_INDEX_H
@@ -0,0 +1,38 @@
+#ifndef OLDNES_RUN_AHEAD_H
+#define OLDNES_RUN_AHEAD_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+
+#define RUN_AHEAD_MAX_FRAMES 8
+#define RUN_AHEAD_FRAME_TIME (1.0 / 60.0988)
+
+struct Emulator;
+
+// Shows the frame N frames in the future, emulated with the input held right now
+typedef struct RunAhead {
+    byte* state;
+    usize state_capacity;
+    byte frames;
+
+    // Input seen on the last frames, to check how often holding it was the right guess
+    word inputs[RUN_AHEAD_MAX_FRAMES + 1];
+    usize input_count;
+
+    usize displayed;
+    usize emulated;
+    usize predictions;
+    usize hits;
+    usize over_budget;
+    double seconds;
+    double worst_seconds;
+} RunAhead;
+
+bool init_run_ahead(struct RunAhead* run_ahead, byte frames);
+void free_run_ahead(struct RunAhead* run_ahead);
+
+void run_frame_ahead(struct RunAhead* run_ahead, struct Emulator* emulator);
+void report_run_ahead(const struct RunAhead* run_ahead, FILE* out);
+
+#endif //OLDNES_RUN_AHEAD_H
@@ -0,0 +1,123 @@
+#ifndef OLDNES_SERVICE_H
+#define OLDNES_SERVICE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "definitions.h"
+#include "rom.h"
+#include "ppu.h"
+#include "cpu_bus.h"
+#include "thread_pool.h"
+
+#define SERVICE_MAGIC       0x44534e4f // "ONSD"
+#define SERVICE_MAX_PAYLOAD 0x1000
+
+// Each session shares one memory block with its client, handed over as a file descriptor when the
+// session is created. Frames, RAM and save states are written there and only their sizes sent.
+#define SERVICE_FRAME_OFFSET 0
+#define SERVICE_FRAME_SIZE   (SCREEN_SIZE * sizeof(usize))
+#define SERVICE_RAM_OFFSET   (SERVICE_FRAME_OFFSET + SERVICE_FRAME_SIZE)
+#define SERVICE_STATE_OFFSET (SERVICE_RAM_OFFSET + RAM_SIZE)
+
+// Requests carry a session id and one argument, plus a payload where noted:
+//   CREATE   payload: ROM path. Replies with the new session id, the shared block size as value, and its fd.
+//   LOAD     payload: ROM path. Restarts the session on another ROM.
+//   STEP     argument: frames. payload: pad 1 and pad 2 bytes per frame, the last pair held to the end.
+//   FRAME    argument: 0 for palette indices, 1 for 0xRRGGBB pixels. value: bytes written.
+//   RAM      value: bytes written.
+//   SAVE     value: size of the state written at SERVICE_STATE_OFFSET.
+//   RESTORE  argument: size of the state at SERVICE_STATE_OFFSET.
+//   STATS    replies with a ServiceStats payload.
+//   DESTROY
+typedef enum ServiceCommand {
+    SERVICE_CREATE = 1,
+    SERVICE_LOAD,
+    SERVICE_STEP,
+    SERVICE_FRAME,
+    SERVICE_RAM,
+    SERVICE_SAVE,
+    SERVICE_RESTORE,
+    SERVICE_STATS,
+    SERVICE_DESTROY,
+} ServiceCommand;
+
+typedef enum ServiceStatus {
+    SERVICE_OK = 0,
+    SERVICE_BAD_REQUEST,
+    SERVICE_NO_SESSION,
+    SERVICE_ROM_ERROR,
+    SERVICE_STATE_ERROR,
+    SERVICE_OUT_OF_MEMORY,
+} ServiceStatus;
+
+// Messages are native-endian; the socket never leaves the machine
+typedef struct ServiceRequest {
+    usize magic;
+    word  command;
+    word  reserved;
+    usize session;
+    usize argument;
+    usize length;
+} ServiceRequest;
+
+typedef struct ServiceResponse {
+    usize status;
+    usize session;
+    usize value;
+    usize length;
+} ServiceResponse;
+
+typedef struct ServiceStats {
+    uint64_t frames;
+    uint64_t requests;
+    uint64_t cpu_nanoseconds;
+} ServiceStats;
+
+struct Emulator;
+struct Connection;
+
+typedef struct Session {
+    usize id;
+    struct Emulator* emulator;
+    byte* shared;
+    usize shared_size;
+    int shared_fd;
+    // RESTORE copies the state here first, so the client cannot change it while it is checked and loaded
+    byte* restore;
+    struct ServiceStats stats;
+    struct Session* next;
+} Session;
+
+// One client socket. Its requests are served one at a time on the worker pool, and the socket
+// is left out of the poll set until the response is sent. received counts the bytes of the
+// request in progress, header first, so one can be read across several polls.
+typedef struct Connection {
+    int fd;
+    atomic_bool busy;
+    struct ServiceRequest request;
+    byte payload[SERVICE_MAX_PAYLOAD + 1];
+    usize received;
+    struct Session* sessions;
+    struct Service* service;
+    struct Connection* next;
+} Connection;
+
+typedef struct Service {
+    int listen_fd;
+    int wake_fds[2];
+    char* path;
+    struct Connection* connections;
+    struct RomCache roms;
+    struct ThreadPool pool;
+    atomic_size_t next_session;
+    atomic_bool stop;
+} Service;
+
+bool init_service(struct Service* service, const char* path, usize workers);
+void free_service(struct Service* service);
+void run_service(struct Service* service);
+void stop_service(struct Service* service);
+
+#endif //OLDNES_SERVICE_H
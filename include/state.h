@@ -0,0 +1,39 @@
+#ifndef OLDNES_STATE_H
+#define OLDNES_STATE_H
+
+#include "definitions.h"
+
+#define STATE_MAGIC   0x54534e4f // "ONST"
+#define STATE_VERSION 7
+
+typedef enum StateFlags {
+    STATE_CHR_RAM = 1,
+    STATE_PRG_RAM = 2,
+    STATE_FOUR_SCREEN = 4,
+} StateFlags;
+
+typedef struct StateHeader {
+    usize magic;
+    word  version;
+    word  flags;
+    usize size;
+    usize sections;
+} StateHeader;
+
+// Fingerprint of one frame: the palette-index picture plus CPU RAM and nametable VRAM
+typedef struct FrameHash {
+    uint64_t screen;
+    uint64_t ram;
+    uint64_t vram;
+} FrameHash;
+
+struct Emulator;
+
+usize get_state_size(const struct Emulator* emulator);
+usize get_max_state_size(void);
+usize save_state(const struct Emulator* emulator, byte* buffer, usize capacity);
+bool load_state(struct Emulator* emulator, const byte* buffer, usize size);
+uint64_t hash_state(const struct Emulator* emulator);
+struct FrameHash hash_frame(const struct Emulator* emulator);
+
+#endif //OLDNES_STATE_H
@@ -0,0 +1,47 @@
+#ifndef OLDNES_THREAD_POOL_H
+#define OLDNES_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "definitions.h"
+
+typedef void (*TaskFunction)(void* context);
+
+typedef struct Task {
+    TaskFunction function;
+    void* context;
+} Task;
+
+// Per-worker deque. The owner pushes and pops at the tail, thieves take from the head.
+typedef struct TaskQueue {
+    pthread_mutex_t lock;
+    Task* tasks;
+    usize head;
+    usize tail;
+    usize capacity;
+} TaskQueue;
+
+typedef struct ThreadPool {
+    pthread_t* threads;
+    struct TaskQueue* queues;
+    usize workers;
+    usize next_queue;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  idle;
+    atomic_size_t queued;
+    atomic_size_t pending;
+    bool stop;
+} ThreadPool;
+
+bool init_thread_pool(struct ThreadPool* pool, usize workers);
+void free_thread_pool(struct ThreadPool* pool);
+
+void submit_task(struct ThreadPool* pool, TaskFunction function, void* context);
+void wait_thread_pool(struct ThreadPool* pool);
+
+usize get_cpu_count(void);
+
+#endif //OLDNES_THREAD_POOL_H
@@ -0,0 +1,67 @@
+#ifndef OLDNES_TIMING_H
+#define OLDNES_TIMING_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define TIMING_HISTORY         600
+#define TIMING_SAMPLE_INTERVAL 16
+
+typedef enum TimingSection {
+    TIMING_INPUT,
+    TIMING_CPU,
+    TIMING_PPU,
+    TIMING_PRESENT,
+    TIMING_PACING,
+    TIMING_SECTIONS,
+} TimingSection;
+
+// Wall time spent in each part of the main loop, kept per frame for the last TIMING_HISTORY frames
+typedef struct FrameTiming {
+    uint64_t history[TIMING_HISTORY][TIMING_SECTIONS];
+    uint64_t current[TIMING_SECTIONS];
+    usize frames;
+    double ticks_per_ms;
+
+    // CPU and PPU steps interleave far too finely to time every one, so run_frame only
+    // times every TIMING_SAMPLE_INTERVAL-th step and splits the whole frame by that ratio
+    uint64_t sampled_cpu;
+    uint64_t sampled_ppu;
+
+    FILE* csv;
+} FrameTiming;
+
+static inline uint64_t read_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+bool init_frame_timing(struct FrameTiming* timing, const char* csv_path);
+void free_frame_timing(struct FrameTiming* timing);
+
+// Charges the ticks since start to a section and returns the current tick, ready to start the next one.
+// Both do nothing when timing is NULL, so callers need not check whether it is enabled
+uint64_t lap_frame_timing(struct FrameTiming* timing, TimingSection section, uint64_t start);
+uint64_t lap_emulation_timing(struct FrameTiming* timing, uint64_t start);
+void split_frame_timing(struct FrameTiming* timing, uint64_t start);
+void end_frame_timing(struct FrameTiming* timing);
+
+double get_frame_time(const struct FrameTiming* timing, usize frames_ago, TimingSection section);
+double get_timing_percentile(const struct FrameTiming* timing, TimingSection section, double percentile);
+void report_frame_timing(const struct FrameTiming* timing, FILE* out);
+
+const char* timing_section_string(TimingSection section);
+
+#endif //OLDNES_TIMING_H
@@ -0,0 +1,58 @@
+#ifndef OLDNES_TRACE_H
+#define OLDNES_TRACE_H
+
+#include <stdio.h>
+
+#include "definitions.h"
+
+#define TRACE_MAGIC    0x43525454 // "TTRC"
+#define TRACE_VERSION  1
+#define TRACE_RECORDS  (1 << 20)
+
+// Only the low bits of the CPU cycle fit, the file header holds the full count of the newest record
+#define TRACE_DOT_BITS   9
+#define TRACE_CYCLE_BITS (32 - TRACE_DOT_BITS)
+
+struct CPU;
+
+// One instruction, as it was about to execute
+typedef struct TraceRecord {
+    word pc;
+    byte opcode;
+    byte operands[2];
+    byte a, x, y, p, sp;
+    word scanline;
+    uint32_t cycle_dot;
+} TraceRecord;
+
+_Static_assert(sizeof(struct TraceRecord) == 16, "Trace records are 16 bytes");
+
+typedef struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t records;
+    uint64_t last_cycle;
+} TraceHeader;
+
+typedef struct TraceRing {
+    struct TraceRecord* records;
+    usize mask;
+    uint64_t count;
+    uint64_t last_cycle;
+} TraceRing;
+
+// Size is rounded up to a power of two
+struct TraceRing* create_trace_ring(usize records);
+void free_trace_ring(struct TraceRing* ring);
+
+void trace_instruction(struct TraceRing* ring, const struct CPU* cpu, word pc, byte opcode);
+bool save_trace(const struct TraceRing* ring, const char* path);
+
+// Saves the ring to path if the process dies on SIGSEGV, SIGBUS, SIGILL, SIGFPE or SIGABRT
+void dump_trace_on_crash(struct TraceRing* ring, const char* path);
+
+bool load_trace(const char* path, struct TraceHeader* header, struct TraceRecord** records);
+void unwrap_trace_cycles(const struct TraceRecord* records, usize count, uint64_t last_cycle, uint64_t* cycles);
+void format_trace_record(char* out, usize size, const struct TraceRecord* record, uint64_t cycle);
+
+#endif //OLDNES_TRACE_H
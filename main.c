@@ -1,9 +1,15 @@
-#include "emulator.h"
+#include <stdlib.h>
+
+#include "frontend.h"
+#include "log.h"
 
 int main(int argc, char* argv[]) {
-    struct Emulator emulator;
-    init_emulator(&emulator, argc, argv);
-    run_emulator(&emulator);
-    free_emulator(&emulator);
+    static struct Frontend frontend;
+    if (!init_frontend(&frontend, argc, argv)) {
+        return EXIT_FAILURE;
+    }
+    run_frontend(&frontend);
+    free_frontend(&frontend);
+    stop_log_writer();
     return 0;
 }
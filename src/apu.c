@@ -0,0 +1,519 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "emulator.h"
+#include "log.h"
+
+#define FRAME_FIRST_STEP 7457
+
+static const byte LENGTH_TABLE[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const byte DUTY_TABLE[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const byte TRIANGLE_TABLE[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+};
+
+// NTSC periods, in CPU cycles
+static const word NOISE_PERIODS[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const word DMC_RATES[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// CPU cycles from each frame counter step to the next, the last one wrapping to the first step
+static const word FRAME_STEPS[2][5] = {
+    { 7456, 7458, 7458, 7458, 0    },
+    { 7456, 7458, 7458, 7452, 7458 },
+};
+
+static void clock_frame_counter(struct APU* apu);
+static void clock_quarter_frame(struct APU* apu);
+static void clock_half_frame(struct APU* apu);
+static void clock_envelope(struct Envelope* envelope);
+static void clock_sweep(struct Pulse* pulse);
+
+static void step_pulse(struct Pulse* pulse);
+static void step_triangle(struct Triangle* triangle);
+static void step_noise(struct Noise* noise);
+static void step_dmc(struct APU* apu);
+static void fetch_dmc(struct APU* apu);
+static void restart_dmc(struct DMC* dmc);
+
+static void arm_timers(struct APU* apu);
+static void mix(struct APU* apu);
+static void update_irq(struct APU* apu);
+
+static byte pulse_output(const struct Pulse* pulse);
+static word sweep_target(const struct Pulse* pulse);
+static byte envelope_output(const struct Envelope* envelope);
+
+bool init_apu(struct Emulator* emulator) {
+    struct APU* apu = &emulator->apu;
+    memset(apu, 0, sizeof(struct APU));
+    apu->emulator = emulator;
+    apu->blip = malloc(sizeof(struct Blip));
+    if (apu->blip == NULL) {
+        LOG(ERROR, "Could not allocate the audio buffer");
+        return false;
+    }
+    init_blip(apu->blip, APU_CLOCK_RATE, APU_SAMPLE_RATE);
+
+    apu->pulse[1].index = 1;
+    apu->noise.shift = 1;
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+    apu->dmc.sample_length = 1;
+    apu->frame_timer = FRAME_FIRST_STEP;
+    arm_timers(apu);
+    return true;
+}
+
+void free_apu(struct APU* apu) {
+    free(apu->blip);
+    apu->blip = NULL;
+}
+
+void sync_apu(struct APU* apu, uint64_t cycle) {
+    while (apu->cycle < cycle) {
+        // Jump straight to whichever of the target, the frame counter or a channel timer comes first
+        const uint64_t remaining = cycle - apu->cycle;
+        uint32_t step = remaining < APU_TIMER_IDLE ? (uint32_t)remaining : APU_TIMER_IDLE - 1;
+        step = apu->frame_timer < step ? apu->frame_timer : step;
+        step = apu->pulse[0].timer < step ? apu->pulse[0].timer : step;
+        step = apu->pulse[1].timer < step ? apu->pulse[1].timer : step;
+        step = apu->triangle.timer < step ? apu->triangle.timer : step;
+        step = apu->noise.timer < step ? apu->noise.timer : step;
+        step = apu->dmc.timer < step ? apu->dmc.timer : step;
+
+        apu->cycle += step;
+        apu->frame_timer -= step;
+        bool changed = false;
+        if (apu->pulse[0].timer != APU_TIMER_IDLE && (apu->pulse[0].timer -= step) == 0) {
+            step_pulse(&apu->pulse[0]);
+            changed = true;
+        }
+        if (apu->pulse[1].timer != APU_TIMER_IDLE && (apu->pulse[1].timer -= step) == 0) {
+            step_pulse(&apu->pulse[1]);
+            changed = true;
+        }
+        if (apu->triangle.timer != APU_TIMER_IDLE && (apu->triangle.timer -= step) == 0) {
+            step_triangle(&apu->triangle);
+            changed = true;
+        }
+        if (apu->noise.timer != APU_TIMER_IDLE && (apu->noise.timer -= step) == 0) {
+            step_noise(&apu->noise);
+            changed = true;
+        }
+        if (apu->dmc.timer != APU_TIMER_IDLE && (apu->dmc.timer -= step) == 0) {
+            step_dmc(apu);
+            changed = true;
+        }
+        if (apu->frame_timer == 0) {
+            clock_frame_counter(apu);
+            changed = true;
+        }
+        if (changed) {
+            mix(apu);
+        }
+    }
+    schedule_events(apu->emulator);
+}
+
+void end_apu_frame(struct APU* apu) {
+    sync_apu(apu, apu->emulator->cpu.cycles);
+    if (apu->blip != NULL) {
+        end_blip_frame(apu->blip, (usize)(apu->cycle - apu->frame_cycle));
+    }
+    apu->frame_cycle = apu->cycle;
+}
+
+uint64_t next_apu_event(const struct APU* apu) {
+    uint64_t next = apu->cycle + apu->frame_timer;
+
+    // The last byte of a sample is fetched when the one before it leaves the buffer for the shifter
+    const struct DMC* dmc = &apu->dmc;
+    if (dmc->irq_enabled && !dmc->loop && dmc->remaining == 1 && dmc->timer != APU_TIMER_IDLE) {
+        const uint64_t fetch = apu->cycle + dmc->timer + (uint64_t)(dmc->bits - 1) * DMC_RATES[dmc->rate];
+        next = fetch < next ? fetch : next;
+    }
+    return next;
+}
+
+byte read_apu_status(struct APU* apu) {
+    sync_apu(apu, apu->emulator->cpu.cycles);
+    const byte status = (apu->pulse[0].length > 0)
+                      | (apu->pulse[1].length > 0) << 1
+                      | (apu->triangle.length > 0) << 2
+                      | (apu->noise.length > 0) << 3
+                      | (apu->dmc.remaining > 0) << 4
+                      | apu->frame_irq << 6
+                      | apu->dmc.irq << 7;
+    apu->frame_irq = false;
+    update_irq(apu);
+    return status;
+}
+
+void write_apu(struct APU* apu, word address, byte value) {
+    sync_apu(apu, apu->emulator->cpu.cycles);
+    struct Pulse* pulse = &apu->pulse[(address >> 2) & 1];
+    struct Triangle* triangle = &apu->triangle;
+    struct Noise* noise = &apu->noise;
+    struct DMC* dmc = &apu->dmc;
+    switch (address) {
+        case 0x4000:
+        case 0x4004:
+            pulse->duty = value >> 6;
+            pulse->envelope.loop = value & 0x20;
+            pulse->envelope.constant = value & 0x10;
+            pulse->envelope.volume = value & 0x0f;
+            break;
+        case 0x4001:
+        case 0x4005:
+            pulse->sweep_enabled = value & 0x80;
+            pulse->sweep_period = (value >> 4) & 0x07;
+            pulse->sweep_negate = value & 0x08;
+            pulse->sweep_shift = value & 0x07;
+            pulse->sweep_reload = true;
+            break;
+        case 0x4002:
+        case 0x4006:
+            pulse->period = (pulse->period & 0x700) | value;
+            break;
+        case 0x4003:
+        case 0x4007:
+            pulse->period = (pulse->period & 0x0ff) | (value & 0x07) << 8;
+            if (pulse->enabled) {
+                pulse->length = LENGTH_TABLE[value >> 3];
+            }
+            pulse->step = 0;
+            pulse->envelope.start = true;
+            break;
+        case 0x4008:
+            triangle->control = value & 0x80;
+            triangle->linear_period = value & 0x7f;
+            break;
+        case 0x400a:
+            triangle->period = (triangle->period & 0x700) | value;
+            break;
+        case 0x400b:
+            triangle->period = (triangle->period & 0x0ff) | (value & 0x07) << 8;
+            if (triangle->enabled) {
+                triangle->length = LENGTH_TABLE[value >> 3];
+            }
+            triangle->linear_reload = true;
+            break;
+        case 0x400c:
+            noise->envelope.loop = value & 0x20;
+            noise->envelope.constant = value & 0x10;
+            noise->envelope.volume = value & 0x0f;
+            break;
+        case 0x400e:
+            noise->mode = value & 0x80;
+            noise->period = value & 0x0f;
+            break;
+        case 0x400f:
+            if (noise->enabled) {
+                noise->length = LENGTH_TABLE[value >> 3];
+            }
+            noise->envelope.start = true;
+            break;
+        case 0x4010:
+            dmc->irq_enabled = value & 0x80;
+            dmc->irq = dmc->irq && dmc->irq_enabled;
+            dmc->loop = value & 0x40;
+            dmc->rate = value & 0x0f;
+            break;
+        case 0x4011:
+            dmc->level = value & 0x7f;
+            break;
+        case 0x4012:
+            dmc->sample_address = 0xc000 | value << 6;
+            break;
+        case 0x4013:
+            dmc->sample_length = (value << 4) | 1;
+            break;
+        case 0x4015:
+            apu->pulse[0].enabled = value & 0x01;
+            apu->pulse[1].enabled = value & 0x02;
+            triangle->enabled = value & 0x04;
+            noise->enabled = value & 0x08;
+            apu->pulse[0].length = apu->pulse[0].enabled ? apu->pulse[0].length : 0;
+            apu->pulse[1].length = apu->pulse[1].enabled ? apu->pulse[1].length : 0;
+            triangle->length = triangle->enabled ? triangle->length : 0;
+            noise->length = noise->enabled ? noise->length : 0;
+            dmc->irq = false;
+            if (!(value & 0x10)) {
+                dmc->remaining = 0;
+            } else if (dmc->remaining == 0) {
+                restart_dmc(dmc);
+                fetch_dmc(apu);
+            }
+            break;
+        case 0x4017:
+            apu->five_step = value & 0x80;
+            apu->irq_inhibit = value & 0x40;
+            apu->frame_irq = apu->frame_irq && !apu->irq_inhibit;
+            apu->frame_step = 0;
+            apu->frame_timer = FRAME_FIRST_STEP;
+            if (apu->five_step) {
+                clock_quarter_frame(apu);
+                clock_half_frame(apu);
+            }
+            break;
+        default:
+            break;
+    }
+    arm_timers(apu);
+    update_irq(apu);
+    mix(apu);
+    schedule_events(apu->emulator);
+}
+
+static void clock_frame_counter(struct APU* apu) {
+    const byte step = apu->frame_step;
+    if (!apu->five_step) {
+        clock_quarter_frame(apu);
+        if (step & 1) {
+            clock_half_frame(apu);
+        }
+        if (step == 3 && !apu->irq_inhibit) {
+            apu->frame_irq = true;
+            update_irq(apu);
+        }
+        apu->frame_step = (step + 1) & 3;
+    } else {
+        if (step != 3) {
+            clock_quarter_frame(apu);
+        }
+        if (step == 1 || step == 4) {
+            clock_half_frame(apu);
+        }
+        apu->frame_step = step == 4 ? 0 : step + 1;
+    }
+    apu->frame_timer = FRAME_STEPS[apu->five_step][step];
+    arm_timers(apu);
+}
+
+static void clock_quarter_frame(struct APU* apu) {
+    clock_envelope(&apu->pulse[0].envelope);
+    clock_envelope(&apu->pulse[1].envelope);
+    clock_envelope(&apu->noise.envelope);
+
+    struct Triangle* triangle = &apu->triangle;
+    if (triangle->linear_reload) {
+        triangle->linear = triangle->linear_period;
+    } else if (triangle->linear > 0) {
+        triangle->linear--;
+    }
+    if (!triangle->control) {
+        triangle->linear_reload = false;
+    }
+}
+
+static void clock_half_frame(struct APU* apu) {
+    // The envelope loop flag doubles as the length counter halt flag
+    for (usize i = 0; i < 2; i++) {
+        struct Pulse* pulse = &apu->pulse[i];
+        if (pulse->length > 0 && !pulse->envelope.loop) {
+            pulse->length--;
+        }
+        clock_sweep(pulse);
+    }
+    if (apu->triangle.length > 0 && !apu->triangle.control) {
+        apu->triangle.length--;
+    }
+    if (apu->noise.length > 0 && !apu->noise.envelope.loop) {
+        apu->noise.length--;
+    }
+}
+
+static void clock_envelope(struct Envelope* envelope) {
+    if (envelope->start) {
+        envelope->start = false;
+        envelope->decay = 15;
+        envelope->divider = envelope->volume;
+    } else if (envelope->divider == 0) {
+        envelope->divider = envelope->volume;
+        if (envelope->decay > 0) {
+            envelope->decay--;
+        } else if (envelope->loop) {
+            envelope->decay = 15;
+        }
+    } else {
+        envelope->divider--;
+    }
+}
+
+static void clock_sweep(struct Pulse* pulse) {
+    const word target = sweep_target(pulse);
+    if (pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift > 0 &&
+        pulse->period >= 8 && target <= 0x7ff) {
+        pulse->period = target;
+    }
+    if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = false;
+    } else {
+        pulse->sweep_divider--;
+    }
+}
+
+static void step_pulse(struct Pulse* pulse) {
+    pulse->step = (pulse->step - 1) & 7;
+    pulse->timer = (pulse->period + 1) * 2;
+}
+
+static void step_triangle(struct Triangle* triangle) {
+    triangle->step = (triangle->step + 1) & 31;
+    triangle->timer = triangle->period + 1;
+}
+
+static void step_noise(struct Noise* noise) {
+    const word feedback = (noise->shift ^ (noise->shift >> (noise->mode ? 6 : 1))) & 1;
+    noise->shift = (noise->shift >> 1) | feedback << 14;
+    noise->timer = NOISE_PERIODS[noise->period];
+}
+
+static void step_dmc(struct APU* apu) {
+    struct DMC* dmc = &apu->dmc;
+    if (!dmc->silence) {
+        if (dmc->shifter & 1) {
+            dmc->level += dmc->level <= 125 ? 2 : 0;
+        } else {
+            dmc->level -= dmc->level >= 2 ? 2 : 0;
+        }
+        dmc->shifter >>= 1;
+    }
+    if (--dmc->bits == 0) {
+        dmc->bits = 8;
+        dmc->silence = !dmc->buffer_full;
+        if (dmc->buffer_full) {
+            dmc->shifter = dmc->buffer;
+            dmc->buffer_full = false;
+            fetch_dmc(apu);
+        }
+    }
+    dmc->timer = DMC_RATES[dmc->rate];
+    arm_timers(apu);
+}
+
+static void fetch_dmc(struct APU* apu) {
+    struct DMC* dmc = &apu->dmc;
+    if (dmc->buffer_full || dmc->remaining == 0) {
+        return;
+    }
+    // The CPU is halted while the sample byte is read
+    struct Emulator* emulator = apu->emulator;
+    dmc->buffer = peek_cpu_memory(&emulator->cpu_bus, dmc->address);
+    dmc->buffer_full = true;
+    emulator->cpu.skip_cycles += 4;
+    dmc->address = dmc->address == 0xffff ? 0x8000 : dmc->address + 1;
+    if (--dmc->remaining == 0) {
+        if (dmc->loop) {
+            restart_dmc(dmc);
+        } else if (dmc->irq_enabled) {
+            dmc->irq = true;
+            update_irq(apu);
+        }
+    }
+}
+
+static void restart_dmc(struct DMC* dmc) {
+    dmc->address = dmc->sample_address;
+    dmc->remaining = dmc->sample_length;
+}
+
+static void arm_timers(struct APU* apu) {
+    // Channels that cannot change their output stop stepping until a register write or frame clock wakes them
+    for (usize i = 0; i < 2; i++) {
+        struct Pulse* pulse = &apu->pulse[i];
+        const bool running = pulse->length > 0 && pulse->period >= 8;
+        if (!running) {
+            pulse->timer = APU_TIMER_IDLE;
+        } else if (pulse->timer == APU_TIMER_IDLE) {
+            pulse->timer = (pulse->period + 1) * 2;
+        }
+    }
+
+    struct Triangle* triangle = &apu->triangle;
+    const bool stepping = triangle->length > 0 && triangle->linear > 0 && triangle->period >= 2;
+    if (!stepping) {
+        triangle->timer = APU_TIMER_IDLE;
+    } else if (triangle->timer == APU_TIMER_IDLE) {
+        triangle->timer = triangle->period + 1;
+    }
+
+    struct Noise* noise = &apu->noise;
+    if (noise->length == 0) {
+        noise->timer = APU_TIMER_IDLE;
+    } else if (noise->timer == APU_TIMER_IDLE) {
+        noise->timer = NOISE_PERIODS[noise->period];
+    }
+
+    struct DMC* dmc = &apu->dmc;
+    if (dmc->silence && !dmc->buffer_full && dmc->remaining == 0 && dmc->bits == 8) {
+        dmc->timer = APU_TIMER_IDLE;
+    } else if (dmc->timer == APU_TIMER_IDLE) {
+        dmc->timer = DMC_RATES[dmc->rate];
+    }
+}
+
+static void mix(struct APU* apu) {
+    // Non-linear mixer approximation from the 2A03 documentation
+    const float pulse = (float)(pulse_output(&apu->pulse[0]) + pulse_output(&apu->pulse[1]));
+    const struct Noise* noise = &apu->noise;
+    const float triangle = (float)TRIANGLE_TABLE[apu->triangle.step];
+    const float noise_out = (noise->length == 0 || (noise->shift & 1)) ? 0.0f : (float)envelope_output(&noise->envelope);
+    const float dmc = (float)apu->dmc.level;
+
+    const float pulse_mix = pulse > 0.0f ? 95.88f / (8128.0f / pulse + 100.0f) : 0.0f;
+    const float tnd_sum = triangle / 8227.0f + noise_out / 12241.0f + dmc / 22638.0f;
+    const float tnd_mix = tnd_sum > 0.0f ? 159.79f / (1.0f / tnd_sum + 100.0f) : 0.0f;
+    const float amplitude = pulse_mix + tnd_mix;
+    if (amplitude != apu->amplitude) {
+        if (apu->blip != NULL) {
+            add_blip_delta(apu->blip, (usize)(apu->cycle - apu->frame_cycle), (amplitude - apu->amplitude) * APU_VOLUME);
+        }
+        apu->amplitude = amplitude;
+    }
+}
+
+static void update_irq(struct APU* apu) {
+    struct CPU* cpu = &apu->emulator->cpu;
+    set_irq_line(cpu, IRQ_FRAME, apu->frame_irq);
+    set_irq_line(cpu, IRQ_DMC, apu->dmc.irq);
+}
+
+static byte pulse_output(const struct Pulse* pulse) {
+    if (pulse->length == 0 || pulse->period < 8 || sweep_target(pulse) > 0x7ff ||
+        !DUTY_TABLE[pulse->duty][pulse->step]) {
+        return 0;
+    }
+    return envelope_output(&pulse->envelope);
+}
+
+static word sweep_target(const struct Pulse* pulse) {
+    // Pulse 1 negates with ones' complement, pulse 2 with two's complement
+    const word change = pulse->period >> pulse->sweep_shift;
+    if (pulse->sweep_negate) {
+        return change + (pulse->index == 0) > pulse->period ? 0 : pulse->period - change - (pulse->index == 0);
+    }
+    return pulse->period + change;
+}
+
+static byte envelope_output(const struct Envelope* envelope) {
+    return envelope->constant ? envelope->volume : envelope->decay;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "emulator.h"
+#include "log.h"
+
+static void run_chunk(void* context);
+static void step_instance(const struct Batch* batch, usize index);
+
+bool init_batch(struct Batch* batch, usize workers) {
+    memset(batch, 0, sizeof(struct Batch));
+    if (!init_thread_pool(&batch->pool, workers)) {
+        return false;
+    }
+    batch->chunk_capacity = batch->pool.workers * BATCH_CHUNKS_PER_WORKER;
+    batch->chunks = calloc(batch->chunk_capacity, sizeof(struct BatchChunk));
+    if (batch->chunks == NULL) {
+        LOG(ERROR, "Could not allocate batch chunks");
+        free_thread_pool(&batch->pool);
+        return false;
+    }
+    return true;
+}
+
+void free_batch(struct Batch* batch) {
+    free_thread_pool(&batch->pool);
+    free(batch->chunks);
+    batch->chunks = NULL;
+}
+
+void step_batch(struct Batch* batch, struct Emulator* const* envs, usize count, const byte* actions, usize frames,
+                void* observations, bool rgb, byte* ram) {
+    batch->envs         = envs;
+    batch->actions      = actions;
+    batch->frames       = frames;
+    batch->observations = observations;
+    batch->rgb          = rgb;
+    batch->ram          = ram;
+
+    // Small batches run on the calling thread, where handing them to the pool would cost more than it saves
+    const usize chunks = count < batch->chunk_capacity ? count : batch->chunk_capacity;
+    if (chunks <= 1 || batch->pool.workers == 1) {
+        for (usize i = 0; i < count; i++) {
+            step_instance(batch, i);
+        }
+        return;
+    }
+    usize first = 0;
+    for (usize i = 0; i < chunks; i++) {
+        struct BatchChunk* chunk = &batch->chunks[i];
+        chunk->batch = batch;
+        chunk->first = first;
+        chunk->count = count / chunks + (i < count % chunks);
+        first += chunk->count;
+        submit_task(&batch->pool, run_chunk, chunk);
+    }
+    wait_thread_pool(&batch->pool);
+}
+
+static void run_chunk(void* context) {
+    const struct BatchChunk* chunk = context;
+    for (usize i = chunk->first; i < chunk->first + chunk->count; i++) {
+        step_instance(chunk->batch, i);
+    }
+}
+
+static void step_instance(const struct Batch* batch, usize index) {
+    struct Emulator* emulator = batch->envs[index];
+    if (batch->actions != NULL) {
+        set_controller(&emulator->cpu_bus.pad1, batch->actions[2 * index]);
+        set_controller(&emulator->cpu_bus.pad2, batch->actions[2 * index + 1]);
+    }
+
+    // Nobody listens to batched instances, so their sound is not synthesized
+    struct Blip* blip = emulator->apu.blip;
+    emulator->apu.blip = NULL;
+    for (usize frame = 0; frame < batch->frames; frame++) {
+        run_frame(emulator);
+    }
+    emulator->apu.blip = blip;
+
+    const byte* pixels = emulator->ppu.frame->pixels;
+    if (batch->observations != NULL && batch->rgb) {
+        usize* out = (usize*)batch->observations + index * SCREEN_SIZE;
+        for (usize i = 0; i < SCREEN_SIZE; i++) {
+            out[i] = PALETTE[pixels[i]];
+        }
+    } else if (batch->observations != NULL) {
+        memcpy((byte*)batch->observations + index * SCREEN_SIZE, pixels, SCREEN_SIZE);
+    }
+    if (batch->ram != NULL) {
+        read_pages(&emulator->cpu_bus.ram, batch->ram + index * RAM_SIZE);
+    }
+}
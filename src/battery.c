@@ -0,0 +1,80 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "battery.h"
+#include "log.h"
+
+struct Battery* open_battery(const char* path, usize size) {
+    const int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        LOG(ERROR, "Could not open save file '%s'", path);
+        return NULL;
+    }
+    // A new or short file is zero-extended, a longer one keeps its tail untouched
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (st.st_size < (off_t)size && ftruncate(fd, size) != 0)) {
+        LOG(ERROR, "Could not size save file '%s'", path);
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        LOG(ERROR, "Could not map save file '%s'", path);
+        return NULL;
+    }
+
+    struct Battery* battery = calloc(1, sizeof(struct Battery));
+    if (battery == NULL || (battery->path = strdup(path)) == NULL) {
+        free(battery);
+        munmap(data, size);
+        return NULL;
+    }
+    battery->data = data;
+    battery->size = size;
+    return battery;
+}
+
+void close_battery(struct Battery* battery, const struct PageTable* ram) {
+    if (battery == NULL) {
+        return;
+    }
+    usize dirty = ~(usize)0;
+    flush_battery(battery, ram, &dirty, true);
+    munmap(battery->data, battery->size);
+    LOG(DEBUG, "Closed save file '%s' after %u flushes", battery->path, (usize)battery->flushes);
+    free(battery->path);
+    free(battery);
+}
+
+void load_battery(const struct Battery* battery, struct PageTable* ram) {
+    write_pages(ram, battery->data);
+}
+
+void flush_battery(struct Battery* battery, const struct PageTable* ram, usize* dirty, bool wait) {
+    // Pages rewritten with the bytes they already held cost a compare, not a sync
+    bool changed = false;
+    for (usize i = 0; i < ram->count && *dirty; i++) {
+        if (!(*dirty & (1u << i))) {
+            continue;
+        }
+        *dirty &= ~(1u << i);
+        byte* out = battery->data + i * PAGE_SIZE;
+        const byte* page = get_page(ram, i);
+        if (memcmp(out, page, PAGE_SIZE) != 0) {
+            memcpy(out, page, PAGE_SIZE);
+            changed = true;
+        }
+    }
+    *dirty = 0;
+    if (changed || wait) {
+        if (msync(battery->data, battery->size, wait ? MS_SYNC : MS_ASYNC) != 0) {
+            LOG(ERROR, "Could not write save file '%s'", battery->path);
+        }
+        battery->flushes += changed;
+    }
+}
@@ -0,0 +1,84 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "blip.h"
+
+#define BLIP_CUTOFF   0.45
+#define BLIP_HIGHPASS 0.0025f
+
+static float kernel[BLIP_PHASES][BLIP_TAPS];
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void build_kernel(void);
+
+void init_blip(struct Blip* blip, double clock_rate, double sample_rate) {
+    pthread_once(&kernel_once, build_kernel);
+    blip->factor = (uint64_t)(sample_rate / clock_rate * (double)(1ull << BLIP_FRAC_BITS) + 0.5);
+    clear_blip(blip);
+}
+
+void clear_blip(struct Blip* blip) {
+    blip->offset = 0;
+    blip->integrator = 0.0f;
+    blip->highpass = 0.0f;
+    blip->count = 0;
+    memset(blip->buffer, 0, sizeof(blip->buffer));
+}
+
+void add_blip_delta(struct Blip* blip, usize clock, float delta) {
+    const uint64_t position = blip->offset + clock * blip->factor;
+    const usize index = position >> BLIP_FRAC_BITS;
+    if (index >= BLIP_BUFFER_SIZE) {
+        return;
+    }
+    const float* impulse = kernel[(position >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+    float* out = &blip->buffer[index];
+    for (usize i = 0; i < BLIP_TAPS; i++) {
+        out[i] += delta * impulse[i];
+    }
+}
+
+usize end_blip_frame(struct Blip* blip, usize clocks) {
+    const uint64_t end = blip->offset + clocks * blip->factor;
+    usize count = end >> BLIP_FRAC_BITS;
+    count = count < BLIP_BUFFER_SIZE ? count : BLIP_BUFFER_SIZE;
+
+    // Integrate into samples, with a one-pole high-pass taking out the DC the mixer leaves
+    float integrator = blip->integrator;
+    float highpass = blip->highpass;
+    for (usize i = 0; i < count; i++) {
+        integrator += blip->buffer[i];
+        const float sample = integrator - highpass;
+        highpass += sample * BLIP_HIGHPASS;
+        blip->samples[i] = sample > 32767.0f ? 32767 : sample < -32768.0f ? -32768 : (sword)sample;
+    }
+    blip->integrator = integrator;
+    blip->highpass = highpass;
+    blip->count = count;
+
+    // The kernel tails of the last deltas belong to the next frame
+    memmove(blip->buffer, blip->buffer + count, BLIP_TAPS * sizeof(float));
+    memset(blip->buffer + BLIP_TAPS, 0, count * sizeof(float));
+    blip->offset = end - ((uint64_t)count << BLIP_FRAC_BITS);
+    return count;
+}
+
+static void build_kernel(void) {
+    // Hann-windowed sinc, each phase normalised so a step always settles on exactly its delta
+    for (usize phase = 0; phase < BLIP_PHASES; phase++) {
+        const double fraction = (double)phase / BLIP_PHASES;
+        double sum = 0.0;
+        for (usize tap = 0; tap < BLIP_TAPS; tap++) {
+            const double x = (double)tap - (BLIP_TAPS / 2 - 1) - fraction;
+            const double angle = M_PI * 2.0 * BLIP_CUTOFF * x;
+            const double sinc = x == 0.0 ? 1.0 : sin(angle) / angle;
+            const double window = 0.5 + 0.5 * cos(M_PI * x / (BLIP_TAPS / 2));
+            kernel[phase][tap] = (float)(sinc * window);
+            sum += kernel[phase][tap];
+        }
+        for (usize tap = 0; tap < BLIP_TAPS; tap++) {
+            kernel[phase][tap] = (float)(kernel[phase][tap] / sum);
+        }
+    }
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bus_stats.h"
+#include "cpu_bus.h"
+#include "log.h"
+
+static const char* IO_NAMES[IO_REGISTERS] = {
+    "PPUCTRL", "PPUMASK", "PPUSTAT", "OAMADDR", "OAMDATA", "PPUSCRL", "PPUADDR", "PPUDATA",
+    [0x08 + (OAMDMA  & 0x1f)] = "OAMDMA",
+    [0x08 + (JOYPAD1 & 0x1f)] = "JOYPAD1",
+    [0x08 + (JOYPAD2 & 0x1f)] = "JOYPAD2",
+};
+
+typedef struct BusStatsHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t frames;
+} BusStatsHeader;
+
+static void count_io_access(struct BusStats* stats, byte slot, bool write);
+static word io_slot_address(byte slot);
+static double per_frame(const struct BusStats* stats, uint64_t count);
+
+struct BusStats* create_bus_stats(void) {
+    struct BusStats* stats = malloc(sizeof(struct BusStats));
+    if (stats == NULL) {
+        LOG(ERROR, "Could not allocate bus statistics");
+        return NULL;
+    }
+    clear_bus_stats(stats);
+    return stats;
+}
+
+void free_bus_stats(struct BusStats* stats) {
+    free(stats);
+}
+
+void clear_bus_stats(struct BusStats* stats) {
+    memset(stats, 0, sizeof(struct BusStats));
+    stats->last_io = 0xff;
+}
+
+void count_cpu_access(struct BusStats* stats, word address, bool write) {
+    if (stats == NULL) {
+        return;
+    }
+    struct BusCounts* page = &stats->cpu_pages[address >> 8];
+    page->reads += !write;
+    page->writes += write;
+    if (address >= 0x2000 && address < 0x4020) {
+        count_io_access(stats, to_io_slot(address), write);
+    }
+}
+
+void count_ppu_access(struct BusStats* stats, word address, bool write) {
+    if (stats == NULL) {
+        return;
+    }
+    struct BusCounts* page = &stats->ppu_pages[(address & 0x3fff) >> 8];
+    page->reads += !write;
+    page->writes += write;
+}
+
+void end_bus_stats_frame(struct BusStats* stats) {
+    if (stats == NULL) {
+        return;
+    }
+    for (usize i = 0; i < IO_REGISTERS; i++) {
+        struct BusCounts* frame = &stats->io_frame[i];
+        struct BusCounts* peak = &stats->io_peak[i];
+        peak->reads = frame->reads > peak->reads ? frame->reads : peak->reads;
+        peak->writes = frame->writes > peak->writes ? frame->writes : peak->writes;
+    }
+    memset(stats->io_frame, 0, sizeof(stats->io_frame));
+    stats->frames++;
+}
+
+void report_bus_stats(const struct BusStats* stats, FILE* out) {
+    if (stats == NULL || stats->frames == 0) {
+        return;
+    }
+    uint64_t cpu_reads = 0, io_reads = 0;
+    for (usize i = 0; i < CPU_BUS_PAGES; i++) {
+        cpu_reads += stats->cpu_pages[i].reads;
+    }
+    for (usize i = 0; i < IO_REGISTERS; i++) {
+        io_reads += stats->io[i].reads;
+    }
+    const uint64_t stat_reads = stats->io[to_io_slot(PPUSTAT)].reads;
+    fprintf(out, "bus: %llu frames, %.0f CPU reads per frame, %.1f%% of them I/O, %.1f%% PPUSTAT\n",
+            (unsigned long long)stats->frames, per_frame(stats, cpu_reads),
+            cpu_reads ? 100.0 * io_reads / cpu_reads : 0.0, cpu_reads ? 100.0 * stat_reads / cpu_reads : 0.0);
+    fprintf(out, "bus: %.1f back-to-back PPUSTAT polls and %.1f PPUDATA bursts per frame (longest %llu)\n",
+            per_frame(stats, stats->stat_spins), per_frame(stats, stats->ppudata_bursts),
+            (unsigned long long)stats->ppudata_longest);
+
+    fprintf(out, "  %-8s %-6s %12s %12s %10s %10s %8s %8s\n",
+            "register", "addr", "reads", "writes", "reads/fr", "writes/fr", "peak rd", "peak wr");
+    for (usize i = 0; i < IO_REGISTERS; i++) {
+        const struct BusCounts* count = &stats->io[i];
+        if (count->reads == 0 && count->writes == 0) {
+            continue;
+        }
+        fprintf(out, "  %-8s $%04x %12llu %12llu %10.1f %10.1f %8llu %8llu\n",
+                IO_NAMES[i] ? IO_NAMES[i] : "APU", io_slot_address(i),
+                (unsigned long long)count->reads, (unsigned long long)count->writes,
+                per_frame(stats, count->reads), per_frame(stats, count->writes),
+                (unsigned long long)stats->io_peak[i].reads, (unsigned long long)stats->io_peak[i].writes);
+    }
+}
+
+bool save_bus_stats(const struct BusStats* stats, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", path);
+        return false;
+    }
+
+    bool written;
+    const char* extension = strrchr(path, '.');
+    if (extension != NULL && strcmp(extension, ".csv") == 0) {
+        written = fprintf(file, "bus,address,reads,writes,reads_per_frame,writes_per_frame\n") > 0;
+        for (usize i = 0; i < CPU_BUS_PAGES; i++) {
+            const struct BusCounts* count = &stats->cpu_pages[i];
+            fprintf(file, "cpu,%u,%llu,%llu,%.3f,%.3f\n", i << 8,
+                    (unsigned long long)count->reads, (unsigned long long)count->writes,
+                    per_frame(stats, count->reads), per_frame(stats, count->writes));
+        }
+        for (usize i = 0; i < PPU_BUS_PAGES; i++) {
+            const struct BusCounts* count = &stats->ppu_pages[i];
+            fprintf(file, "ppu,%u,%llu,%llu,%.3f,%.3f\n", i << 8,
+                    (unsigned long long)count->reads, (unsigned long long)count->writes,
+                    per_frame(stats, count->reads), per_frame(stats, count->writes));
+        }
+        for (usize i = 0; i < IO_REGISTERS; i++) {
+            const struct BusCounts* count = &stats->io[i];
+            fprintf(file, "io,%u,%llu,%llu,%.3f,%.3f\n", io_slot_address(i),
+                    (unsigned long long)count->reads, (unsigned long long)count->writes,
+                    per_frame(stats, count->reads), per_frame(stats, count->writes));
+        }
+        written = written && !ferror(file);
+    } else {
+        // Header, then CPU pages, PPU pages, I/O totals and I/O per-frame peaks as read/write pairs
+        const struct BusStatsHeader header = { BUS_STATS_MAGIC, BUS_STATS_VERSION, stats->frames };
+        written = fwrite(&header, sizeof(header), 1, file) == 1;
+        written = written && fwrite(stats->cpu_pages, sizeof(stats->cpu_pages), 1, file) == 1;
+        written = written && fwrite(stats->ppu_pages, sizeof(stats->ppu_pages), 1, file) == 1;
+        written = written && fwrite(stats->io, sizeof(stats->io), 1, file) == 1;
+        written = written && fwrite(stats->io_peak, sizeof(stats->io_peak), 1, file) == 1;
+    }
+    fclose(file);
+    if (!written) {
+        LOG(ERROR, "Could not write bus statistics to '%s'", path);
+    }
+    return written;
+}
+
+static void count_io_access(struct BusStats* stats, byte slot, bool write) {
+    stats->io[slot].reads += !write;
+    stats->io[slot].writes += write;
+    stats->io_frame[slot].reads += !write;
+    stats->io_frame[slot].writes += write;
+
+    const bool repeated = slot == stats->last_io;
+    const byte ppudata = to_io_slot(PPUDATA);
+    if (slot == to_io_slot(PPUSTAT) && !write && repeated && !stats->last_write) {
+        stats->stat_spins++;
+    }
+    if (slot == ppudata) {
+        if (!repeated) {
+            stats->ppudata_bursts++;
+            stats->ppudata_run = 0;
+        }
+        stats->ppudata_run++;
+        if (stats->ppudata_run > stats->ppudata_longest) {
+            stats->ppudata_longest = stats->ppudata_run;
+        }
+    }
+    stats->last_io = slot;
+    stats->last_write = write;
+}
+
+static word io_slot_address(byte slot) {
+    return slot < 0x08 ? 0x2000 + slot : 0x4000 + (slot - 0x08);
+}
+
+static double per_frame(const struct BusStats* stats, uint64_t count) {
+    return stats->frames ? (double)count / stats->frames : 0.0;
+}
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "capture.h"
+#include "emulator.h"
+#include "log.h"
+
+#define CAPTURE_WIDTH       SCANLINE_VISIBLE_DOTS
+#define CAPTURE_HEIGHT      VISIBLE_SCANLINES
+#define CAPTURE_CHROMA_SIZE ((CAPTURE_WIDTH / 2) * (CAPTURE_HEIGHT / 2))
+#define CAPTURE_FRAME_SIZE  (SCREEN_SIZE + 2 * CAPTURE_CHROMA_SIZE)
+#define WAV_HEADER_SIZE     44
+
+// BT.601 limited range, per palette index, so the RGB stage is skipped entirely
+static byte y_table[0x40];
+static byte u_table[0x40];
+static byte v_table[0x40];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void build_tables(void);
+static void* run_writer(void* arg);
+static void convert_frame(const byte* pixels, byte* planes);
+static void downsample_rows(const byte* top, const byte* bottom, byte* out);
+static bool write_wav_header(FILE* file, int sample_rate, uint64_t samples);
+
+bool start_capture(struct Capture* capture, const char* video_path, const char* audio_path, int sample_rate) {
+    memset(capture, 0, sizeof(struct Capture));
+    capture->sample_rate = sample_rate;
+    pthread_once(&tables_once, build_tables);
+
+    if (video_path != NULL && (capture->video = fopen(video_path, "wb")) == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", video_path);
+        return false;
+    }
+    if (audio_path != NULL && (capture->audio = fopen(audio_path, "wb")) == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", audio_path);
+        stop_capture(capture);
+        return false;
+    }
+    if (capture->video != NULL) {
+        fprintf(capture->video, "YUV4MPEG2 W%d H%d F%d:%d Ip A8:7 C420jpeg\n",
+                CAPTURE_WIDTH, CAPTURE_HEIGHT, CAPTURE_RATE_NUMERATOR, CAPTURE_RATE_DENOMINATOR);
+    }
+    // Sizes are left at zero until stop_capture knows them
+    if (capture->audio != NULL) {
+        write_wav_header(capture->audio, sample_rate, 0);
+    }
+
+    capture->slots = malloc(CAPTURE_SLOTS * sizeof(struct CaptureSlot));
+    if (capture->slots == NULL) {
+        LOG(ERROR, "Could not allocate the capture queue");
+        stop_capture(capture);
+        return false;
+    }
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->filled, NULL);
+    pthread_cond_init(&capture->drained, NULL);
+    if (pthread_create(&capture->thread, NULL, run_writer, capture) != 0) {
+        LOG(ERROR, "Could not start the capture writer");
+        pthread_cond_destroy(&capture->drained);
+        pthread_cond_destroy(&capture->filled);
+        pthread_mutex_destroy(&capture->lock);
+        free(capture->slots);
+        capture->slots = NULL;
+        stop_capture(capture);
+        return false;
+    }
+    return true;
+}
+
+void capture_frame(struct Capture* capture, const struct Emulator* emulator) {
+    if (capture->slots == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&capture->lock);
+    if (capture->queued == CAPTURE_SLOTS) {
+        capture->waits++;
+        while (capture->queued == CAPTURE_SLOTS) {
+            pthread_cond_wait(&capture->drained, &capture->lock);
+        }
+    }
+    pthread_mutex_unlock(&capture->lock);
+
+    // The tail slot belongs to this thread until it is queued
+    struct CaptureSlot* slot = &capture->slots[capture->tail];
+    memcpy(slot->pixels, emulator->ppu.frame->pixels, SCREEN_SIZE);
+    const struct Blip* blip = emulator->apu.blip;
+    slot->count = blip != NULL ? blip->count : 0;
+    if (slot->count > 0) {
+        memcpy(slot->samples, blip->samples, slot->count * sizeof(sword));
+    }
+
+    pthread_mutex_lock(&capture->lock);
+    capture->tail = (capture->tail + 1) % CAPTURE_SLOTS;
+    capture->queued++;
+    capture->frames++;
+    capture->samples += slot->count;
+    pthread_cond_signal(&capture->filled);
+    pthread_mutex_unlock(&capture->lock);
+}
+
+void stop_capture(struct Capture* capture) {
+    if (capture->slots != NULL) {
+        pthread_mutex_lock(&capture->lock);
+        capture->stop = true;
+        pthread_cond_signal(&capture->filled);
+        pthread_mutex_unlock(&capture->lock);
+        pthread_join(capture->thread, NULL);
+        pthread_cond_destroy(&capture->drained);
+        pthread_cond_destroy(&capture->filled);
+        pthread_mutex_destroy(&capture->lock);
+        free(capture->slots);
+        capture->slots = NULL;
+    }
+    if (capture->video != NULL) {
+        fclose(capture->video);
+        capture->video = NULL;
+    }
+    if (capture->audio != NULL) {
+        if (fseek(capture->audio, 0, SEEK_SET) != 0 ||
+            !write_wav_header(capture->audio, capture->sample_rate, capture->samples)) {
+            capture->failed = true;
+        }
+        fclose(capture->audio);
+        capture->audio = NULL;
+    }
+    if (capture->failed) {
+        LOG(ERROR, "Capture is incomplete, a write failed");
+    }
+}
+
+void report_capture(const struct Capture* capture, FILE* out) {
+    fprintf(out, "capture: %llu frames, %.1f s of audio, %llu waits for the writer\n",
+            (unsigned long long)capture->frames, (double)capture->samples / capture->sample_rate,
+            (unsigned long long)capture->waits);
+}
+
+static void build_tables(void) {
+    for (usize i = 0; i < 0x40; i++) {
+        const double r = (PALETTE[i] >> 16) & 0xff;
+        const double g = (PALETTE[i] >> 8) & 0xff;
+        const double b = PALETTE[i] & 0xff;
+        y_table[i] = (byte)(16.5 + (65.738 * r + 129.057 * g + 25.064 * b) / 256.0);
+        u_table[i] = (byte)(128.5 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256.0);
+        v_table[i] = (byte)(128.5 + (112.439 * r - 94.154 * g - 18.285 * b) / 256.0);
+    }
+}
+
+static void* run_writer(void* arg) {
+    struct Capture* capture = arg;
+    byte* planes = malloc(CAPTURE_FRAME_SIZE);
+    if (planes == NULL) {
+        capture->failed = true;
+    }
+    for (;;) {
+        pthread_mutex_lock(&capture->lock);
+        while (capture->queued == 0 && !capture->stop) {
+            pthread_cond_wait(&capture->filled, &capture->lock);
+        }
+        if (capture->queued == 0) {
+            pthread_mutex_unlock(&capture->lock);
+            break;
+        }
+        pthread_mutex_unlock(&capture->lock);
+
+        // The head slot belongs to this thread until it is released
+        const struct CaptureSlot* slot = &capture->slots[capture->head];
+        if (capture->video != NULL && planes != NULL) {
+            convert_frame(slot->pixels, planes);
+            if (fputs("FRAME\n", capture->video) == EOF ||
+                fwrite(planes, 1, CAPTURE_FRAME_SIZE, capture->video) != CAPTURE_FRAME_SIZE) {
+                capture->failed = true;
+            }
+        }
+        if (capture->audio != NULL && slot->count > 0 &&
+            fwrite(slot->samples, sizeof(sword), slot->count, capture->audio) != slot->count) {
+            capture->failed = true;
+        }
+
+        pthread_mutex_lock(&capture->lock);
+        capture->head = (capture->head + 1) % CAPTURE_SLOTS;
+        capture->queued--;
+        pthread_cond_signal(&capture->drained);
+        pthread_mutex_unlock(&capture->lock);
+    }
+    free(planes);
+    return NULL;
+}
+
+static void convert_frame(const byte* pixels, byte* planes) {
+    byte* y = planes;
+    byte* u = planes + SCREEN_SIZE;
+    byte* v = u + CAPTURE_CHROMA_SIZE;
+    byte u_rows[2][CAPTURE_WIDTH];
+    byte v_rows[2][CAPTURE_WIDTH];
+
+    // Luma and chroma are looked up per pixel, then chroma is averaged over each 2x2 block
+    for (usize row = 0; row < CAPTURE_HEIGHT; row += 2) {
+        for (usize half = 0; half < 2; half++) {
+            const byte* line = pixels + (row + half) * CAPTURE_WIDTH;
+            byte* luma = y + (row + half) * CAPTURE_WIDTH;
+            for (usize x = 0; x < CAPTURE_WIDTH; x++) {
+                const byte index = line[x] & 0x3f;
+                luma[x] = y_table[index];
+                u_rows[half][x] = u_table[index];
+                v_rows[half][x] = v_table[index];
+            }
+        }
+        downsample_rows(u_rows[0], u_rows[1], u + (row / 2) * (CAPTURE_WIDTH / 2));
+        downsample_rows(v_rows[0], v_rows[1], v + (row / 2) * (CAPTURE_WIDTH / 2));
+    }
+}
+
+#if defined(__SSE2__)
+static void downsample_rows(const byte* top, const byte* bottom, byte* out) {
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    for (usize x = 0; x < CAPTURE_WIDTH; x += 32) {
+        const __m128i first = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(top + x)),
+                                           _mm_loadu_si128((const __m128i*)(bottom + x)));
+        const __m128i second = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(top + x + 16)),
+                                            _mm_loadu_si128((const __m128i*)(bottom + x + 16)));
+        const __m128i even = _mm_packus_epi16(_mm_and_si128(first, low), _mm_and_si128(second, low));
+        const __m128i odd = _mm_packus_epi16(_mm_srli_epi16(first, 8), _mm_srli_epi16(second, 8));
+        _mm_storeu_si128((__m128i*)(out + x / 2), _mm_avg_epu8(even, odd));
+    }
+}
+#else
+static void downsample_rows(const byte* top, const byte* bottom, byte* out) {
+    for (usize x = 0; x < CAPTURE_WIDTH; x += 2) {
+        out[x / 2] = (byte)((top[x] + top[x + 1] + bottom[x] + bottom[x + 1] + 2) >> 2);
+    }
+}
+#endif
+
+static bool write_wav_header(FILE* file, int sample_rate, uint64_t samples) {
+    const uint32_t data = (uint32_t)(samples * sizeof(sword));
+    const uint32_t rate = (uint32_t)sample_rate;
+    const uint32_t fields[] = { 36 + data, 16, 1 | (1 << 16), rate, rate * sizeof(sword), sizeof(sword) | (16 << 16), data };
+    byte header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    memcpy(header + 36, "data", 4);
+    const usize offsets[] = { 4, 16, 20, 24, 28, 32, 40 };
+    for (usize i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        for (usize b = 0; b < 4; b++) {
+            header[offsets[i] + b] = (byte)(fields[i] >> (8 * b));
+        }
+    }
+    return fwrite(header, 1, WAV_HEADER_SIZE, file) == WAV_HEADER_SIZE;
+}
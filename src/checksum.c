@@ -0,0 +1,200 @@
+#include <pthread.h>
+#include <string.h>
+#if defined(__PCLMUL__)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "checksum.h"
+
+#define CRC32_POLYNOMIAL 0xedb88320u
+#define SHA1_BLOCK_SIZE  64
+
+// Slicing-by-8: table k advances a byte that sits k places further back in the input
+static uint32_t crc_tables[8][0x100];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void build_tables(void);
+static uint32_t crc32_bytes(const byte* ptr, usize size, uint32_t crc);
+#if defined(__PCLMUL__)
+static uint32_t crc32_fold(const byte* ptr, usize size, uint32_t crc);
+#endif
+
+static void sha1_block(uint32_t* state, const byte* block);
+static uint32_t rotate_left(uint32_t value, byte bits);
+static uint32_t read_be32(const byte* ptr);
+
+uint32_t crc32_checksum(const void* data, usize size, uint32_t crc) {
+    pthread_once(&tables_once, build_tables);
+    const byte* ptr = data;
+    crc = ~crc;
+#if defined(__PCLMUL__)
+    // Carry-less multiplication folds four 16-byte lanes at once; the tail goes byte by byte
+    if (size >= 64) {
+        const usize folded = size & ~(usize)15;
+        crc = crc32_fold(ptr, folded, crc);
+        ptr += folded;
+        size -= folded;
+    }
+#endif
+    return ~crc32_bytes(ptr, size, crc);
+}
+
+void sha1_digest(const void* data, usize size, byte digest[SHA1_SIZE]) {
+    uint32_t state[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+    const byte* ptr = data;
+    usize left = size;
+    for (; left >= SHA1_BLOCK_SIZE; left -= SHA1_BLOCK_SIZE, ptr += SHA1_BLOCK_SIZE) {
+        sha1_block(state, ptr);
+    }
+
+    // Padding: a single 1 bit, zeros, then the message length in bits, spilling into a second block if needed
+    byte tail[2 * SHA1_BLOCK_SIZE] = { 0 };
+    memcpy(tail, ptr, left);
+    tail[left] = 0x80;
+    const usize tail_size = left + 9 > SHA1_BLOCK_SIZE ? 2 * SHA1_BLOCK_SIZE : SHA1_BLOCK_SIZE;
+    const uint64_t bits = (uint64_t)size * 8;
+    for (usize i = 0; i < 8; i++) {
+        tail[tail_size - 1 - i] = (byte)(bits >> (8 * i));
+    }
+    for (usize offset = 0; offset < tail_size; offset += SHA1_BLOCK_SIZE) {
+        sha1_block(state, tail + offset);
+    }
+    for (usize i = 0; i < 5; i++) {
+        for (usize b = 0; b < 4; b++) {
+            digest[4 * i + b] = (byte)(state[i] >> (24 - 8 * b));
+        }
+    }
+}
+
+static void build_tables(void) {
+    for (uint32_t i = 0; i < 0x100; i++) {
+        uint32_t crc = i;
+        for (usize bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32_POLYNOMIAL & -(crc & 1));
+        }
+        crc_tables[0][i] = crc;
+    }
+    for (usize i = 0; i < 0x100; i++) {
+        for (usize k = 1; k < 8; k++) {
+            const uint32_t previous = crc_tables[k - 1][i];
+            crc_tables[k][i] = (previous >> 8) ^ crc_tables[0][previous & 0xff];
+        }
+    }
+}
+
+static uint32_t crc32_bytes(const byte* ptr, usize size, uint32_t crc) {
+    while (size >= 8) {
+        uint32_t low;
+        uint32_t high;
+        memcpy(&low, ptr, 4);
+        memcpy(&high, ptr + 4, 4);
+        low ^= crc;
+        crc = crc_tables[7][low & 0xff] ^ crc_tables[6][(low >> 8) & 0xff] ^
+              crc_tables[5][(low >> 16) & 0xff] ^ crc_tables[4][low >> 24] ^
+              crc_tables[3][high & 0xff] ^ crc_tables[2][(high >> 8) & 0xff] ^
+              crc_tables[1][(high >> 16) & 0xff] ^ crc_tables[0][high >> 24];
+        ptr += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ *ptr++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__PCLMUL__)
+static uint32_t crc32_fold(const byte* ptr, usize size, uint32_t crc) {
+    // Bit-reflected folding constants for the CRC-32 polynomial: x^(4*128+32), x^(4*128-32) mod P for
+    // the four-lane fold, the same for one lane, x^64 mod P, and P with its Barrett quotient
+    const __m128i fold4 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i fold1 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i fold64 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i barrett = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)ptr), _mm_cvtsi32_si128((int)crc));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(ptr + 16));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(ptr + 32));
+    __m128i x4 = _mm_loadu_si128((const __m128i*)(ptr + 48));
+    ptr += 64;
+    size -= 64;
+    for (; size >= 64; ptr += 64, size -= 64) {
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, fold4, 0x00), _mm_clmulepi64_si128(x1, fold4, 0x11)),
+                           _mm_loadu_si128((const __m128i*)ptr));
+        x2 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x2, fold4, 0x00), _mm_clmulepi64_si128(x2, fold4, 0x11)),
+                           _mm_loadu_si128((const __m128i*)(ptr + 16)));
+        x3 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x3, fold4, 0x00), _mm_clmulepi64_si128(x3, fold4, 0x11)),
+                           _mm_loadu_si128((const __m128i*)(ptr + 32)));
+        x4 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x4, fold4, 0x00), _mm_clmulepi64_si128(x4, fold4, 0x11)),
+                           _mm_loadu_si128((const __m128i*)(ptr + 48)));
+    }
+
+    // Down to one lane, then through whatever 16-byte blocks are left
+    const __m128i lanes[3] = { x2, x3, x4 };
+    for (usize i = 0; i < 3; i++) {
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, fold1, 0x00), _mm_clmulepi64_si128(x1, fold1, 0x11)),
+                           lanes[i]);
+    }
+    for (; size >= 16; ptr += 16, size -= 16) {
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, fold1, 0x00), _mm_clmulepi64_si128(x1, fold1, 0x11)),
+                           _mm_loadu_si128((const __m128i*)ptr));
+    }
+
+    // 128 bits to 64, then a Barrett reduction to the 32-bit remainder
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, fold1, 0x10));
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), fold64, 0x00), _mm_srli_si128(x1, 4));
+    __m128i quotient = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), barrett, 0x10);
+    quotient = _mm_clmulepi64_si128(_mm_and_si128(quotient, low32), barrett, 0x00);
+    x1 = _mm_xor_si128(x1, quotient);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+static void sha1_block(uint32_t* state, const byte* block) {
+    uint32_t w[80];
+    for (usize i = 0; i < 16; i++) {
+        w[i] = read_be32(block + 4 * i);
+    }
+    for (usize i = 16; i < 80; i++) {
+        w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+    for (usize i = 0; i < 80; i++) {
+        uint32_t f;
+        uint32_t k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        const uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotate_left(b, 30);
+        b = a;
+        a = temp;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+static uint32_t rotate_left(uint32_t value, byte bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static uint32_t read_be32(const byte* ptr) {
+    return (uint32_t)ptr[0] << 24 | (uint32_t)ptr[1] << 16 | (uint32_t)ptr[2] << 8 | ptr[3];
+}
@@ -22,42 +22,6 @@ void write_controller(struct Controller* controller, byte value) {
         controller->index = 0;
 }
 
-void update_controller(struct Controller* controller, const SDL_Event* event) {
-    keyboard_mapper(controller, event);
-}
-
-void keyboard_mapper(struct Controller* controller, const SDL_Event* event) {
-    word key = 0;
-    switch (event->key.keysym.sym) {
-        case SDLK_RIGHT:
-            key = RIGHT;
-            break;
-        case SDLK_LEFT:
-            key = LEFT;
-            break;
-        case SDLK_DOWN:
-            key = DOWN;
-            break;
-        case SDLK_UP:
-            key = UP;
-            break;
-        case SDLK_RETURN:
-            key = START;
-            break;
-        case SDLK_RSHIFT:
-            key = SELECT;
-            break;
-        case SDLK_z:
-            key = A;
-            break;
-        case SDLK_x:
-            key = B;
-            break;
-        default:
-            break;
-    }
-    if (event->type == SDL_KEYUP)
-        controller->status &= ~key;
-    if (event->type == SDL_KEYDOWN)
-        controller->status |= key;
+void set_controller(struct Controller* controller, byte buttons) {
+    controller->status = buttons;
 }
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "cpu.h"
 #include "cpu_opcodes.h"
 #include "emulator.h"
+#include "profiler.h"
+#include "trace.h"
 
 static byte execute(struct CPU* cpu, const struct Instruction* instr);
 static void interrupt(struct CPU* cpu, InterruptType type);
@@ -52,6 +54,12 @@ static void pull_status(struct CPU* cpu);
 void init_cpu(struct Emulator* emulator) {
     struct CPU* cpu = &emulator->cpu;
     cpu->bus = &emulator->cpu_bus;
+    cpu->trace = NULL;
+#ifdef OLDNES_PROFILE
+    cpu->profiler = NULL;
+#endif
+    cpu->irq_line = 0;
+    cpu->event_cycle = 0;
     reset_cpu(&emulator->cpu);
 }
 
@@ -70,20 +78,33 @@ void execute_cpu(struct CPU* cpu) {
     }
     cpu->skip_cycles = 0;
 
+    if (cpu->cycles >= cpu->event_cycle) {
+        run_scheduled_events(cpu->bus->emulator);
+    }
     if(cpu->pending_nmi) {
         interrupt(cpu, NMI);
         cpu->pending_nmi = cpu->pending_irq = false;
         return;
     }
-    if(cpu->pending_irq) {
+    if(cpu->pending_irq || (cpu->irq_line && !cpu->status.i)) {
         interrupt(cpu, IRQ);
         cpu->pending_nmi = cpu->pending_irq = false;
         return;
     }
 
+    const word pc = cpu->pc;
     const byte opcode = fetch_byte(cpu);
+    if (cpu->trace != NULL) {
+        trace_instruction(cpu->trace, cpu, pc, opcode);
+    }
     const Instruction* instr = &INSTRUCTIONS[opcode];
-    cpu->skip_cycles += execute(cpu, instr);
+    const byte cycles = execute(cpu, instr);
+    cpu->skip_cycles += cycles;
+#ifdef OLDNES_PROFILE
+    if (cpu->profiler != NULL) {
+        record_instruction(cpu->profiler, cpu, pc, opcode, cycles);
+    }
+#endif
 }
 
 void interrupt_cpu(struct CPU* cpu, InterruptType type) {
@@ -97,6 +118,10 @@ void interrupt_cpu(struct CPU* cpu, InterruptType type) {
     }
 }
 
+void set_irq_line(struct CPU* cpu, IRQSource source, bool active) {
+    cpu->irq_line = active ? cpu->irq_line | source : cpu->irq_line & ~source;
+}
+
 static byte execute(struct CPU* cpu, const struct Instruction* instr) {
     word address;
     switch (instr->address_mode) {
@@ -397,7 +422,7 @@ static byte execute(struct CPU* cpu, const struct Instruction* instr) {
 }
 
 static void interrupt(struct CPU* cpu, InterruptType type) {
-    if(cpu->status.i) {
+    if(type == IRQ && cpu->status.i) {
         return;
     }
     push_word(cpu, cpu->pc);
@@ -487,11 +512,11 @@ static word zero_page(struct CPU* cpu) {
 }
 
 static word zero_page_x(struct CPU* cpu) {
-    return fetch_byte(cpu) + cpu->x;
+    return (fetch_byte(cpu) + cpu->x) & 0xff;
 }
 
 static word zero_page_y(struct CPU* cpu) {
-    return fetch_byte(cpu) + cpu->y;
+    return (fetch_byte(cpu) + cpu->y) & 0xff;
 }
 
 static word absolute(struct CPU* cpu) {
@@ -500,7 +525,7 @@ static word absolute(struct CPU* cpu) {
 
 static word absolute_x(struct CPU* cpu) {
     const word abs_address = fetch_word(cpu);
-    const word abs_address_x = fetch_word(cpu) + cpu->x;
+    const word abs_address_x = abs_address + cpu->x;
     if (page_crossed(abs_address, abs_address_x)) {
         cpu->skip_cycles++;
     }
@@ -509,7 +534,7 @@ static word absolute_x(struct CPU* cpu) {
 
 static word absolute_y(struct CPU* cpu) {
     const word abs_address = fetch_word(cpu);
-    const word abs_address_y = fetch_word(cpu) + cpu->y;
+    const word abs_address_y = abs_address + cpu->y;
     if (page_crossed(abs_address, abs_address_y)) {
         cpu->skip_cycles++;
     }
@@ -3,21 +3,76 @@
 
 #include "cpu_bus.h"
 #include "emulator.h"
+#include "bus_stats.h"
+#include "battery.h"
 #include "log.h"
 
 void init_cpu_bus(struct Emulator* emulator) {
     struct CPUBus* bus = &emulator->cpu_bus;
     bus->emulator = emulator;
     bus->mapper = &emulator->mapper;
+#ifdef OLDNES_BUS_STATS
+    bus->stats = NULL;
+#endif
 
-    memset(bus->ram, 0, RAM_SIZE);
+    init_page_table(&bus->ram, RAM_SIZE);
+    bus->battery = NULL;
+    bus->prg_ram_dirty = 0;
+
+    // Work and battery RAM share one unbanked window at $6000-$7FFF, mirrored if smaller. A trainer
+    // is copied to $7000 at power-on, so its cartridge gets the whole window.
+    const struct RomImage* rom = bus->mapper->rom;
+    const struct RomInfo* info = &rom->info;
+    const usize prg_ram = info->trainer ? PRG_RAM_SIZE : info->prg_ram_size + info->prg_nvram_size;
+    usize size = PAGE_SIZE;
+    while (size < prg_ram && size < PRG_RAM_SIZE) {
+        size <<= 1;
+    }
+    init_page_table(&bus->prg_ram, prg_ram ? size : 0);
+    if (info->trainer) {
+        for (usize i = 0; i < TRAINER_SIZE; i++) {
+            write_page_table(&bus->prg_ram, 0x1000 + i, rom->data[info->trainer_offset + i]);
+        }
+    }
     init_controller(&bus->pad1, 0);
     init_controller(&bus->pad2, 1);
 }
 
+void free_cpu_bus(struct CPUBus* bus) {
+    close_battery(bus->battery, &bus->prg_ram);
+    bus->battery = NULL;
+    free_page_table(&bus->prg_ram);
+    free_page_table(&bus->ram);
+}
+
+bool attach_battery(struct CPUBus* bus, const char* path) {
+    if (bus->prg_ram.count == 0) {
+        LOG(ERROR, "Cartridge has no RAM to back with '%s'", path);
+        return false;
+    }
+    struct Battery* battery = open_battery(path, get_page_table_size(&bus->prg_ram));
+    if (battery == NULL) {
+        return false;
+    }
+    close_battery(bus->battery, &bus->prg_ram);
+    load_battery(battery, &bus->prg_ram);
+    bus->battery = battery;
+    bus->prg_ram_dirty = 0;
+    return true;
+}
+
+void flush_prg_ram(struct CPUBus* bus) {
+    if (bus->battery != NULL && bus->prg_ram_dirty) {
+        flush_battery(bus->battery, &bus->prg_ram, &bus->prg_ram_dirty, false);
+    }
+}
+
 byte read_cpu_memory(struct CPUBus* bus, word address) {
+#ifdef OLDNES_BUS_STATS
+    count_cpu_access(bus->stats, address, false);
+#endif
     if (address < 0x2000) {
-        return bus->ram[address & 0x7ff];
+        return read_page_table(&bus->ram, address & 0x7ff);
     }
     if (address < 0x4000) {
         address &= 0x2007;
@@ -31,6 +86,8 @@ byte read_cpu_memory(struct CPUBus* bus, word address) {
                 return read_oam(ppu);
             case PPUDATA:
                 return read_ppu(ppu);
+            case APUSTAT:
+                return read_apu_status(&bus->emulator->apu);
             case JOYPAD1:
                 return read_controller(&bus->pad1);
             case JOYPAD2:
@@ -45,8 +102,10 @@ byte read_cpu_memory(struct CPUBus* bus, word address) {
         return 0;
     }
     if (address < 0x8000) {
-        LOG(DEBUG, "Extended RAM not supported yet");
-        return 0;
+        if (bus->prg_ram.count == 0) {
+            return 0;
+        }
+        return read_page_table(&bus->prg_ram, address & (get_page_table_size(&bus->prg_ram) - 1));
     }
     else {
         return bus->mapper->read_prg(bus->mapper, address);
@@ -54,21 +113,32 @@ byte read_cpu_memory(struct CPUBus* bus, word address) {
 }
 
 void write_cpu_memory(struct CPUBus* bus, word address, byte value) {
+#ifdef OLDNES_BUS_STATS
+    count_cpu_access(bus->stats, address, true);
+#endif
     if (address < 0x2000) {
-        bus->ram[address & 0x7ff] = value;
+        write_page_table(&bus->ram, address & 0x7ff, value);
         return;
     }
     if (address < 0x4000) {
         address &= 0x2007;
+    } else if (address < 0x4014) {
+        write_apu(&bus->emulator->apu, address, value);
+        return;
     }
     if (address < 0x4020) {
         struct PPU* ppu = &bus->emulator->ppu;
         switch (address) {
+            // Which pattern table is fetched from, and whether at all, decides when mapper IRQs are due
             case PPUCTRL:
+                bus->mapper->sync(bus->mapper);
                 set_control(ppu, value);
+                schedule_events(bus->emulator);
                 return;
             case PPUMASK:
+                bus->mapper->sync(bus->mapper);
                 set_mask(ppu, value);
+                schedule_events(bus->emulator);
                 return;
             case PPUSCRL:
                 set_scroll(ppu, value);
@@ -92,6 +162,10 @@ void write_cpu_memory(struct CPUBus* bus, word address, byte value) {
                 write_controller(&bus->pad1, value);
                 write_controller(&bus->pad2, value);
                 return;
+            case APUSTAT:
+            case JOYPAD2: // The frame counter shares its address with the second controller port
+                write_apu(&bus->emulator->apu, address, value);
+                return;
             default:
                 LOG(DEBUG, "Cannot write to register 0x%x", address);
                 return;
@@ -102,7 +176,12 @@ void write_cpu_memory(struct CPUBus* bus, word address, byte value) {
         return;
     }
     if (address < 0x8000) {
-        LOG(DEBUG, "Extended RAM not supported yet");
+        if (bus->prg_ram.count == 0) {
+            return;
+        }
+        const usize offset = address & (get_page_table_size(&bus->prg_ram) - 1);
+        write_page_table(&bus->prg_ram, offset, value);
+        bus->prg_ram_dirty |= 1u << (offset >> PAGE_SHIFT);
         return;
     }
     else {
@@ -110,10 +189,27 @@ void write_cpu_memory(struct CPUBus* bus, word address, byte value) {
     }
 }
 
+byte peek_cpu_memory(const struct CPUBus* bus, word address) {
+    // Memory only: registers are never read, since reading them has side effects
+    if (address < 0x2000) {
+        return read_page_table(&bus->ram, address & 0x7ff);
+    }
+    if (address >= 0x8000) {
+        return bus->mapper->read_prg(bus->mapper, address);
+    }
+    if (address >= 0x6000 && bus->prg_ram.count) {
+        return read_page_table(&bus->prg_ram, address & (get_page_table_size(&bus->prg_ram) - 1));
+    }
+    return 0;
+}
+
 const byte* get_page_ptr(const struct CPUBus* bus, word address) {
     if (address < 0x2000) {
-        return &bus->ram[address & 0x7ff];
+        return get_page(&bus->ram, (address & 0x7ff) >> PAGE_SHIFT) + (address & PAGE_MASK);
+    }
+    if (address >= 0x6000 && address < 0x8000 && bus->prg_ram.count) {
+        const usize offset = address & (get_page_table_size(&bus->prg_ram) - 1);
+        return get_page(&bus->prg_ram, offset >> PAGE_SHIFT) + (address & PAGE_MASK);
     }
-    LOG(ERROR, "Could not access pointer to address 0x%x", address);
-    exit(EXIT_FAILURE);
+    return NULL;
 }
\ No newline at end of file
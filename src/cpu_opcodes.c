@@ -1,3 +1,5 @@
+#include <stdio.h>
+
 #include "cpu_opcodes.h"
 
 const Instruction INSTRUCTIONS[0x100] = {
@@ -17,4 +19,49 @@ const Instruction INSTRUCTIONS[0x100] = {
         { 0xd0, BNE, REL, 2 }, { 0xd1, CMP, IDY, 5 }, { 0xd2, XXX, IMP, 0 }, { 0xd3, XXX, IMP, 0 }, { 0xd4, XXX, IMP, 0 }, { 0xd5, CMP, ZPX, 4 }, { 0xd6, DEC, ZPX, 6 }, { 0xd7, XXX, IMP, 0 }, { 0xd8, CLD, IMP, 2 }, { 0xd9, CMP, ABY, 4 }, { 0xda, XXX, IMP, 0 }, { 0xdb, XXX, IMP, 0 }, { 0xdc, XXX, IMP, 0 }, { 0xdd, CMP, ABX, 4 }, { 0xde, DEC, ABX, 7 }, { 0xdf, XXX, IMP, 0 },
         { 0xe0, CPX, IMM, 2 }, { 0xe1, SBC, IDX, 6 }, { 0xe2, XXX, IMP, 0 }, { 0xe3, XXX, IMP, 0 }, { 0xe4, CPX, ZPG, 3 }, { 0xe5, SBC, ZPG, 3 }, { 0xe6, INC, ZPG, 5 }, { 0xe7, XXX, IMP, 0 }, { 0xe8, INX, IMP, 2 }, { 0xe9, SBC, IMM, 2 }, { 0xea, NOP, IMP, 2 }, { 0xeb, SBC, IMM, 2 }, { 0xec, CPX, ABS, 4 }, { 0xed, SBC, ABS, 4 }, { 0xee, INC, ABS, 6 }, { 0xef, XXX, IMP, 0 },
         { 0xf0, BEQ, REL, 2 }, { 0xf1, SBC, IDY, 5 }, { 0xf2, XXX, IMP, 0 }, { 0xf3, XXX, IMP, 0 }, { 0xf4, XXX, IMP, 0 }, { 0xf5, SBC, ZPX, 4 }, { 0xf6, INC, ZPX, 6 }, { 0xf7, XXX, IMP, 0 }, { 0xf8, SED, IMP, 2 }, { 0xf9, SBC, ABY, 4 }, { 0xfa, XXX, IMP, 0 }, { 0xfb, XXX, IMP, 0 }, { 0xfc, XXX, IMP, 0 }, { 0xfd, SBC, ABX, 4 }, { 0xfe, INC, ABX, 7 }, { 0xff, XXX, IMP, 0 },
-};
\ No newline at end of file
+};
+
+const char* const OPERATION_NAMES[XXX + 1] = {
+        "ADC", "AND", "ASL", "BCC", "BCS", "BEQ", "BIT", "BMI", "BNE", "BPL", "BRK", "BVC", "BVS", "CLC", "CLD", "CLI", "CLV", "CMP", "CPX",
+        "CPY", "DEC", "DEX", "DEY", "EOR", "INC", "INX", "INY", "JMP", "JSR", "LDA", "LDX", "LDY", "LSR", "NOP", "ORA", "PHA", "PHP", "PLA",
+        "PLP", "ROL", "ROR", "RTI", "RTS", "SBC", "SEC", "SED", "SEI", "STA", "STX", "STY", "TAX", "TAY", "TSX", "TXS", "TXA", "TYA",
+        "???",
+};
+
+const char* const ADDRESS_MODE_NAMES[IMP + 1] = {
+        "IMM",
+        "ZPG", "ZPX", "ZPY",
+        "ABS", "ABX", "ABY",
+        "IND", "IDX", "IDY",
+        "REL", "ACC", "IMP",
+};
+
+const byte OPERAND_SIZES[IMP + 1] = {
+        1,
+        1, 1, 1,
+        2, 2, 2,
+        2, 1, 1,
+        1, 0, 0,
+};
+
+void disassemble(char* out, usize size, word pc, const byte* bytes) {
+    const Instruction* instr = &INSTRUCTIONS[bytes[0]];
+    const char* name = OPERATION_NAMES[instr->operation];
+    const byte lo = bytes[1];
+    const word value = bytes[1] | (bytes[2] << 8);
+    switch (instr->address_mode) {
+        case IMM: snprintf(out, size, "%s #$%02X", name, lo); break;
+        case ZPG: snprintf(out, size, "%s $%02X", name, lo); break;
+        case ZPX: snprintf(out, size, "%s $%02X,X", name, lo); break;
+        case ZPY: snprintf(out, size, "%s $%02X,Y", name, lo); break;
+        case ABS: snprintf(out, size, "%s $%04X", name, value); break;
+        case ABX: snprintf(out, size, "%s $%04X,X", name, value); break;
+        case ABY: snprintf(out, size, "%s $%04X,Y", name, value); break;
+        case IND: snprintf(out, size, "%s ($%04X)", name, value); break;
+        case IDX: snprintf(out, size, "%s ($%02X,X)", name, lo); break;
+        case IDY: snprintf(out, size, "%s ($%02X),Y", name, lo); break;
+        case REL: snprintf(out, size, "%s $%04X", name, (word)(pc + 2 + (sbyte)lo)); break;
+        case ACC: snprintf(out, size, "%s A", name); break;
+        default:  snprintf(out, size, "%s", name); break;
+    }
+}
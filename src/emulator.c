@@ -1,85 +1,147 @@
-#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "emulator.h"
+#include "bus_stats.h"
+#include "log.h"
 
-static void handle_event(struct Emulator* emulator, const SDL_Event* event);
+static void run_timed_frame(struct Emulator* emulator);
 
-void init_emulator(struct Emulator* emulator, int argc, char* argv[]) {
-    if (argc < 2) {
-        exit(EXIT_FAILURE);
+bool init_emulator(struct Emulator* emulator, struct RomImage* rom) {
+    // Save states and their hashes copy struct sections whole, padding included, so it starts out zeroed
+    memset(emulator, 0, sizeof(struct Emulator));
+    const RomError error = load_mapper(rom, &emulator->mapper);
+    if (error != ROM_OK) {
+        LOG(ERROR, "Could not load '%s': %s", rom->path, rom_error_string(error));
+        return false;
     }
-    load_mapper(argv[1], &emulator->mapper);
 
+    emulator->mapper.emulator = emulator;
     init_ppu_bus(emulator);
     init_cpu_bus(emulator);
     init_ppu(emulator);
     init_cpu(emulator);
-
-    struct GraphicsContext* gfx = &emulator->gfx;
-    gfx->width  = NES_VIDEO_WIDTH;
-    gfx->height = NES_VIDEO_HEIGHT;
-    gfx->scale  = 3.0f;
-    init_graphics(gfx, SDL_INIT_EVERYTHING);
-
-    emulator->exit  = 0;
-    emulator->pause = 0;
+    emulator->timing = NULL;
+    if (!init_apu(emulator) || emulator->ppu.frame == NULL) {
+        free_emulator(emulator);
+        return false;
+    }
+    return true;
 }
 
 void free_emulator(struct Emulator* emulator) {
-    free_graphics(&emulator->gfx);
+    free_apu(&emulator->apu);
+    free_ppu(&emulator->ppu);
+    free_cpu_bus(&emulator->cpu_bus);
+    free_ppu_bus(&emulator->ppu_bus);
     free_mapper(&emulator->mapper);
 }
 
-void run_emulator(struct Emulator* emulator) {
+struct Emulator* fork_emulator(struct Emulator* parent) {
+    struct Emulator* child = malloc(sizeof(struct Emulator));
+    if (child == NULL) {
+        return NULL;
+    }
+
+    // Registers are copied outright, padding and all so the child hashes like its parent. Memory and the
+    // last frame are shared until either side writes to them.
+    memcpy(child, parent, sizeof(struct Emulator));
+
+    share_page_table(&child->cpu_bus.ram, &parent->cpu_bus.ram);
+    share_page_table(&child->cpu_bus.prg_ram, &parent->cpu_bus.prg_ram);
+    share_page_table(&child->ppu_bus.vram, &parent->ppu_bus.vram);
+    share_page_table(&child->ppu.oam, &parent->ppu.oam);
+    share_page_table(&child->mapper.chr_ram, &parent->mapper.chr_ram);
+    share_ppu_frame(&child->ppu, &parent->ppu);
+    retain_rom_image(child->mapper.rom);
+
+#ifdef OLDNES_PROFILE
+    child->cpu.profiler     = NULL;
+#endif
+#ifdef OLDNES_BUS_STATS
+    child->cpu_bus.stats    = NULL;
+    child->ppu_bus.stats    = NULL;
+#endif
+    child->timing           = NULL;
+    child->cpu.trace        = NULL;
+    child->cpu.bus          = &child->cpu_bus;
+    child->ppu.bus          = &child->ppu_bus;
+    child->ppu.emulator     = child;
+    child->apu.blip         = NULL;
+    child->apu.emulator     = child;
+    child->cpu_bus.mapper   = &child->mapper;
+    child->mapper.emulator  = child;
+    child->cpu_bus.emulator = child;
+    child->cpu_bus.battery  = NULL;
+    child->ppu_bus.mapper   = &child->mapper;
+    return child;
+}
+
+bool is_out_of_memory(const struct Emulator* emulator) {
+    // Set once a write was lost to a failed copy-on-write; the machine has diverged from a real one
+    return emulator->ppu.out_of_memory || emulator->cpu_bus.ram.failed || emulator->cpu_bus.prg_ram.failed ||
+           emulator->ppu_bus.vram.failed || emulator->ppu.oam.failed || emulator->mapper.chr_ram.failed;
+}
+
+void run_frame(struct Emulator* emulator) {
     struct CPU* cpu = &emulator->cpu;
     struct PPU* ppu = &emulator->ppu;
-    struct Controller* pad1 = &emulator->cpu_bus.pad1;
-    struct Controller* pad2 = &emulator->cpu_bus.pad2;
-    struct GraphicsContext* gfx = &emulator->gfx;
-
-    SDL_Event event;
-    while (!emulator->exit) {
-        while (SDL_PollEvent(&event)) {
-            update_controller(pad1, &event);
-            update_controller(pad2, &event);
-            handle_event(emulator, &event);
-        }
-        if (!emulator->pause) {
-            while (!ppu->render) {
-                execute_ppu(ppu);
-                execute_ppu(ppu);
-                execute_ppu(ppu);
-                execute_cpu(cpu);
-            }
-            render_graphics(gfx, ppu->screen_buffer);
-            ppu->render = 0;
-        } else {
 
+    if (emulator->timing != NULL) {
+        run_timed_frame(emulator);
+    } else {
+        ppu->render = false;
+        while (!ppu->render) {
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_cpu(cpu);
         }
     }
+    end_apu_frame(&emulator->apu);
+    flush_prg_ram(&emulator->cpu_bus);
+#ifdef OLDNES_BUS_STATS
+    end_bus_stats_frame(emulator->cpu_bus.stats);
+#endif
 }
 
-static void handle_event(struct Emulator* emulator, const SDL_Event* event) {
-    switch (event->type) {
-        case SDL_KEYDOWN: {
-            switch (event->key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    emulator->exit = 1;
-                    break;
-                case SDLK_SPACE:
-                    emulator->pause ^= 1;
-                    break;
-                default:
-                    break;
-            }
-            break;
-        }
-        case SDL_QUIT: {
-            emulator->exit = 1;
-            break;
-        }
-        default: {
+void run_scheduled_events(struct Emulator* emulator) {
+    struct Mapper* mapper = &emulator->mapper;
+    mapper->sync(mapper);
+    sync_apu(&emulator->apu, emulator->cpu.cycles);
+}
 
+void schedule_events(struct Emulator* emulator) {
+    const struct Mapper* mapper = &emulator->mapper;
+    const uint64_t apu = next_apu_event(&emulator->apu);
+    const uint64_t irq = mapper->next_event(mapper);
+    emulator->cpu.event_cycle = apu < irq ? apu : irq;
+}
+
+static void run_timed_frame(struct Emulator* emulator) {
+    struct CPU* cpu = &emulator->cpu;
+    struct PPU* ppu = &emulator->ppu;
+    struct FrameTiming* timing = emulator->timing;
+
+    const uint64_t start = read_ticks();
+    usize step = 0;
+    ppu->render = false;
+    while (!ppu->render) {
+        if (++step % TIMING_SAMPLE_INTERVAL == 0) {
+            const uint64_t before_ppu = read_ticks();
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            const uint64_t before_cpu = read_ticks();
+            execute_cpu(cpu);
+            timing->sampled_ppu += before_cpu - before_ppu;
+            timing->sampled_cpu += read_ticks() - before_cpu;
+        } else {
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_ppu(ppu);
+            execute_cpu(cpu);
         }
     }
+    split_frame_timing(timing, start);
 }
\ No newline at end of file
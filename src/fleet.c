@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fleet.h"
+#include "emulator.h"
+#include "log.h"
+
+static void run_slice(void* context);
+static void apply_inputs(struct FleetInstance* instance);
+static double elapsed_seconds(const struct timespec* start);
+
+static bool load_input_script(struct FleetInstance* instance, const char* path);
+
+bool init_fleet(struct Fleet* fleet, usize workers, usize slice_frames) {
+    memset(fleet, 0, sizeof(struct Fleet));
+    fleet->slice_frames = slice_frames ? slice_frames : FLEET_SLICE_FRAMES;
+    init_rom_cache(&fleet->roms);
+    return init_thread_pool(&fleet->pool, workers);
+}
+
+void free_fleet(struct Fleet* fleet) {
+    free_thread_pool(&fleet->pool);
+    for (usize i = 0; i < fleet->count; i++) {
+        struct FleetInstance* instance = fleet->instances[i];
+        free_emulator(instance->emulator);
+        free(instance->emulator);
+        release_rom_image(instance->rom);
+        free(instance->inputs);
+        free(instance);
+    }
+    free(fleet->instances);
+    free_rom_cache(&fleet->roms);
+}
+
+bool add_fleet_instance(struct Fleet* fleet, const char* rom_path, usize frames, const char* input_path) {
+    // Instances running the same game share one read-only copy of it
+    RomError error;
+    struct RomImage* rom = acquire_rom_image(&fleet->roms, rom_path, &error);
+    if (rom == NULL) {
+        return false;
+    }
+
+    struct FleetInstance* instance = calloc(1, sizeof(struct FleetInstance));
+    instance->id       = fleet->count;
+    instance->rom      = rom;
+    instance->frames   = frames;
+    instance->fleet    = fleet;
+    instance->emulator = calloc(1, sizeof(struct Emulator));
+    if (instance->emulator == NULL || !init_emulator(instance->emulator, rom)) {
+        free(instance->emulator);
+        free(instance);
+        release_rom_image(rom);
+        return false;
+    }
+    if (input_path != NULL && !load_input_script(instance, input_path)) {
+        free_emulator(instance->emulator);
+        free(instance->emulator);
+        free(instance->inputs);
+        free(instance);
+        release_rom_image(rom);
+        return false;
+    }
+
+    fleet->instances = realloc(fleet->instances, (fleet->count + 1) * sizeof(struct FleetInstance*));
+    fleet->instances[fleet->count++] = instance;
+    return true;
+}
+
+bool load_fleet_config(struct Fleet* fleet, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        LOG(ERROR, "File '%s' is not found.", path);
+        return false;
+    }
+
+    // Each line reads: <rom> <frames> [input script]
+    char line[1024];
+    char rom_path[512];
+    char input_path[512];
+    bool success = true;
+    while (success && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        unsigned long frames;
+        const int fields = sscanf(line, "%511s %lu %511s", rom_path, &frames, input_path);
+        if (fields < 2) {
+            LOG(ERROR, "Malformed fleet entry: %s", line);
+            success = false;
+            break;
+        }
+        success = add_fleet_instance(fleet, rom_path, frames, fields == 3 ? input_path : NULL);
+    }
+    fclose(file);
+    return success;
+}
+
+void run_fleet(struct Fleet* fleet) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (usize i = 0; i < fleet->count; i++) {
+        submit_task(&fleet->pool, run_slice, fleet->instances[i]);
+    }
+    wait_thread_pool(&fleet->pool);
+    fleet->seconds = elapsed_seconds(&start);
+}
+
+void report_fleet(const struct Fleet* fleet, FILE* out) {
+    usize total_frames = 0;
+    fprintf(out, "%-6s %-10s %-10s %-10s %s\n", "id", "frames", "seconds", "fps", "rom");
+    for (usize i = 0; i < fleet->count; i++) {
+        const struct FleetInstance* instance = fleet->instances[i];
+        const double fps = instance->seconds > 0 ? instance->frames_done / instance->seconds : 0;
+        fprintf(out, "%-6u %-10u %-10.3f %-10.1f %s\n",
+                instance->id, instance->frames_done, instance->seconds, fps, instance->rom->path);
+        total_frames += instance->frames_done;
+    }
+    const double fps = fleet->seconds > 0 ? total_frames / fleet->seconds : 0;
+    fprintf(out, "total: %u instances, %u frames in %.3f s (%.1f fps on %u workers)\n",
+            fleet->count, total_frames, fleet->seconds, fps, fleet->pool.workers);
+}
+
+static void run_slice(void* context) {
+    struct FleetInstance* instance = context;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    usize stop = instance->frames_done + instance->fleet->slice_frames;
+    if (stop > instance->frames) {
+        stop = instance->frames;
+    }
+    while (instance->frames_done < stop) {
+        apply_inputs(instance);
+        run_frame(instance->emulator);
+        instance->frames_done++;
+    }
+    instance->seconds += elapsed_seconds(&start);
+
+    // An instance that lost writes is no longer worth running, but the rest of the fleet is
+    if (is_out_of_memory(instance->emulator)) {
+        LOG(ERROR, "Stopping instance %u after %u frames: out of memory", instance->id, instance->frames_done);
+        instance->frames = instance->frames_done;
+    }
+
+    // Requeue instead of looping so long runs stay balanced across workers
+    if (instance->frames_done < instance->frames) {
+        submit_task(&instance->fleet->pool, run_slice, instance);
+    }
+}
+
+static void apply_inputs(struct FleetInstance* instance) {
+    struct CPUBus* bus = &instance->emulator->cpu_bus;
+    while (instance->next_input < instance->input_count &&
+           instance->inputs[instance->next_input].frame <= instance->frames_done) {
+        const struct InputEvent* event = &instance->inputs[instance->next_input++];
+        set_controller(&bus->pad1, event->pad1);
+        set_controller(&bus->pad2, event->pad2);
+    }
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static bool load_input_script(struct FleetInstance* instance, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        LOG(ERROR, "File '%s' is not found.", path);
+        return false;
+    }
+
+    // Each line reads: <frame> <pad1> [pad2], button masks may be written in hex
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        unsigned long frame;
+        unsigned int pad1, pad2 = 0;
+        if (sscanf(line, "%lu %i %i", &frame, &pad1, &pad2) < 2) {
+            LOG(ERROR, "Malformed input event in '%s': %s", path, line);
+            fclose(file);
+            return false;
+        }
+        instance->inputs = realloc(instance->inputs, (instance->input_count + 1) * sizeof(struct InputEvent));
+        instance->inputs[instance->input_count++] = (struct InputEvent){ frame, pad1, pad2 };
+    }
+    fclose(file);
+    return true;
+}
\ No newline at end of file
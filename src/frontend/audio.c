@@ -0,0 +1,153 @@
+#include <string.h>
+
+#include "audio.h"
+#include "log.h"
+
+#define AUDIO_MASK        (AUDIO_RING_SIZE - 1)
+#define AUDIO_MIN_BUFFER  256
+#define AUDIO_WAIT_LIMIT  100
+
+static void audio_callback(void* userdata, Uint8* stream, int length);
+
+bool init_audio(struct AudioContext* audio, int sample_rate, unsigned latency_ms) {
+    memset(audio, 0, sizeof(struct AudioContext));
+    audio->sample_rate = sample_rate;
+    audio->step = 1.0;
+
+    // Half the ring sits between the emulator and the speakers, so the whole of it is twice the latency
+    usize target = (usize)sample_rate * latency_ms / 1000;
+    target = target < AUDIO_RING_SIZE / 2 ? target : AUDIO_RING_SIZE / 2;
+    target = target > AUDIO_MIN_BUFFER ? target : AUDIO_MIN_BUFFER;
+    audio->target = target;
+
+    // The device pulls at most half the target at a time, rounded down to a power of two
+    Uint16 buffer = AUDIO_MIN_BUFFER;
+    while (buffer * 4u <= target) {
+        buffer *= 2;
+    }
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        LOG(ERROR, SDL_GetError());
+        return false;
+    }
+    const SDL_AudioSpec desired = {
+        .freq     = sample_rate,
+        .format   = AUDIO_S16SYS,
+        .channels = 1,
+        .samples  = buffer,
+        .callback = audio_callback,
+        .userdata = audio,
+    };
+    SDL_AudioSpec obtained;
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
+    if (audio->device == 0) {
+        LOG(ERROR, SDL_GetError());
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+    LOG(DEBUG, "Opened audio device at %d Hz, %u sample buffer, %u sample target",
+        obtained.freq, obtained.samples, (unsigned)target);
+    return true;
+}
+
+void free_audio(struct AudioContext* audio) {
+    if (audio->device == 0) {
+        return;
+    }
+    SDL_CloseAudioDevice(audio->device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    audio->device = 0;
+}
+
+void queue_audio(struct AudioContext* audio, const sword* samples, usize count) {
+    if (audio->device == 0 || count == 0) {
+        return;
+    }
+    const usize read = atomic_load_explicit(&audio->read, memory_order_acquire);
+    usize write = atomic_load_explicit(&audio->write, memory_order_relaxed);
+
+    // Proportional control: a fuller ring consumes input faster and so produces fewer samples
+    double error = ((double)(write - read) - (double)audio->target) / (double)audio->target;
+    error = error > 1.0 ? 1.0 : error < -1.0 ? -1.0 : error;
+    audio->step = 1.0 + error * AUDIO_MAX_ADJUST;
+
+    // Linear interpolation, with the last sample of the previous batch in front of this one
+    bool overrun = false;
+    double position = audio->position;
+    for (; position < (double)count; position += audio->step) {
+        const usize index = (usize)position;
+        const double fraction = position - (double)index;
+        const sword before = index == 0 ? audio->last : samples[index - 1];
+        const sword sample = (sword)(before + (samples[index] - before) * fraction);
+        if (write - read >= AUDIO_RING_SIZE) {
+            overrun = true;
+            continue;
+        }
+        audio->ring[write & AUDIO_MASK] = sample;
+        write++;
+    }
+    audio->position = position - (double)count;
+    audio->last = samples[count - 1];
+    audio->overruns += overrun;
+    atomic_store_explicit(&audio->write, write, memory_order_release);
+
+    // Playback starts, or resumes after a pause, only once the target is buffered
+    if (!audio->playing && write - read >= audio->target) {
+        audio->playing = true;
+        SDL_PauseAudioDevice(audio->device, 0);
+    }
+}
+
+void pause_audio(struct AudioContext* audio, bool pause) {
+    if (audio->device == 0 || !pause) {
+        return;
+    }
+    SDL_PauseAudioDevice(audio->device, 1);
+    audio->playing = false;
+}
+
+void wait_for_audio(struct AudioContext* audio) {
+    // Syncing to audio: hold the emulator back until the callback has drained the ring to its target
+    for (unsigned i = 0; audio->playing && i < AUDIO_WAIT_LIMIT; i++) {
+        const usize write = atomic_load_explicit(&audio->write, memory_order_relaxed);
+        const usize read = atomic_load_explicit(&audio->read, memory_order_acquire);
+        if (write - read <= audio->target) {
+            return;
+        }
+        SDL_Delay(1);
+    }
+}
+
+void report_audio(const struct AudioContext* audio, FILE* out) {
+    if (audio->device == 0) {
+        return;
+    }
+    fprintf(out, "audio: %u underruns, %u overruns, %.1f ms target latency, resampling at %+.3f%%\n",
+            atomic_load(&audio->underruns), (unsigned)audio->overruns,
+            1000.0 * (double)audio->target / audio->sample_rate, (audio->step - 1.0) * 100.0);
+}
+
+static void audio_callback(void* userdata, Uint8* stream, int length) {
+    struct AudioContext* audio = userdata;
+    sword* out = (sword*)stream;
+    const usize wanted = (usize)length / sizeof(sword);
+    const usize read = atomic_load_explicit(&audio->read, memory_order_relaxed);
+    const usize write = atomic_load_explicit(&audio->write, memory_order_acquire);
+
+    const usize available = write - read;
+    const usize count = available < wanted ? available : wanted;
+    const usize start = read & AUDIO_MASK;
+    const usize first = count < AUDIO_RING_SIZE - start ? count : AUDIO_RING_SIZE - start;
+    memcpy(out, &audio->ring[start], first * sizeof(sword));
+    memcpy(out + first, audio->ring, (count - first) * sizeof(sword));
+    atomic_store_explicit(&audio->read, read + count, memory_order_release);
+
+    // Holding the last sample instead of dropping to silence keeps an underrun from clicking
+    if (count < wanted) {
+        const sword hold = count > 0 ? out[count - 1] : 0;
+        for (usize i = count; i < wanted; i++) {
+            out[i] = hold;
+        }
+        atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,377 @@
+#include <SDL2/SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frontend.h"
+#include "state.h"
+#include "profiler.h"
+#include "bus_stats.h"
+#include "trace.h"
+#include "rom_index.h"
+#include "log.h"
+
+static void handle_event(struct Frontend* frontend, const SDL_Event* event);
+static void update_controller(struct Controller* controller, const SDL_Event* event);
+static void quick_save(struct Frontend* frontend);
+static void quick_load(struct Frontend* frontend);
+static void attach_save_file(struct Frontend* frontend, const char* rom_path);
+
+bool init_frontend(struct Frontend* frontend, int argc, char* argv[]) {
+    const char* rom_path = NULL;
+    byte run_ahead = 0;
+    bool timing = false;
+    const char* timing_path = NULL;
+    const char* log_path = NULL;
+    const char* index_path = NULL;
+    unsigned latency = AUDIO_DEFAULT_LATENCY;
+    bool audio_sync = true;
+    struct GraphicsContext* gfx = &frontend->gfx;
+    frontend->movie_path = NULL;
+    frontend->trace_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--run-ahead=", 12) == 0) {
+            run_ahead = (byte)strtoul(argv[i] + 12, NULL, 10);
+        } else if (strncmp(argv[i], "--record=", 9) == 0) {
+            frontend->movie_path = argv[i] + 9;
+        } else if (strcmp(argv[i], "--timing") == 0) {
+            timing = true;
+        } else if (strncmp(argv[i], "--timing=", 9) == 0) {
+            timing = true;
+            timing_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--log=", 6) == 0) {
+            log_path = argv[i] + 6;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            frontend->trace_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--index=", 8) == 0) {
+            index_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--latency=", 10) == 0) {
+            latency = (unsigned)strtoul(argv[i] + 10, NULL, 10);
+        } else if (strcmp(argv[i], "--sync=vsync") == 0) {
+            audio_sync = false;
+        } else if (strcmp(argv[i], "--sync=audio") == 0) {
+            audio_sync = true;
+        } else {
+            rom_path = argv[i];
+        }
+    }
+    if (rom_path == NULL) {
+        LOG(ERROR, "Usage: %s [--run-ahead=N] [--record=movie] [--timing[=file.csv]] [--log=file] [--trace=file] "
+                   "[--index=file] [--latency=ms] [--sync=audio|vsync] <rom>", argv[0]);
+        return false;
+    }
+    // The emulation thread only ever hands messages to the writer, which the caller stops on exit.
+    // A failure from here on unwinds everything set up before it, the writer included.
+    if (!start_log_writer(log_path)) {
+        return false;
+    }
+    if (!init_frame_timing(&frontend->timing, timing_path)) {
+        goto stop_log;
+    }
+
+    RomError error;
+    struct RomImage* rom = load_rom_image(rom_path, &error);
+    if (rom == NULL) {
+        goto free_timing;
+    }
+    // Header corrections come from the library index, so a mis-headered dump needs no rescan
+    struct RomIndex index;
+    if (index_path != NULL && open_rom_index(&index, index_path)) {
+        apply_rom_index(&index, rom);
+        close_rom_index(&index);
+    } else if (index_path != NULL) {
+        LOG(ERROR, "Could not open ROM index '%s'", index_path);
+    }
+    const bool loaded = init_emulator(&frontend->emulator, rom);
+    release_rom_image(rom);
+    if (!loaded) {
+        goto free_timing;
+    }
+    frontend->emulator.timing = timing ? &frontend->timing : NULL;
+    frontend->show_timing = false;
+    attach_save_file(frontend, rom_path);
+
+    // Without a sound device there is nothing to sync to, so presenting falls back to waiting for vsync
+    if (!init_audio(&frontend->audio, APU_SAMPLE_RATE, latency)) {
+        LOG(INFO, "Running without sound");
+    }
+    frontend->audio_sync = audio_sync && frontend->audio.device != 0;
+
+    gfx->width  = NES_VIDEO_WIDTH;
+    gfx->height = NES_VIDEO_HEIGHT;
+    gfx->scale  = 3.0f;
+    gfx->vsync  = !frontend->audio_sync;
+    init_graphics(gfx, SDL_INIT_EVERYTHING);
+
+    frontend->exit  = 0;
+    frontend->pause = 0;
+    frontend->quick_state = NULL;
+    frontend->quick_state_size = 0;
+    frontend->rewinding = false;
+    if (!init_rewind(&frontend->rewind, REWIND_DEFAULT_BUDGET, REWIND_KEYFRAME_INTERVAL)) {
+        goto free_output;
+    }
+    if (!init_run_ahead(&frontend->run_ahead, run_ahead)) {
+        goto free_rewind;
+    }
+#ifdef OLDNES_PROFILE
+    frontend->emulator.cpu.profiler = create_profiler();
+#endif
+#ifdef OLDNES_BUS_STATS
+    frontend->emulator.cpu_bus.stats = create_bus_stats();
+    frontend->emulator.ppu_bus.stats = frontend->emulator.cpu_bus.stats;
+#endif
+    init_movie(&frontend->movie);
+    if (frontend->movie_path != NULL && !start_recording(&frontend->movie, &frontend->emulator)) {
+        goto free_diagnostics;
+    }
+    // F6 saves the last TRACE_RECORDS instructions, so does a crash
+    if (frontend->trace_path != NULL) {
+        frontend->emulator.cpu.trace = create_trace_ring(TRACE_RECORDS);
+        dump_trace_on_crash(frontend->emulator.cpu.trace, frontend->trace_path);
+    }
+    return true;
+
+free_diagnostics:
+    free_movie(&frontend->movie);
+#ifdef OLDNES_PROFILE
+    free_profiler(frontend->emulator.cpu.profiler);
+#endif
+#ifdef OLDNES_BUS_STATS
+    free_bus_stats(frontend->emulator.cpu_bus.stats);
+#endif
+    free_run_ahead(&frontend->run_ahead);
+free_rewind:
+    free_rewind(&frontend->rewind);
+free_output:
+    free_audio(&frontend->audio);
+    free_graphics(gfx);
+    free_emulator(&frontend->emulator);
+free_timing:
+    free_frame_timing(&frontend->timing);
+stop_log:
+    stop_log_writer();
+    return false;
+}
+
+void free_frontend(struct Frontend* frontend) {
+#ifdef OLDNES_PROFILE
+    report_profile(frontend->emulator.cpu.profiler, stdout, PROFILE_TOP);
+    free_profiler(frontend->emulator.cpu.profiler);
+#endif
+#ifdef OLDNES_BUS_STATS
+    report_bus_stats(frontend->emulator.cpu_bus.stats, stdout);
+    free_bus_stats(frontend->emulator.cpu_bus.stats);
+#endif
+    free_trace_ring(frontend->emulator.cpu.trace);
+    report_audio(&frontend->audio, stdout);
+    free_audio(&frontend->audio);
+    free_graphics(&frontend->gfx);
+    free_emulator(&frontend->emulator);
+    free(frontend->quick_state);
+    free_rewind(&frontend->rewind);
+    if (frontend->run_ahead.frames > 0) {
+        report_run_ahead(&frontend->run_ahead, stdout);
+    }
+    free_run_ahead(&frontend->run_ahead);
+    if (frontend->movie_path != NULL) {
+        save_movie(&frontend->movie, frontend->movie_path);
+    }
+    free_movie(&frontend->movie);
+    report_frame_timing(&frontend->timing, stdout);
+    free_frame_timing(&frontend->timing);
+}
+
+void run_frontend(struct Frontend* frontend) {
+    struct Emulator* emulator = &frontend->emulator;
+    struct Controller* pad1 = &emulator->cpu_bus.pad1;
+    struct Controller* pad2 = &emulator->cpu_bus.pad2;
+    struct GraphicsContext* gfx = &frontend->gfx;
+
+    SDL_Event event;
+    while (!frontend->exit) {
+        uint64_t now = read_ticks();
+        while (SDL_PollEvent(&event)) {
+            update_controller(pad1, &event);
+            update_controller(pad2, &event);
+            handle_event(frontend, &event);
+        }
+        if (!frontend->pause) {
+            // Timing may have been switched on by the events above, so it is looked up afterwards
+            struct FrameTiming* timing = emulator->timing;
+            now = lap_frame_timing(timing, TIMING_INPUT, now);
+            if (frontend->rewinding) {
+                // Step back one frame and replay it so there is a picture to show
+                if (rewind_emulator(&frontend->rewind, emulator)) {
+                    run_frame(emulator);
+                    queue_audio(&frontend->audio, emulator->apu.blip->samples, emulator->apu.blip->count);
+                }
+            } else {
+                capture_rewind(&frontend->rewind, emulator);
+                run_frame_ahead(&frontend->run_ahead, emulator);
+                if (frontend->movie_path != NULL && !record_frame(&frontend->movie, emulator)) {
+                    // Keep what was recorded rather than a movie with frames missing from the middle
+                    save_movie(&frontend->movie, frontend->movie_path);
+                    frontend->movie_path = NULL;
+                }
+                queue_audio(&frontend->audio, emulator->apu.blip->samples, emulator->apu.blip->count);
+            }
+            now = lap_emulation_timing(timing, now);
+
+            draw_graphics(gfx, get_screen_buffer(&emulator->ppu));
+            if (frontend->show_timing) {
+                draw_timing_overlay(gfx, &frontend->timing);
+            }
+            now = lap_frame_timing(timing, TIMING_PRESENT, now);
+            // With vsync on, presenting is where the loop waits for the display, otherwise it waits for the sound card
+            present_graphics(gfx);
+            if (frontend->audio_sync) {
+                wait_for_audio(&frontend->audio);
+            }
+            lap_frame_timing(timing, TIMING_PACING, now);
+            end_frame_timing(timing);
+        }
+    }
+}
+
+static void handle_event(struct Frontend* frontend, const SDL_Event* event) {
+    switch (event->type) {
+        case SDL_KEYDOWN: {
+            switch (event->key.keysym.sym) {
+                case SDLK_ESCAPE:
+                    frontend->exit = 1;
+                    break;
+                case SDLK_SPACE:
+                    frontend->pause ^= 1;
+                    pause_audio(&frontend->audio, frontend->pause);
+                    break;
+                case SDLK_F5:
+                    quick_save(frontend);
+                    break;
+                case SDLK_F8:
+                    quick_load(frontend);
+                    break;
+#ifdef OLDNES_PROFILE
+                case SDLK_F2:
+                    report_profile(frontend->emulator.cpu.profiler, stdout, PROFILE_TOP);
+                    break;
+#endif
+#ifdef OLDNES_BUS_STATS
+                case SDLK_F4:
+                    report_bus_stats(frontend->emulator.cpu_bus.stats, stdout);
+                    break;
+#endif
+                case SDLK_F6:
+                    if (frontend->emulator.cpu.trace != NULL) {
+                        save_trace(frontend->emulator.cpu.trace, frontend->trace_path);
+                        LOG(INFO, "Saved trace to '%s'", frontend->trace_path);
+                    }
+                    break;
+                case SDLK_F3:
+                    frontend->show_timing ^= 1;
+                    frontend->emulator.timing = &frontend->timing;
+                    break;
+                case SDLK_BACKSPACE:
+                    // A movie only holds input, so jumping back would desynchronise it
+                    frontend->rewinding = frontend->movie_path == NULL;
+                    break;
+                default:
+                    break;
+            }
+            break;
+        }
+        case SDL_KEYUP: {
+            if (event->key.keysym.sym == SDLK_BACKSPACE) {
+                frontend->rewinding = false;
+            }
+            break;
+        }
+        case SDL_QUIT: {
+            frontend->exit = 1;
+            break;
+        }
+        default: {
+
+        }
+    }
+}
+
+static void update_controller(struct Controller* controller, const SDL_Event* event) {
+    byte key = 0;
+    switch (event->key.keysym.sym) {
+        case SDLK_RIGHT:
+            key = RIGHT;
+            break;
+        case SDLK_LEFT:
+            key = LEFT;
+            break;
+        case SDLK_DOWN:
+            key = DOWN;
+            break;
+        case SDLK_UP:
+            key = UP;
+            break;
+        case SDLK_RETURN:
+            key = START;
+            break;
+        case SDLK_RSHIFT:
+            key = SELECT;
+            break;
+        case SDLK_z:
+            key = A;
+            break;
+        case SDLK_x:
+            key = B;
+            break;
+        default:
+            break;
+    }
+    if (event->type == SDL_KEYUP)
+        set_controller(controller, controller->status & ~key);
+    if (event->type == SDL_KEYDOWN)
+        set_controller(controller, controller->status | key);
+}
+
+static void quick_save(struct Frontend* frontend) {
+    const usize size = get_state_size(&frontend->emulator);
+    if (size > frontend->quick_state_size) {
+        // The previous save is kept if there is no room for a bigger one
+        byte* state = malloc(size);
+        if (state == NULL) {
+            LOG(ERROR, "Could not allocate %u bytes for a quick save", size);
+            return;
+        }
+        free(frontend->quick_state);
+        frontend->quick_state = state;
+    }
+    frontend->quick_state_size = save_state(&frontend->emulator, frontend->quick_state, size);
+    LOG(INFO, "Saved state (%u bytes)", frontend->quick_state_size);
+}
+
+static void quick_load(struct Frontend* frontend) {
+    if (frontend->quick_state_size == 0) {
+        return;
+    }
+    if (frontend->movie_path != NULL) {
+        LOG(INFO, "Loading states is disabled while recording a movie");
+        return;
+    }
+    if (load_state(&frontend->emulator, frontend->quick_state, frontend->quick_state_size)) {
+        LOG(INFO, "Loaded state");
+    }
+}
+static void attach_save_file(struct Frontend* frontend, const char* rom_path) {
+    // Battery RAM lives next to the ROM, as game.sav for game.nes
+    if (!frontend->emulator.mapper.rom->info.battery) {
+        return;
+    }
+    char path[4096];
+    const char* dot = strrchr(rom_path, '.');
+    const char* slash = strrchr(rom_path, '/');
+    const int stem = dot != NULL && (slash == NULL || dot > slash) ? (int)(dot - rom_path) : (int)strlen(rom_path);
+    if (snprintf(path, sizeof(path), "%.*s.sav", stem, rom_path) >= (int)sizeof(path)) {
+        return;
+    }
+    if (attach_battery(&frontend->emulator.cpu_bus, path)) {
+        LOG(INFO, "Battery RAM is saved to '%s'", path);
+    }
+}
@@ -0,0 +1,104 @@
+#include "graphics.h"
+#include "log.h"
+
+void init_graphics(struct GraphicsContext* gfx, uint32_t systems) {
+    SDL_Init(systems);
+    gfx->window = SDL_CreateWindow("OldNES Emulator",
+            SDL_WINDOWPOS_CENTERED,
+            SDL_WINDOWPOS_CENTERED,
+            gfx->width  * (int)gfx->scale,
+            gfx->height * (int)gfx->scale,
+            SDL_WINDOW_SHOWN);
+    if (gfx->window == NULL) {
+        LOG(ERROR, SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    const uint32_t flags = SDL_RENDERER_ACCELERATED | (gfx->vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+    gfx->renderer = SDL_CreateRenderer(gfx->window, -1, flags);
+    if (gfx->renderer == NULL) {
+        LOG(ERROR, SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    SDL_RenderSetLogicalSize(gfx->renderer, gfx->width, gfx->height);
+    SDL_RenderSetIntegerScale(gfx->renderer, 1);
+    SDL_RenderSetScale(gfx->renderer, gfx->scale, gfx->scale);
+
+    gfx->texture = SDL_CreateTexture(gfx->renderer,
+            SDL_PIXELFORMAT_ABGR8888,
+            SDL_TEXTUREACCESS_STREAMING,
+            gfx->width,
+            gfx->height);
+    if(gfx->texture == NULL){
+        LOG(ERROR, SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    SDL_SetRenderDrawColor(gfx->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(gfx->renderer);
+    SDL_RenderPresent(gfx->renderer);
+
+    LOG(DEBUG, "Initialized SDL subsystem");
+}
+
+void free_graphics(struct GraphicsContext* gfx) {
+    SDL_DestroyTexture(gfx->texture);
+    SDL_DestroyRenderer(gfx->renderer);
+    SDL_DestroyWindow(gfx->window);
+    SDL_Quit();
+
+    LOG(DEBUG, "Graphics clean up finished");
+}
+
+void render_graphics(struct GraphicsContext* gfx, const uint32_t* buffer){
+    draw_graphics(gfx, buffer);
+    present_graphics(gfx);
+}
+
+void draw_graphics(struct GraphicsContext* gfx, const uint32_t* buffer) {
+    SDL_RenderClear(gfx->renderer);
+    SDL_UpdateTexture(gfx->texture, NULL, buffer, (int)(gfx->width * sizeof(uint32_t)));
+    SDL_RenderCopy(gfx->renderer, gfx->texture, NULL, NULL);
+}
+
+void draw_timing_overlay(struct GraphicsContext* gfx, const struct FrameTiming* timing) {
+    // One stacked bar per frame, newest on the right; the line marks a 60Hz frame
+    static const byte COLORS[TIMING_SECTIONS][3] = {
+        [TIMING_INPUT]   = { 0x40, 0xa0, 0xff },
+        [TIMING_CPU]     = { 0xff, 0x50, 0x40 },
+        [TIMING_PPU]     = { 0x40, 0xe0, 0x60 },
+        [TIMING_PRESENT] = { 0xff, 0xd0, 0x30 },
+        [TIMING_PACING]  = { 0x90, 0x90, 0x90 },
+    };
+    const int bars = gfx->width / TIMING_BAR_WIDTH;
+    const int bottom = gfx->height;
+    const double pixels_per_ms = TIMING_BUDGET_HEIGHT / (1000.0 / 60.0);
+
+    SDL_SetRenderDrawBlendMode(gfx->renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(gfx->renderer, 0, 0, 0, 0xa0);
+    const SDL_Rect background = { 0, bottom - 2 * TIMING_BUDGET_HEIGHT, gfx->width, 2 * TIMING_BUDGET_HEIGHT };
+    SDL_RenderFillRect(gfx->renderer, &background);
+
+    for (int i = 0; i < bars; i++) {
+        int y = bottom;
+        for (int section = 0; section < TIMING_SECTIONS; section++) {
+            const int height = (int)(get_frame_time(timing, bars - 1 - i, section) * pixels_per_ms + 0.5);
+            if (height == 0) {
+                continue;
+            }
+            y -= height;
+            const SDL_Rect bar = { i * TIMING_BAR_WIDTH, y, TIMING_BAR_WIDTH, height };
+            SDL_SetRenderDrawColor(gfx->renderer, COLORS[section][0], COLORS[section][1], COLORS[section][2], 0xff);
+            SDL_RenderFillRect(gfx->renderer, &bar);
+        }
+    }
+
+    const SDL_Rect budget = { 0, bottom - TIMING_BUDGET_HEIGHT, gfx->width, 1 };
+    SDL_SetRenderDrawColor(gfx->renderer, 0xff, 0xff, 0xff, 0xc0);
+    SDL_RenderFillRect(gfx->renderer, &budget);
+    SDL_SetRenderDrawColor(gfx->renderer, 0, 0, 0, 0xff);
+    SDL_SetRenderDrawBlendMode(gfx->renderer, SDL_BLENDMODE_NONE);
+}
+
+void present_graphics(struct GraphicsContext* gfx) {
+    SDL_RenderPresent(gfx->renderer);
+}
\ No newline at end of file
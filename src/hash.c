@@ -0,0 +1,206 @@
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+
+// XXH64 constants and round structure
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+#define PRIME32_1 0x9E3779B1U
+
+// Wide hashing follows the XXH3 long-input loop: eight 64-bit lanes eat 64-byte stripes,
+// each mixed with a sliding key, and get scrambled after every block of stripes
+#define STRIPE_SIZE       64
+#define STRIPE_LANES      8
+#define STRIPES_PER_BLOCK 16
+#define KEY_SIZE          (STRIPES_PER_BLOCK * 8 + STRIPE_SIZE)
+
+// Taken from a splitmix64 sequence; the values only need to look random
+static const byte WIDE_KEY[KEY_SIZE] = {
+    0x94, 0x3e, 0x94, 0xb4, 0x1e, 0xf2, 0x9f, 0x8c, 0x4c, 0x25, 0x91, 0x09,
+    0xd8, 0xcf, 0x9b, 0x52, 0x6e, 0x5e, 0x1b, 0x93, 0x6d, 0xeb, 0xb8, 0x12,
+    0x21, 0xcc, 0x1f, 0x0c, 0x5d, 0x0c, 0xc5, 0xce, 0xa1, 0x1c, 0xef, 0x26,
+    0x6e, 0x79, 0xf5, 0x31, 0x82, 0xff, 0x1d, 0xd9, 0x5a, 0x0e, 0xad, 0x6f,
+    0x33, 0x54, 0x40, 0xf5, 0xc6, 0x22, 0x1c, 0x06, 0xa1, 0x86, 0x78, 0xe3,
+    0x3b, 0xed, 0xeb, 0xac, 0xa6, 0x13, 0x27, 0x5a, 0x48, 0xe8, 0x81, 0x0d,
+    0x8c, 0x23, 0xfd, 0xf1, 0xf8, 0x00, 0xe6, 0xa3, 0x8e, 0x5f, 0xe5, 0x79,
+    0xc7, 0x82, 0x13, 0xef, 0x40, 0x5d, 0x88, 0x60, 0xff, 0x41, 0x2c, 0xfe,
+    0xb2, 0x4b, 0xc3, 0xda, 0x26, 0xb8, 0xcb, 0x94, 0xf6, 0x31, 0xa7, 0x24,
+    0x87, 0x42, 0x02, 0xb5, 0x15, 0x27, 0xb7, 0x20, 0x95, 0xc2, 0xbe, 0xd0,
+    0x80, 0xbd, 0xfe, 0xac, 0x7c, 0x5f, 0x33, 0x81, 0x08, 0x1d, 0xbd, 0xba,
+    0xaa, 0xe0, 0x4b, 0xe3, 0x1a, 0x43, 0xf8, 0x7e, 0x4d, 0x6b, 0xc8, 0x25,
+    0x7e, 0xfb, 0x1f, 0x46, 0x2a, 0x2b, 0x9c, 0x88, 0x7e, 0x97, 0x0b, 0x19,
+    0xe6, 0x0f, 0x81, 0x6a, 0x40, 0x83, 0x05, 0xf2, 0xa4, 0x7b, 0x4c, 0xa2,
+    0x86, 0x0f, 0x35, 0x02, 0x87, 0x10, 0x5c, 0xba, 0x56, 0x68, 0x1c, 0x8e,
+    0xd6, 0xef, 0xb2, 0x73, 0x0a, 0x45, 0xee, 0x63, 0xc2, 0xd9, 0x39, 0xc5,
+};
+
+static uint64_t rotate_left(uint64_t value, byte bits);
+static uint64_t read64(const byte* ptr);
+static uint32_t read32(const byte* ptr);
+static uint64_t round64(uint64_t acc, uint64_t input);
+static uint64_t merge_round(uint64_t acc, uint64_t value);
+
+static void accumulate_stripe(uint64_t* acc, const byte* data, const byte* key);
+static void scramble_lanes(uint64_t* acc, const byte* key);
+
+uint64_t hash64(const void* data, usize size, uint64_t seed) {
+    const byte* ptr = data;
+    const byte* end = ptr + size;
+    uint64_t hash;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do {
+            v1 = round64(v1, read64(ptr));
+            v2 = round64(v2, read64(ptr + 8));
+            v3 = round64(v3, read64(ptr + 16));
+            v4 = round64(v4, read64(ptr + 24));
+            ptr += 32;
+        } while (ptr + 32 <= end);
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    } else {
+        hash = seed + PRIME64_5;
+    }
+    hash += size;
+
+    while (ptr + 8 <= end) {
+        hash ^= round64(0, read64(ptr));
+        hash = rotate_left(hash, 27) * PRIME64_1 + PRIME64_4;
+        ptr += 8;
+    }
+    if (ptr + 4 <= end) {
+        hash ^= (uint64_t)read32(ptr) * PRIME64_1;
+        hash = rotate_left(hash, 23) * PRIME64_2 + PRIME64_3;
+        ptr += 4;
+    }
+    while (ptr < end) {
+        hash ^= *ptr++ * PRIME64_5;
+        hash = rotate_left(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t hash64_wide(const void* data, usize size, uint64_t seed) {
+    if (size < STRIPE_SIZE) {
+        return hash64(data, size, seed);
+    }
+    const byte* ptr = data;
+    const byte* key = WIDE_KEY;
+    uint64_t acc[STRIPE_LANES] = {
+        PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME64_5, PRIME64_1 ^ seed, PRIME64_2 + seed,
+    };
+
+    const usize stripes = (size - 1) / STRIPE_SIZE;
+    usize stripe = 0;
+    for (; stripe + STRIPES_PER_BLOCK <= stripes; stripe += STRIPES_PER_BLOCK) {
+        for (usize i = 0; i < STRIPES_PER_BLOCK; i++) {
+            accumulate_stripe(acc, ptr + (stripe + i) * STRIPE_SIZE, key + i * 8);
+        }
+        scramble_lanes(acc, key + KEY_SIZE - STRIPE_SIZE);
+    }
+    for (usize i = 0; stripe + i < stripes; i++) {
+        accumulate_stripe(acc, ptr + (stripe + i) * STRIPE_SIZE, key + i * 8);
+    }
+    // The last stripe always ends on the final byte, overlapping the one before it if needed
+    accumulate_stripe(acc, ptr + size - STRIPE_SIZE, key + KEY_SIZE - STRIPE_SIZE - 7);
+
+    uint64_t hash = seed + size * PRIME64_1;
+    for (usize i = 0; i < STRIPE_LANES; i++) {
+        hash = merge_round(hash, acc[i] ^ read64(key + 8 * i + 11));
+    }
+    hash ^= hash >> 37;
+    hash *= 0x165667919E3779F9ULL;
+    return hash ^ (hash >> 32);
+}
+
+#if defined(__SSE2__)
+static void accumulate_stripe(uint64_t* acc, const byte* data, const byte* key) {
+    __m128i* lanes = (__m128i*)acc;
+    for (usize i = 0; i < STRIPE_LANES / 2; i++) {
+        const __m128i value = _mm_loadu_si128((const __m128i*)data + i);
+        const __m128i mixed = _mm_xor_si128(value, _mm_loadu_si128((const __m128i*)key + i));
+        const __m128i product = _mm_mul_epu32(mixed, _mm_shuffle_epi32(mixed, _MM_SHUFFLE(0, 3, 0, 1)));
+        const __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+        __m128i lane = _mm_loadu_si128(lanes + i);
+        lane = _mm_add_epi64(lane, _mm_add_epi64(product, swapped));
+        _mm_storeu_si128(lanes + i, lane);
+    }
+}
+
+static void scramble_lanes(uint64_t* acc, const byte* key) {
+    __m128i* lanes = (__m128i*)acc;
+    const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+    for (usize i = 0; i < STRIPE_LANES / 2; i++) {
+        __m128i lane = _mm_loadu_si128(lanes + i);
+        lane = _mm_xor_si128(lane, _mm_srli_epi64(lane, 47));
+        lane = _mm_xor_si128(lane, _mm_loadu_si128((const __m128i*)key + i));
+        const __m128i lo = _mm_mul_epu32(lane, prime);
+        const __m128i hi = _mm_mul_epu32(_mm_srli_epi64(lane, 32), prime);
+        _mm_storeu_si128(lanes + i, _mm_add_epi64(lo, _mm_slli_epi64(hi, 32)));
+    }
+}
+#else
+static void accumulate_stripe(uint64_t* acc, const byte* data, const byte* key) {
+    for (usize i = 0; i < STRIPE_LANES; i++) {
+        const uint64_t value = read64(data + 8 * i);
+        const uint64_t mixed = value ^ read64(key + 8 * i);
+        acc[i ^ 1] += value;
+        acc[i] += (mixed & 0xffffffff) * (mixed >> 32);
+    }
+}
+
+static void scramble_lanes(uint64_t* acc, const byte* key) {
+    for (usize i = 0; i < STRIPE_LANES; i++) {
+        uint64_t lane = acc[i];
+        lane ^= lane >> 47;
+        lane ^= read64(key + 8 * i);
+        acc[i] = lane * PRIME32_1;
+    }
+}
+#endif
+
+static uint64_t rotate_left(uint64_t value, byte bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const byte* ptr) {
+    uint64_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(const byte* ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotate_left(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t merge_round(uint64_t acc, uint64_t value) {
+    acc ^= round64(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
@@ -1,25 +1,236 @@
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "log.h"
 
-void LOG(enum LogLevel level, const char* fmt, ...) {
-//    if (level < LOG_LEVEL) return;
-    switch (level) {
-        case ERROR:
-            printf("[ERROR] ");
-            break;
-        case INFO:
-            printf("[INFO]  ");
-            break;
-        case DEBUG:
-            printf("[DEBUG] ");
-            break;
-        default:
-            printf("[LOG]   ");
+// One slot of the ring. A producer owns it while sequence equals its ticket, the writer
+// while sequence is one past it, after which it is handed back a lap later.
+typedef struct LogRecord {
+    atomic_size_t sequence;
+    uint64_t time;
+    uint8_t level;
+    uint16_t length;
+    char text[LOG_MESSAGE_SIZE];
+} LogRecord;
+
+typedef struct LogWriter {
+    struct LogRecord* records;
+    atomic_size_t enqueue;
+    size_t dequeue;
+    atomic_bool running;
+    atomic_bool stop;
+    pthread_t thread;
+    FILE* out;
+    LogFormat format;
+} LogWriter;
+
+static const char* LEVEL_PREFIXES[] = {
+    [DEBUG] = "[DEBUG] ",
+    [INFO]  = "[INFO]  ",
+    [ERROR] = "[ERROR] ",
+};
+
+static struct LogWriter writer;
+static atomic_uint_fast64_t suppressed_total;
+static atomic_uint_fast64_t dropped_total;
+
+static void emit(enum LogLevel level, const char* fmt, va_list ap);
+static void emit_format(enum LogLevel level, const char* fmt, ...);
+static bool push_record(enum LogLevel level, const char* fmt, va_list ap);
+static bool drain_records(void);
+static void write_record(const struct LogRecord* record);
+static void* run_writer(void* context);
+static uint64_t now_ns(void);
+
+void write_log(struct LogSite* site, enum LogLevel level, const char* fmt, ...) {
+    // The first message of each new second resets the site's budget and owns up to what was dropped
+    const uint64_t second = now_ns() / 1000000000u;
+    uint_fast64_t window = atomic_load_explicit(&site->window, memory_order_relaxed);
+    if (window != second &&
+        atomic_compare_exchange_strong_explicit(&site->window, &window, second, memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&site->count, 0, memory_order_relaxed);
+        const unsigned suppressed = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+        if (suppressed > 0) {
+            emit_format(level, "(%u similar messages suppressed)", suppressed);
+        }
+    }
+    if (atomic_fetch_add_explicit(&site->count, 1, memory_order_relaxed) >= LOG_BURST) {
+        atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&suppressed_total, 1, memory_order_relaxed);
+        return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    emit(level, fmt, ap);
+    va_end(ap);
+}
+
+bool start_log_writer(const char* path) {
+    if (atomic_load(&writer.running)) {
+        return true;
+    }
+    const char* extension = path != NULL ? strrchr(path, '.') : NULL;
+    writer.format = extension != NULL && strcmp(extension, ".bin") == 0 ? LOG_BINARY : LOG_TEXT;
+    writer.out = path != NULL ? fopen(path, writer.format == LOG_BINARY ? "wb" : "w") : stdout;
+    if (writer.out == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", path);
+        return false;
+    }
+
+    writer.records = malloc(LOG_RING_SIZE * sizeof(struct LogRecord));
+    if (writer.records == NULL) {
+        if (writer.out != stdout) {
+            fclose(writer.out);
+        }
+        return false;
+    }
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&writer.records[i].sequence, i);
+    }
+    atomic_init(&writer.enqueue, 0);
+    writer.dequeue = 0;
+    atomic_store(&writer.stop, false);
+    if (pthread_create(&writer.thread, NULL, run_writer, NULL) != 0) {
+        free(writer.records);
+        if (writer.out != stdout) {
+            fclose(writer.out);
+        }
+        return false;
+    }
+    atomic_store(&writer.running, true);
+    return true;
+}
+
+void stop_log_writer(void) {
+    if (!atomic_load(&writer.running)) {
+        return;
+    }
+    // New messages go out synchronously from here on, the writer drains what is already queued.
+    // Other threads must have stopped logging by now, the ring is freed below
+    atomic_store(&writer.running, false);
+    atomic_store(&writer.stop, true);
+    pthread_join(writer.thread, NULL);
+
+    if (writer.out != stdout) {
+        fclose(writer.out);
+    }
+    free(writer.records);
+    writer.records = NULL;
+    const uint_fast64_t suppressed = atomic_exchange(&suppressed_total, 0);
+    const uint_fast64_t dropped = atomic_exchange(&dropped_total, 0);
+    if (suppressed > 0 || dropped > 0) {
+        emit_format(INFO, "Logging suppressed %llu messages and dropped %llu on a full buffer",
+                    (unsigned long long)suppressed, (unsigned long long)dropped);
+    }
+}
+
+static void emit(enum LogLevel level, const char* fmt, va_list ap) {
+    if (atomic_load_explicit(&writer.running, memory_order_acquire)) {
+        if (!push_record(level, fmt, ap)) {
+            atomic_fetch_add_explicit(&dropped_total, 1, memory_order_relaxed);
+        }
+        return;
     }
+    // No writer: format the whole line first so it goes out in one write
+    char line[LOG_MESSAGE_SIZE + 16];
+    const int prefix = snprintf(line, sizeof(line), "%s", LEVEL_PREFIXES[level]);
+    const int length = vsnprintf(line + prefix, sizeof(line) - prefix - 1, fmt, ap);
+    size_t end = prefix + (length < 0 ? 0 : length);
+    end = end < sizeof(line) - 2 ? end : sizeof(line) - 2;
+    line[end++] = '\n';
+    fwrite(line, 1, end, stdout);
+}
+
+static void emit_format(enum LogLevel level, const char* fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    vprintf(fmt, ap);
+    emit(level, fmt, ap);
     va_end(ap);
-    printf("\n");
-}
\ No newline at end of file
+}
+
+static bool push_record(enum LogLevel level, const char* fmt, va_list ap) {
+    // Bounded multi-producer queue: claim a ticket, format straight into its slot, then publish
+    size_t ticket = atomic_load_explicit(&writer.enqueue, memory_order_relaxed);
+    struct LogRecord* record;
+    for (;;) {
+        record = &writer.records[ticket % LOG_RING_SIZE];
+        const size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        const intptr_t difference = (intptr_t)sequence - (intptr_t)ticket;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&writer.enqueue, &ticket, ticket + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false;
+        } else {
+            ticket = atomic_load_explicit(&writer.enqueue, memory_order_relaxed);
+        }
+    }
+
+    record->time = now_ns();
+    record->level = level;
+    const int length = vsnprintf(record->text, LOG_MESSAGE_SIZE, fmt, ap);
+    record->length = length < 0 ? 0 : length < LOG_MESSAGE_SIZE ? length : LOG_MESSAGE_SIZE - 1;
+    atomic_store_explicit(&record->sequence, ticket + 1, memory_order_release);
+    return true;
+}
+
+static bool drain_records(void) {
+    bool drained = false;
+    for (;;) {
+        struct LogRecord* record = &writer.records[writer.dequeue % LOG_RING_SIZE];
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) != writer.dequeue + 1) {
+            break;
+        }
+        write_record(record);
+        atomic_store_explicit(&record->sequence, writer.dequeue + LOG_RING_SIZE, memory_order_release);
+        writer.dequeue++;
+        drained = true;
+    }
+    if (drained) {
+        fflush(writer.out);
+    }
+    return drained;
+}
+
+static void write_record(const struct LogRecord* record) {
+    if (writer.format == LOG_BINARY) {
+        const struct LogEntryHeader header = { record->time, record->level, 0, record->length };
+        fwrite(&header, sizeof(header), 1, writer.out);
+        fwrite(record->text, 1, record->length, writer.out);
+    } else {
+        fputs(LEVEL_PREFIXES[record->level], writer.out);
+        fwrite(record->text, 1, record->length, writer.out);
+        fputc('\n', writer.out);
+    }
+}
+
+static void* run_writer(void* context) {
+    // Producers never block or signal, so the writer polls; a millisecond keeps it off the CPU
+    const struct timespec interval = { 0, 1000000 };
+    while (!atomic_load(&writer.stop)) {
+        if (!drain_records()) {
+            nanosleep(&interval, NULL);
+        }
+    }
+    // Records claimed before the stop flag are published shortly after, give them a moment
+    for (int i = 0; i < 10; i++) {
+        drain_records();
+        if (atomic_load(&writer.enqueue) == writer.dequeue) {
+            break;
+        }
+        nanosleep(&interval, NULL);
+    }
+    return context;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
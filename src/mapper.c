@@ -1,108 +1,125 @@
 #include <stdlib.h>
 #include <string.h>
-#include <SDL2/SDL_rwops.h>
 
 #include "mapper.h"
 #include "log.h"
 
-#define NES_MAGIC "NES\x1A"
-
-typedef struct INESHeader {
-    byte nes_id[4];
-    byte prg_banks;
-    byte chr_banks;
-    byte flags6;
-    byte flags7;
-    byte prg_ram_size;
-    byte flags9;
-    byte flags10;
-    byte unused[5];
-} INESHeader;
-
-static byte* read_rom_data(SDL_RWops* file, usize bytes);
-static void select_mapper(struct Mapper* mapper);
+static RomError select_mapper(struct Mapper* mapper);
 
 static byte read_prg(const struct Mapper* mapper, word address);
 static byte read_chr(const struct Mapper* mapper, word address);
 static void write_prg(struct Mapper* mapper, word address, byte value);
 static void write_chr(struct Mapper* mapper, word address, byte value);
-static void scanline_irq(struct Mapper* mapper);
-
-void load_mapper(const char* filename, struct Mapper* mapper) {
-    SDL_RWops* file = SDL_RWFromFile(filename, "rb");
-    if (file == NULL) {
-        LOG(ERROR, "File '%s' is not found.", filename);
-        exit(EXIT_FAILURE);
-    }
+static word prg_bank(const struct Mapper* mapper, word address);
+static void restore(struct Mapper* mapper);
+static void sync(struct Mapper* mapper);
+static uint64_t next_event(const struct Mapper* mapper);
 
-    INESHeader header;
+RomError load_mapper(struct RomImage* rom, struct Mapper* mapper) {
+    const struct RomInfo* info = &rom->info;
     memset(mapper, 0, sizeof(struct Mapper));
-    SDL_RWread(file, &header, sizeof(INESHeader), 1);
 
-    if (strncmp((char*)header.nes_id, NES_MAGIC, 4) != 0) {
-        LOG(ERROR, "Invalid iNES file format.");
-        exit(EXIT_FAILURE);
-    }
-
-    mapper->prg_banks = header.prg_banks;
-    mapper->chr_banks = header.chr_banks;
+    mapper->prg_banks = info->prg_rom_size / 0x4000;
+    mapper->chr_banks = info->chr_rom_size / 0x2000;
     LOG(INFO, "PRG banks (16KB): %u", mapper->prg_banks);
     LOG(INFO, "CHR banks  (8KB): %u", mapper->chr_banks);
 
-    mapper->mirroring = (header.flags6 & 0x08) ?: (header.flags6 & 0x01);
-    mapper->mapper_id = (header.flags7 & 0xf0) | ((header.flags6 & 0xf0) >> 4);
-
-    mapper->prg_rom = read_rom_data(file, 0x4000 * mapper->prg_banks);
-    mapper->chr_rom = read_rom_data(file, 0x2000 * mapper->chr_banks);
-
-    SDL_RWclose(file);
+    if (info->four_screen) {
+        mapper->state.mirroring = FOUR_SCREEN;
+    } else {
+        mapper->state.mirroring = info->vertical_mirroring ? VERTICAL : HORIZONTAL;
+    }
+    mapper->mapper_id = info->mapper_id;
+    mapper->submapper = info->submapper;
+
+    mapper->rom = retain_rom_image(rom);
+    mapper->clamp = info->prg_rom_size - 1;
+    mapper->prg_rom = rom->data + info->prg_offset;
+    if (info->chr_rom_size) {
+        mapper->chr_rom = rom->data + info->chr_offset;
+        mapper->chr_size = info->chr_rom_size;
+    } else {
+        // Headers that leave the CHR-RAM size out get the usual 8KB
+        const usize chr_ram = info->chr_ram_size + info->chr_nvram_size;
+        mapper->chr_size = PAGE_SIZE;
+        while (mapper->chr_size < (chr_ram ? chr_ram : CHR_RAM_SIZE)) {
+            mapper->chr_size <<= 1;
+        }
+    }
+    // Banks are 1KB at the finest, and CHR-RAM is paged like any other memory
+    if (mapper->chr_rom != NULL ? mapper->chr_size % 0x400 != 0 : mapper->chr_size > CHR_RAM_SIZE) {
+        LOG(ERROR, "Cannot map %u bytes of CHR memory", mapper->chr_size);
+        free_mapper(mapper);
+        return ROM_UNSUPPORTED_SIZE;
+    }
+    if (mapper->chr_rom == NULL) {
+        init_page_table(&mapper->chr_ram, mapper->chr_size);
+    }
 
-    select_mapper(mapper);
+    const RomError error = select_mapper(mapper);
+    if (error != ROM_OK) {
+        free_mapper(mapper);
+    }
+    return error;
 }
 
 void free_mapper(struct Mapper* mapper) {
-    if (mapper->prg_rom != NULL) {
-        free(mapper->prg_rom);
-    }
-    if (mapper->chr_rom != NULL) {
-        free(mapper->chr_rom);
-    }
+    release_rom_image(mapper->rom);
+    free_page_table(&mapper->chr_ram);
+    mapper->rom = NULL;
+    mapper->prg_rom = NULL;
+    mapper->chr_rom = NULL;
     LOG(DEBUG, "Mapper cleanup complete");
 }
 
-static byte* read_rom_data(SDL_RWops* file, usize bytes) {
-    if (!bytes) {
-        return NULL;
-    } else {
-        byte* ptr = malloc(bytes);
-        SDL_RWread(file, ptr, bytes, 1);
-        return ptr;
+// The mappers select_mapper can load, for callers that only have a header
+bool is_mapper_supported(word mapper_id) {
+    switch (mapper_id) {
+        case NROM:
+        case MMC3:
+            return true;
+        default:
+            return false;
     }
 }
 
-static void select_mapper(Mapper* mapper) {
+static RomError select_mapper(Mapper* mapper) {
     mapper->read_prg     = read_prg;
     mapper->read_chr     = read_chr;
     mapper->write_prg    = write_prg;
     mapper->write_chr    = write_chr;
-    mapper->scanline_irq = scanline_irq;
+    mapper->prg_bank     = prg_bank;
+    mapper->restore      = restore;
+    mapper->sync         = sync;
+    mapper->next_event   = next_event;
 
     switch (mapper->mapper_id) {
         case NROM:
             // Do nothing. Uses default methods
             break;
+        case MMC3:
+            if (!load_MMC3(mapper)) {
+                return ROM_UNSUPPORTED_SIZE;
+            }
+            break;
         default:
             LOG(ERROR, "Mapper %u not implemented", mapper->mapper_id);
-            exit(EXIT_FAILURE);
+            return ROM_UNSUPPORTED_MAPPER;
     }
+    mapper->restore(mapper);
+    return ROM_OK;
 }
 
 static byte read_prg(const struct Mapper* mapper, word address) {
-    return mapper->prg_rom[address & 0x7fff];
+    return mapper->prg_rom[address & mapper->clamp];
 }
 
 static byte read_chr(const struct Mapper* mapper, word address) {
-    return mapper->chr_rom[address];
+    const usize offset = mapper->chr_offsets[address >> 10] | (address & 0x3ff);
+    if (mapper->chr_rom == NULL) {
+        return read_page_table(&mapper->chr_ram, offset & (mapper->chr_size - 1));
+    }
+    return mapper->chr_rom[offset];
 }
 
 static void write_prg(struct Mapper* mapper, word address, byte value) {
@@ -110,9 +127,32 @@ static void write_prg(struct Mapper* mapper, word address, byte value) {
 }
 
 static void write_chr(struct Mapper* mapper, word address, byte value) {
-    LOG(DEBUG, "Attempted to write to CHR-ROM");
+    if (mapper->chr_rom != NULL) {
+        LOG(DEBUG, "Attempted to write to CHR-ROM");
+        return;
+    }
+    const usize offset = mapper->chr_offsets[address >> 10] | (address & 0x3ff);
+    write_page_table(&mapper->chr_ram, offset & (mapper->chr_size - 1), value);
+}
+
+static word prg_bank(const struct Mapper* mapper, word address) {
+    // Index of the 16KB PRG-ROM bank the address currently reads from
+    return (address & mapper->clamp) >> 14;
+}
+
+static void restore(struct Mapper* mapper) {
+    // Without banking the CHR offsets are fixed, mirroring CHR-ROM smaller than 8KB
+    for (usize i = 0; i < 8; i++) {
+        mapper->chr_offsets[i] = (i << 10) % mapper->chr_size;
+    }
+}
+
+static void sync(struct Mapper* mapper) {
+    // No IRQ to keep up to date by default
+    (void)mapper;
 }
 
-static void scanline_irq(struct Mapper* mapper) {
-    // Do nothing. This is to be implemented by other mappers.
+static uint64_t next_event(const struct Mapper* mapper) {
+    (void)mapper;
+    return UINT64_MAX;
 }
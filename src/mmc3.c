@@ -0,0 +1,251 @@
+#include "mapper.h"
+#include "emulator.h"
+#include "log.h"
+
+#define BANK_SELECT 8
+
+#define FRAME_DOTS      (SCANLINE_CYCLE_LENGTH * (SCANLINE_FRAME_END + 1))
+#define EDGES_PER_FRAME (VISIBLE_SCANLINES + 1)
+
+// Dots at which PPU A12 rises once per rendered line, depending on which pattern table is fetched from when
+#define EDGE_SPRITES    260
+#define EDGE_BACKGROUND 324
+
+static byte read_prg(const struct Mapper* mapper, word address);
+static byte read_chr(const struct Mapper* mapper, word address);
+static void write_prg(struct Mapper* mapper, word address, byte value);
+static void write_chr(struct Mapper* mapper, word address, byte value);
+static word prg_bank(const struct Mapper* mapper, word address);
+static void restore(struct Mapper* mapper);
+static void sync(struct Mapper* mapper);
+static uint64_t next_event(const struct Mapper* mapper);
+
+static word edge_dot(const struct PPU* ppu);
+static uint32_t position_at(const struct PPU* ppu, uint64_t elapsed);
+static uint64_t edges_until(word edge, uint32_t position);
+static uint64_t count_edges(word edge, uint32_t from, uint64_t dots);
+static uint64_t dots_to_edge(word edge, uint32_t from, uint64_t n);
+static void clock_counter(struct Mapper* mapper, uint64_t edges);
+
+bool load_MMC3(struct Mapper* mapper) {
+    // PRG is switched in 8KB banks, so it has to hold at least one and be cut into whole ones
+    const usize prg_size = mapper->rom->info.prg_rom_size;
+    if (prg_size == 0 || prg_size % 0x2000 != 0) {
+        LOG(ERROR, "Cannot map %u bytes of PRG-ROM in 8KB banks", prg_size);
+        return false;
+    }
+    mapper->read_prg   = read_prg;
+    mapper->read_chr   = read_chr;
+    mapper->write_prg  = write_prg;
+    mapper->write_chr  = write_chr;
+    mapper->prg_bank   = prg_bank;
+    mapper->restore    = restore;
+    mapper->sync       = sync;
+    mapper->next_event = next_event;
+    return true;
+}
+
+static byte read_prg(const struct Mapper* mapper, word address) {
+    return mapper->prg_rom[mapper->prg_offsets[(address >> 13) & 3] | (address & 0x1fff)];
+}
+
+static byte read_chr(const struct Mapper* mapper, word address) {
+    const usize offset = mapper->chr_offsets[address >> 10] | (address & 0x3ff);
+    if (mapper->chr_rom == NULL) {
+        return read_page_table(&mapper->chr_ram, offset & (mapper->chr_size - 1));
+    }
+    return mapper->chr_rom[offset];
+}
+
+static void write_prg(struct Mapper* mapper, word address, byte value) {
+    struct MapperState* state = &mapper->state;
+    struct Emulator* emulator = mapper->emulator;
+    switch (address & 0xe001) {
+        case 0x8000:
+            state->registers[BANK_SELECT] = value;
+            restore(mapper);
+            map_ppu_pages(&emulator->ppu_bus);
+            return;
+        case 0x8001:
+            state->registers[state->registers[BANK_SELECT] & 7] = value;
+            restore(mapper);
+            map_ppu_pages(&emulator->ppu_bus);
+            return;
+        case 0xa000:
+            if (state->mirroring != FOUR_SCREEN) {
+                state->mirroring = (value & 1) ? HORIZONTAL : VERTICAL;
+                set_mirroring(&emulator->ppu_bus);
+            }
+            return;
+        case 0xa001:
+            // PRG-RAM protect, ignored like most emulators do for compatibility with MMC6 dumps
+            return;
+        default:
+            break;
+    }
+
+    // Everything from here on changes the IRQ counter, so it is brought up to date first
+    sync(mapper);
+    switch (address & 0xe001) {
+        case 0xc000:
+            state->irq_latch = value;
+            break;
+        case 0xc001:
+            state->irq_counter = 0;
+            state->irq_reload = true;
+            break;
+        case 0xe000:
+            state->irq_enabled = false;
+            set_irq_line(&emulator->cpu, IRQ_MAPPER, false);
+            break;
+        case 0xe001:
+            state->irq_enabled = true;
+            break;
+        default:
+            break;
+    }
+    schedule_events(emulator);
+}
+
+static void write_chr(struct Mapper* mapper, word address, byte value) {
+    if (mapper->chr_rom != NULL) {
+        LOG(DEBUG, "Attempted to write to CHR-ROM");
+        return;
+    }
+    const usize offset = mapper->chr_offsets[address >> 10] | (address & 0x3ff);
+    write_page_table(&mapper->chr_ram, offset & (mapper->chr_size - 1), value);
+}
+
+static word prg_bank(const struct Mapper* mapper, word address) {
+    return (word)(mapper->prg_offsets[(address >> 13) & 3] >> 14);
+}
+
+static void restore(struct Mapper* mapper) {
+    const byte* registers = mapper->state.registers;
+    const byte select = registers[BANK_SELECT];
+
+    // Bank numbers wrap to the size of the ROM, both of which are powers of two on real boards
+    const usize prg_count = mapper->rom->info.prg_rom_size / 0x2000;
+    const usize prg_mask = prg_count - 1;
+    const usize fixed = (prg_count - 2) & prg_mask;
+    mapper->prg_offsets[0] = ((select & 0x40) ? fixed : (registers[6] & prg_mask)) << 13;
+    mapper->prg_offsets[1] = (registers[7] & prg_mask) << 13;
+    mapper->prg_offsets[2] = ((select & 0x40) ? (registers[6] & prg_mask) : fixed) << 13;
+    mapper->prg_offsets[3] = (prg_count - 1) << 13;
+
+    // Two 2KB banks and four 1KB banks, with the halves swapped by bit 7. CHR memory of any size
+    // wraps the same way, small CHR-RAM being masked further when it is accessed.
+    const usize chr_count = mapper->chr_size > 0x400 ? mapper->chr_size / 0x400 : 1;
+    const usize swap = (select & 0x80) ? 4 : 0;
+    mapper->chr_offsets[0 ^ swap] = ((registers[0] & 0xfe) % chr_count) << 10;
+    mapper->chr_offsets[1 ^ swap] = ((registers[0] | 1) % chr_count) << 10;
+    mapper->chr_offsets[2 ^ swap] = ((registers[1] & 0xfe) % chr_count) << 10;
+    mapper->chr_offsets[3 ^ swap] = ((registers[1] | 1) % chr_count) << 10;
+    for (usize i = 0; i < 4; i++) {
+        mapper->chr_offsets[(4 + i) ^ swap] = (registers[2 + i] % chr_count) << 10;
+    }
+}
+
+static void sync(struct Mapper* mapper) {
+    struct Emulator* emulator = mapper->emulator;
+    const uint64_t now = emulator->cpu.cycles;
+    const uint64_t elapsed = now - mapper->state.irq_cycle;
+    mapper->state.irq_cycle = now;
+
+    // PPUCTRL and PPUMASK writes sync before they land, so the edge position held for the whole interval
+    const word edge = edge_dot(&emulator->ppu);
+    if (elapsed == 0 || edge == 0) {
+        return;
+    }
+    const uint64_t dots = elapsed * 3;
+    clock_counter(mapper, count_edges(edge, position_at(&emulator->ppu, dots), dots));
+}
+
+static uint64_t next_event(const struct Mapper* mapper) {
+    const struct MapperState* state = &mapper->state;
+    const struct Emulator* emulator = mapper->emulator;
+    const word edge = edge_dot(&emulator->ppu);
+    if (!state->irq_enabled || edge == 0 || (emulator->cpu.irq_line & IRQ_MAPPER)) {
+        return UINT64_MAX;
+    }
+
+    // Edges until the counter next reaches zero, counted from where it was last synced
+    uint64_t edges = state->irq_counter;
+    if (state->irq_counter == 0 || state->irq_reload) {
+        edges = state->irq_latch ? state->irq_latch + 1u : 1u;
+    }
+    const uint32_t from = position_at(&emulator->ppu, (emulator->cpu.cycles - state->irq_cycle) * 3);
+    return state->irq_cycle + (dots_to_edge(edge, from, edges) + 2) / 3;
+}
+
+static word edge_dot(const struct PPU* ppu) {
+    // A12 rises when fetches move from the $0000 pattern table to $1000 after a long enough low stretch:
+    // sprite fetches at dot 257 with sprites in $1000, or next-line tile fetches at dot 321 with the
+    // background there. Tall sprites are assumed to come from $1000, as nearly every MMC3 game has them.
+    if (!ppu->mask.show_background && !ppu->mask.show_sprites) {
+        return 0;
+    }
+    if (ppu->ctrl.sprite_size || (ppu->ctrl.pattern_sprite && !ppu->ctrl.pattern_background)) {
+        return EDGE_SPRITES;
+    }
+    if (!ppu->ctrl.pattern_sprite && ppu->ctrl.pattern_background) {
+        return EDGE_BACKGROUND;
+    }
+    return 0;
+}
+
+static uint32_t position_at(const struct PPU* ppu, uint64_t elapsed) {
+    // The PPU runs exactly three dots per CPU cycle, so earlier positions are found by stepping back
+    const uint32_t position = ppu->scanline * SCANLINE_CYCLE_LENGTH + ppu->cycle;
+    return (uint32_t)((position + FRAME_DOTS - elapsed % FRAME_DOTS) % FRAME_DOTS);
+}
+
+static uint64_t edges_until(word edge, uint32_t position) {
+    // Edges at or before a position within a frame: one per visible line and one on the pre-render line
+    if (position < edge) {
+        return 0;
+    }
+    const uint32_t lines = (position - edge) / SCANLINE_CYCLE_LENGTH + 1;
+    return (lines < VISIBLE_SCANLINES ? lines : VISIBLE_SCANLINES) + (lines > SCANLINE_FRAME_END);
+}
+
+static uint64_t count_edges(word edge, uint32_t from, uint64_t dots) {
+    uint64_t count = dots / FRAME_DOTS * EDGES_PER_FRAME;
+    const uint32_t to = from + (uint32_t)(dots % FRAME_DOTS);
+    if (to < FRAME_DOTS) {
+        return count + edges_until(edge, to) - edges_until(edge, from);
+    }
+    return count + EDGES_PER_FRAME - edges_until(edge, from) + edges_until(edge, to - FRAME_DOTS);
+}
+
+static uint64_t dots_to_edge(word edge, uint32_t from, uint64_t n) {
+    const uint64_t target = edges_until(edge, from) + n - 1;
+    const uint64_t index = target % EDGES_PER_FRAME;
+    const uint64_t line = index < VISIBLE_SCANLINES ? index : SCANLINE_FRAME_END;
+    return target / EDGES_PER_FRAME * FRAME_DOTS + line * SCANLINE_CYCLE_LENGTH + edge - from;
+}
+
+static void clock_counter(struct Mapper* mapper, uint64_t edges) {
+    // Each edge reloads an empty counter or decrements it, and the IRQ fires whenever it ends up at zero
+    struct MapperState* state = &mapper->state;
+    bool zero = false;
+    while (edges > 0) {
+        if (state->irq_counter == 0 || state->irq_reload) {
+            state->irq_counter = state->irq_latch;
+            state->irq_reload = false;
+            edges--;
+            if (state->irq_counter == 0) {
+                zero = true;
+                break;
+            }
+            continue;
+        }
+        const uint64_t step = edges < state->irq_counter ? edges : state->irq_counter;
+        state->irq_counter -= (byte)step;
+        edges -= step;
+        zero |= state->irq_counter == 0;
+    }
+    if (zero && state->irq_enabled) {
+        set_irq_line(&mapper->emulator->cpu, IRQ_MAPPER, true);
+    }
+}
@@ -0,0 +1,361 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "emulator.h"
+#include "state.h"
+#include "hash.h"
+#include "log.h"
+
+#define MOVIE_RUN_MAX 0xffff
+
+static bool reserve_frames(struct Movie* movie, usize frames);
+static usize check_count(usize frames, usize interval);
+static struct MovieCheck take_check(const struct Emulator* emulator);
+static void print_check_diff(const struct MovieCheck* expected, const struct MovieCheck* actual, FILE* out);
+
+static byte* write_header(byte* out, const struct MovieHeader* header);
+static void read_header(const byte* in, struct MovieHeader* header);
+static byte* write_check(byte* out, const struct MovieCheck* check);
+static const byte* read_check(const byte* in, struct MovieCheck* check);
+static byte* put_field(byte* out, uint64_t value, usize size);
+static uint64_t get_field(const byte** in, usize size);
+
+void init_movie(struct Movie* movie) {
+    memset(movie, 0, sizeof(struct Movie));
+    movie->check_interval = MOVIE_CHECK_INTERVAL;
+}
+
+void free_movie(struct Movie* movie) {
+    free(movie->initial_state);
+    free(movie->inputs);
+    free(movie->checks);
+    init_movie(movie);
+}
+
+bool save_movie(const struct Movie* movie, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", path);
+        return false;
+    }
+
+    // Inputs are written as runs of unchanged frames, followed by the sparse checks
+    const usize checks = movie->checks != NULL ? check_count(movie->frames, movie->check_interval) : 0;
+    const usize body = (movie->frames ? movie->frames : 1) * MOVIE_RUN_SIZE + checks * MOVIE_CHECK_SIZE;
+    byte* buffer = malloc(MOVIE_HEADER_SIZE + body);
+    if (buffer == NULL) {
+        LOG(ERROR, "Could not allocate %u bytes to write movie '%s'", MOVIE_HEADER_SIZE + body, path);
+        fclose(file);
+        return false;
+    }
+    byte* runs = buffer + MOVIE_HEADER_SIZE;
+    byte* ptr = runs;
+    usize run_count = 0;
+    for (usize i = 0; i < movie->frames;) {
+        const word input = movie->inputs[i];
+        usize length = 1;
+        while (i + length < movie->frames && movie->inputs[i + length] == input && length < MOVIE_RUN_MAX) {
+            length++;
+        }
+        ptr = put_field(ptr, input & 0xff, 1);
+        ptr = put_field(ptr, input >> 8, 1);
+        ptr = put_field(ptr, length, 2);
+        run_count++;
+        i += length;
+    }
+    for (usize i = 0; i < checks; i++) {
+        ptr = write_check(ptr, &movie->checks[i]);
+    }
+
+    const struct MovieHeader header = {
+        .magic          = MOVIE_MAGIC,
+        .version        = MOVIE_VERSION,
+        .flags          = checks ? MOVIE_CHECKS : 0,
+        .rom_hash       = movie->rom_hash,
+        .frames         = movie->frames,
+        .runs           = run_count,
+        .state_size     = movie->initial_state_size,
+        .check_interval = movie->check_interval,
+    };
+    write_header(buffer, &header);
+    const usize size = (usize)(ptr - buffer);
+    bool written = fwrite(buffer, 1, MOVIE_HEADER_SIZE, file) == MOVIE_HEADER_SIZE;
+    written = written && fwrite(movie->initial_state, 1, header.state_size, file) == header.state_size;
+    written = written && fwrite(runs, 1, size - MOVIE_HEADER_SIZE, file) == size - MOVIE_HEADER_SIZE;
+    free(buffer);
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        LOG(ERROR, "Could not write movie '%s'", path);
+    }
+    return written;
+}
+
+bool load_movie(struct Movie* movie, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG(ERROR, "File '%s' is not found.", path);
+        return false;
+    }
+
+    init_movie(movie);
+    byte raw[MOVIE_HEADER_SIZE];
+    struct MovieHeader header;
+    const bool read = fread(raw, 1, MOVIE_HEADER_SIZE, file) == MOVIE_HEADER_SIZE;
+    read_header(raw, &header);
+    if (!read || header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION) {
+        LOG(ERROR, "'%s' is not a movie this build can play", path);
+        fclose(file);
+        return false;
+    }
+    if (header.check_interval == 0 || header.runs > header.frames) {
+        LOG(ERROR, "Movie '%s' is truncated or corrupt", path);
+        fclose(file);
+        return false;
+    }
+
+    movie->rom_hash = header.rom_hash;
+    movie->initial_state_size = header.state_size;
+    movie->check_interval = header.check_interval;
+    movie->initial_state = malloc(header.state_size ? header.state_size : 1);
+    const usize checks = (header.flags & MOVIE_CHECKS) ? check_count(header.frames, header.check_interval) : 0;
+    const size_t body = (size_t)header.runs * MOVIE_RUN_SIZE + (size_t)checks * MOVIE_CHECK_SIZE;
+    byte* buffer = malloc(body ? body : 1);
+    bool loaded = movie->initial_state != NULL && buffer != NULL && reserve_frames(movie, header.frames);
+    loaded = loaded && fread(movie->initial_state, 1, header.state_size, file) == header.state_size;
+    loaded = loaded && fread(buffer, 1, body, file) == body;
+
+    const byte* ptr = buffer;
+    for (usize i = 0; loaded && i < header.runs; i++) {
+        const word input = (word)get_field(&ptr, 1);
+        const word pads = input | (word)get_field(&ptr, 1) << 8;
+        const usize length = get_field(&ptr, 2);
+        if (movie->frames + length > header.frames) {
+            loaded = false;
+            break;
+        }
+        for (usize j = 0; j < length; j++) {
+            movie->inputs[movie->frames++] = pads;
+        }
+    }
+    loaded = loaded && movie->frames == header.frames;
+    for (usize i = 0; loaded && i < checks; i++) {
+        ptr = read_check(ptr, &movie->checks[i]);
+    }
+    if (!checks) {
+        free(movie->checks);
+        movie->checks = NULL;
+    }
+    free(buffer);
+    fclose(file);
+    if (!loaded) {
+        LOG(ERROR, "Movie '%s' is truncated or corrupt", path);
+        free_movie(movie);
+    }
+    return loaded;
+}
+
+bool start_recording(struct Movie* movie, const struct Emulator* emulator) {
+    free_movie(movie);
+    const struct RomImage* rom = emulator->mapper.rom;
+    movie->rom_hash = hash64(rom->data, rom->size, 0);
+    movie->initial_state_size = get_state_size(emulator);
+    movie->initial_state = malloc(movie->initial_state_size);
+    if (movie->initial_state == NULL) {
+        return false;
+    }
+    save_state(emulator, movie->initial_state, movie->initial_state_size);
+    return reserve_frames(movie, 60 * 60);
+}
+
+bool record_frame(struct Movie* movie, const struct Emulator* emulator) {
+    if (movie->frames == movie->capacity && !reserve_frames(movie, movie->capacity * 2)) {
+        LOG(ERROR, "Could not grow the movie past %u frames", movie->frames);
+        return false;
+    }
+    const struct CPUBus* bus = &emulator->cpu_bus;
+    movie->inputs[movie->frames] = bus->pad1.status | bus->pad2.status << 8;
+    if (movie->frames % movie->check_interval == 0) {
+        movie->checks[movie->frames / movie->check_interval] = take_check(emulator);
+    }
+    movie->frames++;
+    return true;
+}
+
+bool start_playback(struct Movie* movie, struct Emulator* emulator) {
+    const struct RomImage* rom = emulator->mapper.rom;
+    if (hash64(rom->data, rom->size, 0) != movie->rom_hash) {
+        LOG(ERROR, "Movie was recorded against a different ROM");
+        return false;
+    }
+    return load_state(emulator, movie->initial_state, movie->initial_state_size);
+}
+
+void apply_movie_input(const struct Movie* movie, usize frame, struct Emulator* emulator) {
+    const word input = movie->inputs[frame];
+    set_controller(&emulator->cpu_bus.pad1, input & 0xff);
+    set_controller(&emulator->cpu_bus.pad2, input >> 8);
+}
+
+bool verify_frame(const struct Movie* movie, usize frame, const struct Emulator* emulator, FILE* out) {
+    if (movie->checks == NULL || frame % movie->check_interval != 0) {
+        return true;
+    }
+    const struct MovieCheck* expected = &movie->checks[frame / movie->check_interval];
+    if (hash_state(emulator) == expected->hash) {
+        return true;
+    }
+    const struct MovieCheck actual = take_check(emulator);
+    const usize matched = frame >= movie->check_interval ? frame - movie->check_interval : 0;
+    fprintf(out, "Playback diverged by frame %u, after matching on frame %u (state hash %016llx, expected %016llx)\n",
+            frame, matched, (unsigned long long)actual.hash, (unsigned long long)expected->hash);
+    print_check_diff(expected, &actual, out);
+    return false;
+}
+
+static bool reserve_frames(struct Movie* movie, usize frames) {
+    if (frames <= movie->capacity) {
+        return true;
+    }
+    word* inputs = realloc(movie->inputs, frames * sizeof(word));
+    if (inputs == NULL) {
+        return false;
+    }
+    movie->inputs = inputs;
+    const usize checks = check_count(frames, movie->check_interval);
+    struct MovieCheck* resized = realloc(movie->checks, (checks ? checks : 1) * sizeof(struct MovieCheck));
+    if (resized == NULL) {
+        return false;
+    }
+    movie->checks = resized;
+    movie->capacity = frames;
+    return true;
+}
+
+static usize check_count(usize frames, usize interval) {
+    return (frames + interval - 1) / interval;
+}
+
+static struct MovieCheck take_check(const struct Emulator* emulator) {
+    const struct CPU* cpu = &emulator->cpu;
+    const struct PPU* ppu = &emulator->ppu;
+    return (struct MovieCheck){
+        .hash     = hash_state(emulator),
+        .pc       = cpu->pc,
+        .a        = cpu->a,
+        .x        = cpu->x,
+        .y        = cpu->y,
+        .sp       = cpu->sp,
+        .status   = cpu->status.value,
+        .fine_x   = ppu->fine_x,
+        .ctrl     = ppu->ctrl.value,
+        .mask     = ppu->mask.value,
+        .stat     = ppu->stat.value,
+        .vram     = ppu->vram.address,
+        .temp     = ppu->temp.address,
+        .scanline = ppu->scanline,
+        .cycle    = ppu->cycle,
+    };
+}
+
+static void print_check_diff(const struct MovieCheck* expected, const struct MovieCheck* actual, FILE* out) {
+    usize differences = 0;
+    #define DIFF(field, format) \
+        differences += expected->field != actual->field; \
+        fprintf(out, "  %-8s " format "  " format "%s\n", #field, expected->field, actual->field, \
+                expected->field != actual->field ? "  <--" : "")
+    fprintf(out, "  %-8s %-8s  %s\n", "", "expected", "actual");
+    DIFF(pc, "%04x    ");
+    DIFF(a, "%02x      ");
+    DIFF(x, "%02x      ");
+    DIFF(y, "%02x      ");
+    DIFF(sp, "%02x      ");
+    DIFF(status, "%02x      ");
+    DIFF(ctrl, "%02x      ");
+    DIFF(mask, "%02x      ");
+    DIFF(stat, "%02x      ");
+    DIFF(vram, "%04x    ");
+    DIFF(temp, "%04x    ");
+    DIFF(fine_x, "%-8u");
+    DIFF(scanline, "%-8u");
+    DIFF(cycle, "%-8u");
+    #undef DIFF
+    if (differences == 0) {
+        fprintf(out, "  Registers match; the difference is in memory or mapper state\n");
+    }
+}
+
+static byte* write_header(byte* out, const struct MovieHeader* header) {
+    out = put_field(out, header->magic, 4);
+    out = put_field(out, header->version, 2);
+    out = put_field(out, header->flags, 2);
+    out = put_field(out, header->rom_hash, 8);
+    out = put_field(out, header->frames, 4);
+    out = put_field(out, header->runs, 4);
+    out = put_field(out, header->state_size, 4);
+    return put_field(out, header->check_interval, 4);
+}
+
+static void read_header(const byte* in, struct MovieHeader* header) {
+    header->magic          = (usize)get_field(&in, 4);
+    header->version        = (word)get_field(&in, 2);
+    header->flags          = (word)get_field(&in, 2);
+    header->rom_hash       = get_field(&in, 8);
+    header->frames         = (usize)get_field(&in, 4);
+    header->runs           = (usize)get_field(&in, 4);
+    header->state_size     = (usize)get_field(&in, 4);
+    header->check_interval = (usize)get_field(&in, 4);
+}
+
+static byte* write_check(byte* out, const struct MovieCheck* check) {
+    out = put_field(out, check->hash, 8);
+    out = put_field(out, check->pc, 2);
+    out = put_field(out, check->a, 1);
+    out = put_field(out, check->x, 1);
+    out = put_field(out, check->y, 1);
+    out = put_field(out, check->sp, 1);
+    out = put_field(out, check->status, 1);
+    out = put_field(out, check->fine_x, 1);
+    out = put_field(out, check->ctrl, 1);
+    out = put_field(out, check->mask, 1);
+    out = put_field(out, check->stat, 1);
+    out = put_field(out, check->vram, 2);
+    out = put_field(out, check->temp, 2);
+    out = put_field(out, check->scanline, 2);
+    return put_field(out, check->cycle, 2);
+}
+
+static const byte* read_check(const byte* in, struct MovieCheck* check) {
+    check->hash     = get_field(&in, 8);
+    check->pc       = (word)get_field(&in, 2);
+    check->a        = (byte)get_field(&in, 1);
+    check->x        = (byte)get_field(&in, 1);
+    check->y        = (byte)get_field(&in, 1);
+    check->sp       = (byte)get_field(&in, 1);
+    check->status   = (byte)get_field(&in, 1);
+    check->fine_x   = (byte)get_field(&in, 1);
+    check->ctrl     = (byte)get_field(&in, 1);
+    check->mask     = (byte)get_field(&in, 1);
+    check->stat     = (byte)get_field(&in, 1);
+    check->vram     = (word)get_field(&in, 2);
+    check->temp     = (word)get_field(&in, 2);
+    check->scanline = (word)get_field(&in, 2);
+    check->cycle    = (word)get_field(&in, 2);
+    return in;
+}
+
+static byte* put_field(byte* out, uint64_t value, usize size) {
+    for (usize i = 0; i < size; i++) {
+        out[i] = (byte)(value >> (8 * i));
+    }
+    return out + size;
+}
+
+static uint64_t get_field(const byte** in, usize size) {
+    uint64_t value = 0;
+    for (usize i = 0; i < size; i++) {
+        value |= (uint64_t)(*in)[i] << (8 * i);
+    }
+    *in += size;
+    return value;
+}
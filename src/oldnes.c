@@ -0,0 +1,123 @@
+#include <stdlib.h>
+
+#include "oldnes.h"
+#include "emulator.h"
+#include "state.h"
+#include "rewind.h"
+#include "batch.h"
+
+struct Emulator* oldnes_create(void) {
+    return calloc(1, sizeof(struct Emulator));
+}
+
+void oldnes_destroy(struct Emulator* emulator) {
+    if (emulator == NULL) {
+        return;
+    }
+    free_emulator(emulator);
+    free(emulator);
+}
+
+struct Emulator* oldnes_fork(struct Emulator* parent) {
+    return fork_emulator(parent);
+}
+
+bool oldnes_load_rom(struct Emulator* emulator, const byte* data, usize size) {
+    RomError error;
+    struct RomImage* rom = create_rom_image(data, size, &error);
+    if (rom == NULL) {
+        return false;
+    }
+    const bool loaded = oldnes_load_rom_image(emulator, rom);
+    release_rom_image(rom);
+    return loaded;
+}
+
+bool oldnes_load_rom_image(struct Emulator* emulator, struct RomImage* rom) {
+    free_emulator(emulator);
+    return init_emulator(emulator, rom);
+}
+
+void oldnes_set_input(struct Emulator* emulator, byte player, byte buttons) {
+    struct CPUBus* bus = &emulator->cpu_bus;
+    set_controller(player ? &bus->pad2 : &bus->pad1, buttons);
+}
+
+void oldnes_run_frame(struct Emulator* emulator) {
+    run_frame(emulator);
+}
+
+bool oldnes_out_of_memory(const struct Emulator* emulator) {
+    return is_out_of_memory(emulator);
+}
+
+const usize* oldnes_get_framebuffer(struct Emulator* emulator) {
+    return get_screen_buffer(&emulator->ppu);
+}
+
+void oldnes_read_ram(const struct Emulator* emulator, byte buffer[OLDNES_RAM_SIZE]) {
+    read_pages(&emulator->cpu_bus.ram, buffer);
+}
+
+struct FrameHash oldnes_hash_frame(const struct Emulator* emulator) {
+    return hash_frame(emulator);
+}
+
+usize oldnes_state_size(const struct Emulator* emulator) {
+    return get_state_size(emulator);
+}
+
+usize oldnes_save_state(const struct Emulator* emulator, byte* buffer, usize capacity) {
+    return save_state(emulator, buffer, capacity);
+}
+
+bool oldnes_load_state(struct Emulator* emulator, const byte* buffer, usize size) {
+    return load_state(emulator, buffer, size);
+}
+
+struct RewindBuffer* oldnes_create_rewind(usize budget) {
+    struct RewindBuffer* rewind = malloc(sizeof(struct RewindBuffer));
+    if (rewind != NULL && !init_rewind(rewind, budget, REWIND_KEYFRAME_INTERVAL)) {
+        free(rewind);
+        return NULL;
+    }
+    return rewind;
+}
+
+void oldnes_destroy_rewind(struct RewindBuffer* rewind) {
+    if (rewind == NULL) {
+        return;
+    }
+    free_rewind(rewind);
+    free(rewind);
+}
+
+void oldnes_capture_rewind(struct RewindBuffer* rewind, const struct Emulator* emulator) {
+    capture_rewind(rewind, emulator);
+}
+
+bool oldnes_rewind(struct RewindBuffer* rewind, struct Emulator* emulator) {
+    return rewind_emulator(rewind, emulator);
+}
+
+struct Batch* oldnes_create_batch(usize workers) {
+    struct Batch* batch = malloc(sizeof(struct Batch));
+    if (batch != NULL && !init_batch(batch, workers)) {
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+void oldnes_destroy_batch(struct Batch* batch) {
+    if (batch == NULL) {
+        return;
+    }
+    free_batch(batch);
+    free(batch);
+}
+
+void oldnes_batch_step(struct Batch* batch, struct Emulator* const* envs, usize count, const byte* actions,
+                       usize frames, void* observations, bool rgb, byte ram[][OLDNES_RAM_SIZE]) {
+    step_batch(batch, envs, count, actions, frames, observations, rgb, (byte*)ram);
+}
\ No newline at end of file
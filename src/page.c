@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "page.h"
+#include "log.h"
+
+// Fresh tables point every page here, so untouched memory costs nothing until it is written
+static struct Page ZERO_PAGE;
+
+static void release_page(struct Page* page);
+
+void init_page_table(struct PageTable* table, usize size) {
+    memset(table, 0, sizeof(struct PageTable));
+    table->count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (table->count > MAX_PAGES) {
+        LOG(ERROR, "Cannot page %u bytes of memory", size);
+        table->count = MAX_PAGES;
+    }
+    for (usize i = 0; i < table->count; i++) {
+        table->pages[i] = &ZERO_PAGE;
+    }
+}
+
+void free_page_table(struct PageTable* table) {
+    for (usize i = 0; i < table->count; i++) {
+        release_page(table->pages[i]);
+    }
+    memset(table, 0, sizeof(struct PageTable));
+}
+
+void share_page_table(struct PageTable* table, struct PageTable* parent) {
+    // Neither side may write in place any more; the first write decides who keeps the page
+    table->count = parent->count;
+    table->owned = 0;
+    table->failed = false;
+    parent->owned = 0;
+    for (usize i = 0; i < parent->count; i++) {
+        struct Page* page = parent->pages[i];
+        if (page != &ZERO_PAGE) {
+            atomic_fetch_add_explicit(&page->refs, 1, memory_order_relaxed);
+        }
+        table->pages[i] = page;
+    }
+}
+
+void clear_page_table(struct PageTable* table) {
+    for (usize i = 0; i < table->count; i++) {
+        release_page(table->pages[i]);
+        table->pages[i] = &ZERO_PAGE;
+    }
+    table->owned = 0;
+}
+
+byte* claim_page(struct PageTable* table, usize index) {
+    struct Page* page = table->pages[index];
+    if (page == &ZERO_PAGE || atomic_load_explicit(&page->refs, memory_order_acquire) != 1) {
+        struct Page* copy = malloc(sizeof(struct Page));
+        if (copy == NULL) {
+            if (!table->failed) {
+                LOG(ERROR, "Could not allocate memory page, writes to it are lost");
+            }
+            table->failed = true;
+            return NULL;
+        }
+        atomic_init(&copy->refs, 1);
+        memcpy(copy->data, page->data, PAGE_SIZE);
+        release_page(page);
+        table->pages[index] = page = copy;
+    }
+    table->owned |= 1u << index;
+    return page->data;
+}
+
+void read_pages(const struct PageTable* table, byte* buffer) {
+    for (usize i = 0; i < table->count; i++) {
+        memcpy(buffer + i * PAGE_SIZE, table->pages[i]->data, PAGE_SIZE);
+    }
+}
+
+void write_pages(struct PageTable* table, const byte* buffer) {
+    // Pages that already hold the right bytes stay shared
+    for (usize i = 0; i < table->count; i++) {
+        const byte* data = buffer + i * PAGE_SIZE;
+        if (memcmp(table->pages[i]->data, data, PAGE_SIZE) != 0) {
+            byte* page = get_writable_page(table, i);
+            if (page != NULL) {
+                memcpy(page, data, PAGE_SIZE);
+            }
+        }
+    }
+}
+
+static void release_page(struct Page* page) {
+    if (page == &ZERO_PAGE || page == NULL) {
+        return;
+    }
+    if (atomic_fetch_sub_explicit(&page->refs, 1, memory_order_acq_rel) == 1) {
+        free(page);
+    }
+}
@@ -1,7 +1,24 @@
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "ppu.h"
 #include "emulator.h"
+#include "log.h"
+
+const usize PALETTE[0x40] = {
+        0xff545454, 0xff001e74, 0xff081090, 0xff300088, 0xff440064, 0xff5c0030, 0xff540400, 0xff3c1800,
+        0xff202a00, 0xff083a00, 0xff004000, 0xff003c00, 0xff00323c, 0xff000000, 0xff000000, 0xff000000,
+        0xff989698, 0xff084cc4, 0xff3032ec, 0xff5c1ee4, 0xff8814b0, 0xffa01464, 0xff982220, 0xff783c00,
+        0xff545a00, 0xff287200, 0xff087c00, 0xff007628, 0xff006678, 0xff000000, 0xff000000, 0xff000000,
+        0xffeceeec, 0xff4c9aec, 0xff787cec, 0xffb062ec, 0xffe454ec, 0xffec58b4, 0xffec6a64, 0xffd48820,
+        0xffa0aa00, 0xff74c400, 0xff4cd020, 0xff38cc6c, 0xff38b4cc, 0xff3c3c3c, 0xff000000, 0xff000000,
+        0xffeceeec, 0xffa8ccec, 0xffbcbcec, 0xffd4b2ec, 0xffecaeec, 0xffecaed4, 0xffecb4b0, 0xffe4c490,
+        0xffccd278, 0xffb4de78, 0xffa8e290, 0xff98e2b4, 0xffa0d6e4, 0xffa0a2a0, 0xff000000, 0xff000000,
+};
+
+static bool claim_frame(struct PPU* ppu);
+static void release_frame(struct Frame* frame);
 
 static byte rendering_enabled(const struct PPU* ppu);
 static byte get_vram_increment(const struct PPU* ppu);
@@ -11,8 +28,10 @@ static void increment_scroll_y(struct PPU* ppu);
 static void transfer_address_x(struct PPU* ppu);
 static void transfer_address_y(struct PPU* ppu);
 
-static word render_background(struct PPU* ppu);
-static word render_sprites(struct PPU* ppu, word background_address, byte* restrict background_priority);
+static void evaluate_sprites(struct PPU* ppu);
+static void render_pixel(struct PPU* ppu);
+static byte render_background(struct PPU* ppu, byte fine_x);
+static byte render_sprites(struct PPU* ppu, byte x, byte background);
 static Sprite get_sprite(const byte* oam, size_t pos);
 
 void init_ppu(struct Emulator* emulator) {
@@ -20,12 +39,34 @@ void init_ppu(struct Emulator* emulator) {
     ppu->emulator = emulator;
     ppu->bus = &emulator->ppu_bus;
 
-    memset(ppu->oam, 0, OAM_SIZE);
+    init_page_table(&ppu->oam, OAM_SIZE);
+    ppu->frame = NULL;
+    ppu->screen_buffer = NULL;
+    ppu->frame_owned = false;
+    ppu->out_of_memory = false;
     ppu->vram.address = 0x0000;
     ppu->oam_address = 0;
     reset_ppu(ppu);
 }
 
+void free_ppu(struct PPU* ppu) {
+    free_page_table(&ppu->oam);
+    release_frame(ppu->frame);
+    free(ppu->screen_buffer);
+    ppu->frame = NULL;
+    ppu->screen_buffer = NULL;
+}
+
+void share_ppu_frame(struct PPU* ppu, struct PPU* parent) {
+    // Whichever side draws next takes its own copy; the RGBA screen is rebuilt on demand
+    atomic_fetch_add_explicit(&parent->frame->refs, 1, memory_order_relaxed);
+    ppu->frame = parent->frame;
+    ppu->frame_owned = parent->frame_owned = false;
+    ppu->out_of_memory = false;
+    ppu->screen_buffer = NULL;
+    ppu->screen_dirty = true;
+}
+
 void reset_ppu(struct PPU* ppu) {
     ppu->temp.address = 0x0000;
     ppu->ctrl.value  = 0x00;
@@ -36,9 +77,28 @@ void reset_ppu(struct PPU* ppu) {
     ppu->scanline = 0;
     ppu->cycle    = 0;
     ppu->first_write = true;
-    ppu->mask.show_background = true;
-    ppu->mask.show_sprites    = true;
-    memset(ppu->screen_buffer, 0, sizeof(ppu->screen_buffer));
+    if (claim_frame(ppu)) {
+        memset(ppu->frame->pixels, 0, SCREEN_SIZE);
+    }
+    ppu->screen_dirty = true;
+}
+
+const usize* get_screen_buffer(struct PPU* ppu) {
+    if (ppu->screen_buffer == NULL) {
+        ppu->screen_buffer = malloc(SCREEN_SIZE * sizeof(usize));
+        if (ppu->screen_buffer == NULL) {
+            return NULL;
+        }
+        ppu->screen_dirty = true;
+    }
+    if (ppu->screen_dirty) {
+        const byte* pixels = ppu->frame->pixels;
+        for (usize i = 0; i < SCREEN_SIZE; i++) {
+            ppu->screen_buffer[i] = PALETTE[pixels[i]];
+        }
+        ppu->screen_dirty = false;
+    }
+    return ppu->screen_buffer;
 }
 
 //void execute_ppu(struct PPU* ppu) {
@@ -133,76 +193,72 @@ void reset_ppu(struct PPU* ppu) {
 
 void execute_ppu(struct PPU* ppu) {
     struct CPU* cpu = &ppu->emulator->cpu;
-    struct Mapper* mapper = &ppu->emulator->mapper;
 
-    if (ppu->scanline > 0 && ppu->scanline <= VISIBLE_SCANLINES) {
-        if (ppu->cycle == SCANLINE_VISIBLE_DOTS + 1 && rendering_enabled(ppu)) {
-            increment_scroll_y(ppu);
+    if (ppu->scanline < VISIBLE_SCANLINES) {
+        if (ppu->cycle == 1 && !ppu->frame_owned) {
+            claim_frame(ppu);
         }
-        if (ppu->cycle == SCANLINE_VISIBLE_DOTS + 2 && rendering_enabled(ppu)) {
-            transfer_address_x(ppu);
+        if (ppu->cycle > 0 && ppu->cycle <= SCANLINE_VISIBLE_DOTS) {
+            render_pixel(ppu);
         }
-        if (ppu->cycle == SCANLINE_CYCLE_END) {
-            memset(ppu->oam_cache, 0, 8);
-            ppu->oam_cache_len = 0;
-            const byte range = ppu->ctrl.sprite_size ? 16 : 8;
-            for (ssize i = ppu->oam_address / 4; i < 64; i++) {
-                const ssize diff = (ssize)ppu->scanline - ppu->oam[i * 4];
-                if (diff >= 0 && diff < range) {
-                    ppu->oam_cache[ppu->oam_cache_len++] = i * 4;
-                    if (ppu->oam_cache_len >= 8) {
-                        break;
-                    }
-                }
+    } else if (ppu->scanline == VISIBLE_SCANLINES + 1) {
+        if (ppu->cycle == 1) {
+            ppu->stat.vertical_blank = true;
+            ppu->render = true;
+            ppu->screen_dirty = true;
+            if (ppu->ctrl.generate_nmi) {
+                interrupt_cpu(cpu, NMI);
             }
         }
-    } else if (ppu->scanline == VISIBLE_SCANLINES) {
-
-    } else if (ppu->scanline < SCANLINE_FRAME_END) {
-
-    } else {
-
-    }
-    if (ppu->cycle == 1) {
-        ppu->stat.vertical_blank = ppu->stat.sprite_overflow = 0;
-    }
-    if (ppu->cycle == SCANLINE_VISIBLE_DOTS + 1 && rendering_enabled(ppu)) {
-        increment_scroll_y(ppu);
-    }
-    if (ppu->cycle == SCANLINE_VISIBLE_DOTS + 2 && rendering_enabled(ppu)) {
-        transfer_address_x(ppu);
-    }
-    if (ppu->cycle > 280 && ppu->cycle <= 304) {
-        transfer_address_y(ppu);
-    }
-    if (ppu->cycle == 260 && rendering_enabled(ppu)) {
-        mapper->scanline_irq(mapper);
+    } else if (ppu->scanline == SCANLINE_FRAME_END) {
+        if (ppu->cycle == 1) {
+            ppu->stat.vertical_blank = ppu->stat.sprite_zero = ppu->stat.sprite_overflow = false;
+        }
+        if (ppu->cycle > 280 && ppu->cycle <= 304) {
+            transfer_address_y(ppu);
+        }
     }
-    if (ppu->cycle == 1 && ppu->scanline == VISIBLE_SCANLINES + 1) {
-        ppu->stat.vertical_blank = true;
-        if (ppu->ctrl.generate_nmi) {
-            interrupt_cpu(cpu, NMI);
+
+    // Scroll bookkeeping shared by the visible and pre-render lines
+    if (ppu->scanline < VISIBLE_SCANLINES || ppu->scanline == SCANLINE_FRAME_END) {
+        if (ppu->cycle == SCANLINE_VISIBLE_DOTS) {
+            increment_scroll_y(ppu);
+        }
+        if (ppu->cycle == SCANLINE_VISIBLE_DOTS + 1) {
+            transfer_address_x(ppu);
+        }
+        if (ppu->cycle == SCANLINE_CYCLE_END) {
+            evaluate_sprites(ppu);
         }
     }
 
     // Increment cycles and scanline
-    if (ppu->cycle >= SCANLINE_CYCLE_END) {
-        ppu->scanline++;
+    if (++ppu->cycle > SCANLINE_CYCLE_END) {
         ppu->cycle = 0;
+        if (++ppu->scanline > SCANLINE_FRAME_END) {
+            ppu->scanline = 0;
+            ppu->even_frame ^= 1;
+        }
     }
-    if (ppu->scanline >= SCANLINE_FRAME_END) {
-        ppu->scanline = 0;
-        ppu->even_frame ^= 1;
-    }
-    ppu->cycle++;
 }
 
-void dma(struct PPU* ppu, byte address) {
-    const struct CPUBus* bus = &ppu->emulator->cpu_bus;
-    const byte* ptr = get_page_ptr(bus, address);
-    memcpy(ppu->oam + ppu->oam_address, ptr, 256 - ppu->oam_address);
-    if (ppu->oam_address) {
-        memcpy(ppu->oam, ptr + (256 - ppu->oam_address), ppu->oam_address);
+void dma(struct PPU* ppu, byte page) {
+    struct CPUBus* bus = &ppu->emulator->cpu_bus;
+    const word base = (word)(page << 8);
+    const byte* ptr = get_page_ptr(bus, base);
+    byte buffer[256];
+    if (ptr == NULL) {
+        for (word i = 0; i < 256; i++) {
+            buffer[i] = read_cpu_memory(bus, base | i);
+        }
+        ptr = buffer;
+    }
+    byte* oam = get_writable_page(&ppu->oam, 0);
+    if (oam != NULL) {
+        memcpy(oam + ppu->oam_address, ptr, 256 - ppu->oam_address);
+        if (ppu->oam_address) {
+            memcpy(oam, ptr + (256 - ppu->oam_address), ppu->oam_address);
+        }
     }
     struct CPU* cpu = &ppu->emulator->cpu;
     cpu->skip_cycles += 513;
@@ -227,7 +283,7 @@ byte read_status(struct PPU* ppu) {
 }
 
 byte read_oam(struct PPU* ppu) {
-    return ppu->oam[ppu->oam_address];
+    return read_page_table(&ppu->oam, ppu->oam_address);
 }
 
 void write_ppu(struct PPU* ppu, byte value) {
@@ -251,11 +307,11 @@ void set_oam_address(struct PPU* ppu, byte address) {
 
 void set_vram_address(struct PPU* ppu, byte address) {
     if (ppu->first_write) {
-        ppu->temp.address = (ppu->temp.address & 0xff00) | address;
-        ppu->vram = ppu->temp;
+        ppu->temp.address = (word)((address & 0x3f) << 8) | (ppu->temp.address & 0x00ff);
         ppu->first_write = false;
     } else {
-        ppu->temp.address = (word)((address & 0x3f) << 8) | (ppu->temp.address & 0x00ff);
+        ppu->temp.address = (ppu->temp.address & 0xff00) | address;
+        ppu->vram = ppu->temp;
         ppu->first_write = true;
     }
 }
@@ -273,7 +329,36 @@ void set_scroll(struct PPU* ppu, byte scroll) {
 }
 
 void write_oam(struct PPU* ppu, byte value) {
-    ppu->oam[ppu->oam_address++] = value;
+    write_page_table(&ppu->oam, ppu->oam_address++, value);
+}
+
+static bool claim_frame(struct PPU* ppu) {
+    struct Frame* frame = ppu->frame;
+    if (frame == NULL || atomic_load_explicit(&frame->refs, memory_order_acquire) != 1) {
+        struct Frame* copy = malloc(sizeof(struct Frame));
+        if (copy == NULL) {
+            if (!ppu->out_of_memory) {
+                LOG(ERROR, "Could not allocate frame buffer");
+            }
+            ppu->out_of_memory = true;
+            return false;
+        }
+        atomic_init(&copy->refs, 1);
+        // Lines above the current one are kept when a fork happened mid-frame
+        if (frame != NULL && ppu->scanline > 0) {
+            memcpy(copy->pixels, frame->pixels, SCREEN_SIZE);
+        }
+        release_frame(frame);
+        ppu->frame = copy;
+    }
+    ppu->frame_owned = true;
+    return true;
+}
+
+static void release_frame(struct Frame* frame) {
+    if (frame != NULL && atomic_fetch_sub_explicit(&frame->refs, 1, memory_order_acq_rel) == 1) {
+        free(frame);
+    }
 }
 
 static byte rendering_enabled(const struct PPU* ppu) {
@@ -318,15 +403,105 @@ static void transfer_address_x(struct PPU* ppu) {
 }
 
 static void transfer_address_y(struct PPU* ppu) {
+    if (!rendering_enabled(ppu)) return;
     ppu->vram.nametable_y = ppu->temp.nametable_y;
     ppu->vram.coarse_y    = ppu->temp.coarse_y;
     ppu->vram.fine_y      = ppu->temp.fine_y;
 }
 
-static word render_background(struct PPU* ppu) {
+static void evaluate_sprites(struct PPU* ppu) {
+    // Sprites are evaluated at the end of a line for the line that follows it
+    const ssize range = ppu->ctrl.sprite_size ? 16 : 8;
+    const byte* oam = get_page(&ppu->oam, 0);
+    ppu->oam_cache_len = 0;
+    for (ssize i = 0; i < 64; i++) {
+        const ssize diff = (ssize)ppu->scanline - oam[i * 4];
+        if (diff >= 0 && diff < range) {
+            if (ppu->oam_cache_len >= OAM_CACHE_SIZE) {
+                ppu->stat.sprite_overflow = true;
+                break;
+            }
+            ppu->oam_cache[ppu->oam_cache_len++] = i * 4;
+        }
+    }
+}
 
+static void render_pixel(struct PPU* ppu) {
+    const byte x = ppu->cycle - 1;
+    byte background = 0;
+    if (ppu->mask.show_background) {
+        const byte fine_x = (ppu->fine_x + x) & 0x07;
+        if (x >= 8 || ppu->mask.show_background_left) {
+            background = render_background(ppu, fine_x);
+        }
+        if (fine_x == 7) {
+            increment_scroll_x(ppu);
+        }
+    }
+    const byte palette_address = render_sprites(ppu, x, background);
+    const byte color = read_ppu_memory(ppu->bus, 0x3f00 | palette_address) & 0x3f;
+    if (ppu->frame_owned) {
+        ppu->frame->pixels[ppu->scanline * SCANLINE_VISIBLE_DOTS + x] = color;
+    }
 }
 
-static word render_sprites(struct PPU* ppu, word background_address) {
+static byte render_background(struct PPU* ppu, byte fine_x) {
+    const word v = ppu->vram.address;
+    const byte tile = fetch_ppu_memory(ppu->bus, 0x2000 | (v & 0x0fff));
+    const word pattern = (ppu->ctrl.pattern_background << 12) | (tile << 4) | ppu->vram.fine_y;
+    const byte shift = 7 - fine_x;
+    const byte color = ((fetch_ppu_memory(ppu->bus, pattern) >> shift) & 1)
+                     | (((fetch_ppu_memory(ppu->bus, pattern + 8) >> shift) & 1) << 1);
+    if (!color) {
+        return 0;
+    }
+    const word attribute_address = 0x2000 | ATTRIBUTE_OFFSET | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07);
+    const byte attribute_shift = ((v >> 4) & 0x04) | (v & 0x02);
+    const byte attribute = fetch_ppu_memory(ppu->bus, attribute_address);
+    return (((attribute >> attribute_shift) & 0x03) << 2) | color;
+}
+
+static byte render_sprites(struct PPU* ppu, byte x, byte background) {
+    if (!ppu->mask.show_sprites || (x < 8 && !ppu->mask.show_sprites_left)) {
+        return background;
+    }
+    const byte length = ppu->ctrl.sprite_size ? 16 : 8;
+    const byte* oam = get_page(&ppu->oam, 0);
+    for (byte i = 0; i < ppu->oam_cache_len; i++) {
+        const Sprite sprite = get_sprite(oam, ppu->oam_cache[i]);
+        const ssize dx = (ssize)x - sprite.x;
+        if (dx < 0 || dx >= 8) {
+            continue;
+        }
+        byte x_shift = (sprite.attr & 0x40) ? dx : 7 - dx;
+        byte y_offset = (ppu->scanline - sprite.y - 1) % length;
+        if (sprite.attr & 0x80) {
+            y_offset ^= length - 1;
+        }
+
+        word pattern;
+        if (length == 8) {
+            pattern = (ppu->ctrl.pattern_sprite << 12) | (sprite.id << 4) | y_offset;
+        } else {
+            pattern = ((sprite.id & 1) << 12) | ((sprite.id & 0xfe) << 4) | ((y_offset & 8) << 1) | (y_offset & 7);
+        }
+        const byte color = ((fetch_ppu_memory(ppu->bus, pattern) >> x_shift) & 1)
+                         | (((fetch_ppu_memory(ppu->bus, pattern + 8) >> x_shift) & 1) << 1);
+        if (!color) {
+            continue;
+        }
+        if (ppu->oam_cache[i] == 0 && background && x != 0xff) {
+            ppu->stat.sprite_zero = true;
+        }
+        if (background && (sprite.attr & 0x20)) {
+            return background;
+        }
+        return 0x10 | ((sprite.attr & 0x03) << 2) | color;
+    }
+    return background;
+}
 
+static Sprite get_sprite(const byte* oam, size_t pos) {
+    const Sprite sprite = { oam[pos], oam[pos + 1], oam[pos + 2], oam[pos + 3] };
+    return sprite;
 }
\ No newline at end of file
@@ -2,9 +2,10 @@
 
 #include "ppu_bus.h"
 #include "emulator.h"
+#include "bus_stats.h"
 
-static void set_mirroring(struct PPUBus* bus);
-static void set_mirror_mapping(struct PPUBus* bus, word tr, word tl, word br, word bl);
+static void set_mirror_mapping(struct PPUBus* bus, word tl, word tr, word bl, word br);
+static void write_paged(struct PPUBus* bus, struct PageTable* table, usize address, byte value);
 
 static word to_palette_address(word address);
 static word to_nametable_address(const word* name_table, word address);
@@ -12,18 +13,27 @@ static word to_nametable_address(const word* name_table, word address);
 void init_ppu_bus(struct Emulator* emulator) {
     struct PPUBus* bus = &emulator->ppu_bus;
     bus->mapper = &emulator->mapper;
+#ifdef OLDNES_BUS_STATS
+    bus->stats = NULL;
+#endif
 
+    // Four-screen boards carry their own 2KB on the cartridge for the two extra nametables
+    const bool four_screen = bus->mapper->state.mirroring == FOUR_SCREEN;
+    init_page_table(&bus->vram, four_screen ? FOUR_SCREEN_VRAM_SIZE : VRAM_SIZE);
+    memset(bus->palette, 0, 0x20);
     set_mirroring(bus);
-    memset(bus->vram,    0, 0x800);
-    memset(bus->palette, 0,  0x20);
+}
+
+void free_ppu_bus(struct PPUBus* bus) {
+    free_page_table(&bus->vram);
 }
 
 byte read_ppu_memory(const struct PPUBus* bus, word address) {
-    if (address < 0x2000) {
-        return bus->mapper->read_chr(bus->mapper, address);
-    }
+#ifdef OLDNES_BUS_STATS
+    count_ppu_access(bus->stats, address, false);
+#endif
     if (address < 0x3f00) {
-        return bus->vram[to_nametable_address(bus->nametable, address)];
+        return bus->pages[address >> PAGE_SHIFT][address & PAGE_MASK];
     }
     if (address < 0x4000) {
         return bus->palette[to_palette_address(address)];
@@ -32,12 +42,20 @@ byte read_ppu_memory(const struct PPUBus* bus, word address) {
 }
 
 void write_ppu_memory(struct PPUBus* bus, word address, byte value) {
+#ifdef OLDNES_BUS_STATS
+    count_ppu_access(bus->stats, address, true);
+#endif
     if (address < 0x2000) {
-        bus->mapper->write_chr(bus->mapper, address, value);
+        struct Mapper* mapper = bus->mapper;
+        const usize owned = mapper->chr_ram.owned;
+        mapper->write_chr(mapper, address, value);
+        if (mapper->chr_ram.owned != owned) {
+            map_ppu_pages(bus);
+        }
         return;
     }
     if (address < 0x3f00) {
-        bus->vram[to_nametable_address(bus->nametable, address)] = value;
+        write_paged(bus, &bus->vram, to_nametable_address(bus->nametable, address), value);
         return;
     }
     if (address < 0x4000) {
@@ -46,8 +64,8 @@ void write_ppu_memory(struct PPUBus* bus, word address, byte value) {
     }
 }
 
-static void set_mirroring(struct PPUBus* bus) {
-    switch (bus->mapper->mirroring) {
+void set_mirroring(struct PPUBus* bus) {
+    switch (bus->mapper->state.mirroring) {
         case VERTICAL:
             set_mirror_mapping(bus, 0x000, 0x400, 0x000, 0x400);
             break;
@@ -62,19 +80,47 @@ static void set_mirroring(struct PPUBus* bus) {
             set_mirror_mapping(bus, 0x400, 0x400, 0x400, 0x400);
             break;
         case FOUR_SCREEN:
-            set_mirror_mapping(bus, 0x000, 0x000, 0x000, 0x000);
+            set_mirror_mapping(bus, 0x000, 0x400, 0x800, 0xc00);
             break;
         default:
             set_mirror_mapping(bus, 0x000, 0x000, 0x000, 0x000);
             break;
     }
+    map_ppu_pages(bus);
 }
 
-static void set_mirror_mapping(struct PPUBus* bus, word tr, word tl, word br, word bl) {
-    bus->nametable[0] = tr;
-    bus->nametable[1] = tl;
-    bus->nametable[2] = br;
-    bus->nametable[3] = bl;
+void map_ppu_pages(struct PPUBus* bus) {
+    // Pattern tables follow the mapper's 1KB CHR banks
+    const struct Mapper* mapper = bus->mapper;
+    for (usize page = 0; page < 0x2000 >> PAGE_SHIFT; page++) {
+        const usize offset = mapper->chr_offsets[page >> 2] | ((page & 3) << PAGE_SHIFT);
+        if (mapper->chr_rom == NULL) {
+            bus->pages[page] = get_page(&mapper->chr_ram, (offset & (mapper->chr_size - 1)) >> PAGE_SHIFT);
+        } else {
+            bus->pages[page] = mapper->chr_rom + offset;
+        }
+    }
+    // Nametables, mirrored once more from $3000 up to the palette
+    for (usize page = 0x2000 >> PAGE_SHIFT; page < PPU_PAGES; page++) {
+        const word address = to_nametable_address(bus->nametable, (word)(page << PAGE_SHIFT));
+        bus->pages[page] = get_page(&bus->vram, address >> PAGE_SHIFT);
+    }
+}
+
+static void set_mirror_mapping(struct PPUBus* bus, word tl, word tr, word bl, word br) {
+    bus->nametable[0] = tl;
+    bus->nametable[1] = tr;
+    bus->nametable[2] = bl;
+    bus->nametable[3] = br;
+}
+
+static void write_paged(struct PPUBus* bus, struct PageTable* table, usize address, byte value) {
+    // The first write after a fork or load may move the page, and every pointer to it with it
+    const usize owned = table->owned;
+    write_page_table(table, address, value);
+    if (table->owned != owned) {
+        map_ppu_pages(bus);
+    }
 }
 
 static word to_palette_address(word address) {
@@ -86,6 +132,5 @@ static word to_palette_address(word address) {
 }
 
 static word to_nametable_address(const word* name_table, word address) {
-    const word nametable_address = (address - 0x2000) % 0xfff;
-    return name_table[nametable_address / 0x400] + nametable_address & 0x3ff;
-}
\ No newline at end of file
+    return name_table[(address >> 10) & 3] | (address & 0x3ff);
+}
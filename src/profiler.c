@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "profiler.h"
+#include "cpu.h"
+#include "cpu_opcodes.h"
+#include "log.h"
+
+#define RAM_BANK 0xffff
+
+static struct ProfileEntry* find_entry(struct Profiler* profiler, usize key);
+static int compare_entries(const void* a, const void* b);
+static int compare_opcodes(const void* a, const void* b);
+
+typedef struct OpcodeTotal {
+    uint64_t cycles;
+    word opcode;
+} OpcodeTotal;
+
+struct Profiler* create_profiler(void) {
+    struct Profiler* profiler = calloc(1, sizeof(struct Profiler));
+    if (profiler == NULL) {
+        return NULL;
+    }
+    profiler->entries = calloc(PROFILE_SLOTS, sizeof(struct ProfileEntry));
+    if (profiler->entries == NULL) {
+        free(profiler);
+        return NULL;
+    }
+    return profiler;
+}
+
+void free_profiler(struct Profiler* profiler) {
+    if (profiler == NULL) {
+        return;
+    }
+    free(profiler->entries);
+    free(profiler);
+}
+
+void clear_profiler(struct Profiler* profiler) {
+    struct ProfileEntry* entries = profiler->entries;
+    memset(entries, 0, PROFILE_SLOTS * sizeof(struct ProfileEntry));
+    memset(profiler, 0, sizeof(struct Profiler));
+    profiler->entries = entries;
+}
+
+void record_instruction(struct Profiler* profiler, const struct CPU* cpu, word pc, byte opcode, byte cycles) {
+    profiler->opcode_count[opcode]++;
+    profiler->opcode_cycles[opcode] += cycles;
+    profiler->total_count++;
+    profiler->total_cycles += cycles;
+
+    const struct Mapper* mapper = cpu->bus->mapper;
+    const word bank = pc >= 0x8000 ? mapper->prg_bank(mapper, pc) : RAM_BANK;
+    struct ProfileEntry* entry = find_entry(profiler, (usize)bank << 16 | pc);
+    if (entry == NULL) {
+        profiler->dropped++;
+        return;
+    }
+    if (entry->count == 0) {
+        entry->bytes[0] = opcode;
+        entry->bytes[1] = read_cpu_memory(cpu->bus, pc + 1);
+        entry->bytes[2] = read_cpu_memory(cpu->bus, pc + 2);
+        profiler->used++;
+    }
+    entry->count++;
+    entry->cycles += cycles;
+}
+
+void report_profile(const struct Profiler* profiler, FILE* out, usize top) {
+    if (profiler == NULL || profiler->total_cycles == 0) {
+        return;
+    }
+    const double total = (double)profiler->total_cycles;
+
+    struct OpcodeTotal opcodes[0x100];
+    for (usize i = 0; i < 0x100; i++) {
+        opcodes[i] = (struct OpcodeTotal){ profiler->opcode_cycles[i], i };
+    }
+    qsort(opcodes, 0x100, sizeof(struct OpcodeTotal), compare_opcodes);
+
+    fprintf(out, "%llu instructions, %llu cycles\n\n",
+            (unsigned long long)profiler->total_count, (unsigned long long)profiler->total_cycles);
+    fprintf(out, "%-4s %-3s %-3s %12s %12s %7s\n", "op", "", "", "count", "cycles", "%");
+    for (usize i = 0; i < 0x100 && opcodes[i].cycles; i++) {
+        const word opcode = opcodes[i].opcode;
+        const Instruction* instr = &INSTRUCTIONS[opcode];
+        fprintf(out, "$%02X  %-3s %-3s %12llu %12llu %6.2f%%\n", opcode,
+                OPERATION_NAMES[instr->operation], ADDRESS_MODE_NAMES[instr->address_mode],
+                (unsigned long long)profiler->opcode_count[opcode],
+                (unsigned long long)opcodes[i].cycles, 100.0 * opcodes[i].cycles / total);
+    }
+
+    // Only the occupied slots get sorted
+    struct ProfileEntry* entries = malloc((profiler->used ? profiler->used : 1) * sizeof(struct ProfileEntry));
+    usize count = 0;
+    for (usize i = 0; i < PROFILE_SLOTS && count < profiler->used; i++) {
+        if (profiler->entries[i].count) {
+            entries[count++] = profiler->entries[i];
+        }
+    }
+    qsort(entries, count, sizeof(struct ProfileEntry), compare_entries);
+
+    fprintf(out, "\n%-4s %-5s %-16s %12s %12s %7s\n", "bank", "pc", "instruction", "count", "cycles", "%");
+    for (usize i = 0; i < count && i < top; i++) {
+        const struct ProfileEntry* entry = &entries[i];
+        const word bank = entry->key >> 16;
+        const word pc = entry->key & 0xffff;
+        char text[32];
+        disassemble(text, sizeof(text), pc, entry->bytes);
+        if (bank == RAM_BANK) {
+            fprintf(out, "%-4s $%04X %-16s", "RAM", pc, text);
+        } else {
+            fprintf(out, "%-4u $%04X %-16s", bank, pc, text);
+        }
+        fprintf(out, " %12llu %12llu %6.2f%%\n", (unsigned long long)entry->count,
+                (unsigned long long)entry->cycles, 100.0 * entry->cycles / total);
+    }
+    if (profiler->dropped) {
+        fprintf(out, "%llu instructions not attributed, the PC table is full\n",
+                (unsigned long long)profiler->dropped);
+    }
+    free(entries);
+}
+
+static struct ProfileEntry* find_entry(struct Profiler* profiler, usize key) {
+    // Linear probing; a slot that has never counted anything is free
+    usize slot = (key * 0x9E3779B1u) >> 16 & (PROFILE_SLOTS - 1);
+    for (usize probe = 0; probe < 64; probe++) {
+        struct ProfileEntry* entry = &profiler->entries[(slot + probe) & (PROFILE_SLOTS - 1)];
+        if (entry->key == key) {
+            return entry;
+        }
+        if (entry->count == 0) {
+            entry->key = key;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const struct ProfileEntry* x = a;
+    const struct ProfileEntry* y = b;
+    return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
+
+static int compare_opcodes(const void* a, const void* b) {
+    const struct OpcodeTotal* x = a;
+    const struct OpcodeTotal* y = b;
+    return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "emulator.h"
+#include "state.h"
+#include "log.h"
+
+static bool allocate_buffers(struct RewindBuffer* rewind);
+static usize reserve(struct RewindBuffer* rewind, usize length);
+static void evict_oldest(struct RewindBuffer* rewind);
+static bool reserve_entry(struct RewindBuffer* rewind);
+static void push_entry(struct RewindBuffer* rewind, struct RewindEntry entry);
+static struct RewindEntry* get_entry(const struct RewindBuffer* rewind, usize index);
+static bool reload_keyframe(struct RewindBuffer* rewind);
+
+static usize encode_delta(struct RewindBuffer* rewind, usize size, bool keyframe);
+static bool decode_delta(const byte* in, usize length, const byte* base, usize size, byte* out);
+static void clear_history(struct RewindBuffer* rewind);
+static byte* write_varint(byte* out, usize value);
+static const byte* read_varint(const byte* in, const byte* end, usize* value);
+
+bool init_rewind(struct RewindBuffer* rewind, usize budget, usize keyframe_interval) {
+    memset(rewind, 0, sizeof(struct RewindBuffer));
+    rewind->capacity = budget ? budget : REWIND_DEFAULT_BUDGET;
+    rewind->keyframe_interval = keyframe_interval ? keyframe_interval : REWIND_KEYFRAME_INTERVAL;
+    rewind->data = malloc(rewind->capacity);
+    if (rewind->data == NULL) {
+        LOG(ERROR, "Could not allocate %u bytes for rewind", rewind->capacity);
+        return false;
+    }
+    return true;
+}
+
+void free_rewind(struct RewindBuffer* rewind) {
+    free(rewind->data);
+    free(rewind->entries);
+    free(rewind->keyframe);
+    free(rewind->state);
+    free(rewind->delta);
+    free(rewind->encoded);
+    memset(rewind, 0, sizeof(struct RewindBuffer));
+}
+
+void capture_rewind(struct RewindBuffer* rewind, const struct Emulator* emulator) {
+    if (rewind->state == NULL && !allocate_buffers(rewind)) {
+        return;
+    }
+    // The entry is made room for first, so a capture that cannot be recorded changes nothing
+    if (!reserve_entry(rewind)) {
+        LOG(ERROR, "Could not grow the rewind history, dropping this frame");
+        return;
+    }
+    const usize size = save_state(emulator, rewind->state, rewind->state_capacity);
+    bool keyframe = rewind->entry_count == 0 || size != rewind->keyframe_size ||
+                    rewind->frames_since_keyframe >= rewind->keyframe_interval;
+
+    usize length = encode_delta(rewind, size, keyframe);
+    if (length > rewind->capacity) {
+        return;
+    }
+    usize offset = reserve(rewind, length);
+    if (!keyframe && rewind->entry_count == 0) {
+        // Making room evicted the keyframe this delta was taken against
+        rewind->write_offset = offset;
+        keyframe = true;
+        length = encode_delta(rewind, size, true);
+        offset = reserve(rewind, length);
+    }
+    memcpy(rewind->data + offset, rewind->encoded, length);
+
+    if (keyframe) {
+        memcpy(rewind->keyframe, rewind->state, size);
+        rewind->keyframe_size = size;
+        rewind->frames_since_keyframe = 0;
+    } else {
+        rewind->frames_since_keyframe++;
+    }
+    const struct RewindEntry entry = { offset, length, size, keyframe };
+    push_entry(rewind, entry);
+}
+
+bool rewind_emulator(struct RewindBuffer* rewind, struct Emulator* emulator) {
+    if (rewind->entry_count == 0) {
+        return false;
+    }
+    const struct RewindEntry entry = *get_entry(rewind, rewind->entry_count - 1);
+    if (!decode_delta(rewind->data + entry.offset, entry.length, entry.keyframe ? NULL : rewind->keyframe,
+                      entry.state_size, rewind->state)) {
+        clear_history(rewind);
+        return false;
+    }
+    rewind->entry_count--;
+    rewind->write_offset = entry.offset;
+
+    if (entry.keyframe && !reload_keyframe(rewind)) {
+        clear_history(rewind);
+    } else if (!entry.keyframe) {
+        rewind->frames_since_keyframe--;
+    }
+    return load_state(emulator, rewind->state, entry.state_size);
+}
+
+static bool allocate_buffers(struct RewindBuffer* rewind) {
+    rewind->state_capacity = get_max_state_size();
+    rewind->keyframe = malloc(rewind->state_capacity);
+    rewind->state    = malloc(rewind->state_capacity);
+    rewind->delta    = malloc(rewind->state_capacity);
+    rewind->encoded  = malloc(rewind->state_capacity * 2 + 16);
+    if (rewind->keyframe == NULL || rewind->state == NULL || rewind->delta == NULL || rewind->encoded == NULL) {
+        free(rewind->keyframe);
+        free(rewind->state);
+        free(rewind->delta);
+        free(rewind->encoded);
+        rewind->keyframe = rewind->state = rewind->delta = rewind->encoded = NULL;
+        return false;
+    }
+    return true;
+}
+
+static usize reserve(struct RewindBuffer* rewind, usize length) {
+    if (rewind->write_offset + length > rewind->capacity) {
+        // Everything past the write offset is left over from the previous lap and older than anything
+        // at the start of the buffer, so it goes before the overlap check below can reach newer entries
+        while (rewind->entry_count > 0 && get_entry(rewind, 0)->offset >= rewind->write_offset) {
+            evict_oldest(rewind);
+        }
+        rewind->write_offset = 0;
+    }
+    const usize offset = rewind->write_offset;
+    while (rewind->entry_count > 0) {
+        const struct RewindEntry* oldest = get_entry(rewind, 0);
+        if (oldest->offset >= offset + length || oldest->offset + oldest->length <= offset) {
+            break;
+        }
+        evict_oldest(rewind);
+    }
+    rewind->write_offset = offset + length;
+    return offset;
+}
+
+static void evict_oldest(struct RewindBuffer* rewind) {
+    // Deltas are useless without their keyframe, so a whole group goes at once
+    do {
+        rewind->first_entry = (rewind->first_entry + 1) % rewind->entry_capacity;
+        rewind->entry_count--;
+    } while (rewind->entry_count > 0 && !get_entry(rewind, 0)->keyframe);
+}
+
+static bool reserve_entry(struct RewindBuffer* rewind) {
+    if (rewind->entry_count < rewind->entry_capacity) {
+        return true;
+    }
+    const usize capacity = rewind->entry_capacity ? rewind->entry_capacity * 2 : 256;
+    struct RewindEntry* entries = malloc(capacity * sizeof(struct RewindEntry));
+    if (entries == NULL) {
+        return false;
+    }
+    for (usize i = 0; i < rewind->entry_count; i++) {
+        entries[i] = *get_entry(rewind, i);
+    }
+    free(rewind->entries);
+    rewind->entries = entries;
+    rewind->entry_capacity = capacity;
+    rewind->first_entry = 0;
+    return true;
+}
+
+static void push_entry(struct RewindBuffer* rewind, struct RewindEntry entry) {
+    *get_entry(rewind, rewind->entry_count++) = entry;
+}
+
+static struct RewindEntry* get_entry(const struct RewindBuffer* rewind, usize index) {
+    return &rewind->entries[(rewind->first_entry + index) % rewind->entry_capacity];
+}
+
+static bool reload_keyframe(struct RewindBuffer* rewind) {
+    rewind->keyframe_size = 0;
+    rewind->frames_since_keyframe = 0;
+    for (usize i = rewind->entry_count; i-- > 0;) {
+        const struct RewindEntry* entry = get_entry(rewind, i);
+        if (entry->keyframe) {
+            if (!decode_delta(rewind->data + entry->offset, entry->length, NULL, entry->state_size, rewind->keyframe)) {
+                return false;
+            }
+            rewind->keyframe_size = entry->state_size;
+            rewind->frames_since_keyframe = rewind->entry_count - 1 - i;
+            return true;
+        }
+    }
+    return true;
+}
+
+static void clear_history(struct RewindBuffer* rewind) {
+    LOG(ERROR, "Rewind history is corrupt, discarding it");
+    rewind->first_entry = 0;
+    rewind->entry_count = 0;
+    rewind->write_offset = 0;
+    rewind->keyframe_size = 0;
+    rewind->frames_since_keyframe = 0;
+}
+
+static usize encode_delta(struct RewindBuffer* rewind, usize size, bool keyframe) {
+    const byte* delta = rewind->state;
+    if (!keyframe) {
+        for (usize i = 0; i < size; i++) {
+            rewind->delta[i] = rewind->state[i] ^ rewind->keyframe[i];
+        }
+        delta = rewind->delta;
+    }
+
+    // Alternating runs of zero bytes and literals
+    byte* ptr = rewind->encoded;
+    usize i = 0;
+    while (i < size) {
+        const usize zero_start = i;
+        while (i < size && delta[i] == 0) {
+            i++;
+        }
+        const usize literal_start = i;
+        while (i < size && (delta[i] != 0 || (i + 1 < size && delta[i + 1] != 0))) {
+            i++;
+        }
+        ptr = write_varint(ptr, literal_start - zero_start);
+        ptr = write_varint(ptr, i - literal_start);
+        memcpy(ptr, delta + literal_start, i - literal_start);
+        ptr += i - literal_start;
+    }
+    return ptr - rewind->encoded;
+}
+
+static bool decode_delta(const byte* in, usize length, const byte* base, usize size, byte* out) {
+    // Runs are checked against both buffers, so a damaged entry is refused rather than decoded past its end
+    const byte* end = in + length;
+    usize i = 0;
+    while (i < size) {
+        usize zeros, literals;
+        if ((in = read_varint(in, end, &zeros)) == NULL || (in = read_varint(in, end, &literals)) == NULL ||
+            zeros > size - i || literals > size - i - zeros || literals > (usize)(end - in)) {
+            return false;
+        }
+        memset(out + i, 0, zeros);
+        i += zeros;
+        memcpy(out + i, in, literals);
+        in += literals;
+        i += literals;
+    }
+    if (base != NULL) {
+        for (i = 0; i < size; i++) {
+            out[i] ^= base[i];
+        }
+    }
+    return true;
+}
+
+static byte* write_varint(byte* out, usize value) {
+    while (value >= 0x80) {
+        *out++ = (byte)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (byte)value;
+    return out;
+}
+
+static const byte* read_varint(const byte* in, const byte* end, usize* value) {
+    usize result = 0;
+    byte shift = 0;
+    while (in < end && *in & 0x80) {
+        if (shift > 28) {
+            return NULL;
+        }
+        result |= (usize)(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    if (in == end || shift > 28) {
+        return NULL;
+    }
+    *value = result | (usize)*in++ << shift;
+    return in;
+}
\ No newline at end of file
@@ -0,0 +1,315 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rom.h"
+#include "log.h"
+
+#define NES_MAGIC "NES\x1A"
+
+typedef struct INESHeader {
+    byte nes_id[4];
+    byte prg_banks;
+    byte chr_banks;
+    byte flags6;
+    byte flags7;
+    byte flags8;
+    byte flags9;
+    byte flags10;
+    byte flags11;
+    byte flags12;
+    byte flags13;
+    byte flags14;
+    byte flags15;
+} INESHeader;
+
+static struct RomImage* new_rom_image(const char* path, const byte* data, usize size, bool mapped, RomError* error);
+static void destroy_rom_image(struct RomImage* image);
+static void unmap_rom_data(const byte* data, usize size, bool mapped);
+static const byte* map_file(const char* path, usize* size, bool* mapped, RomError* error);
+
+static uint64_t rom_size(byte lsb, byte msb, usize unit);
+static usize ram_size(byte shift);
+
+void init_rom_cache(struct RomCache* cache) {
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->images = NULL;
+}
+
+void free_rom_cache(struct RomCache* cache) {
+    // Images still referenced by emulators outlive the cache
+    pthread_mutex_lock(&cache->lock);
+    for (struct RomImage* image = cache->images; image != NULL; image = image->next) {
+        image->cache = NULL;
+    }
+    cache->images = NULL;
+    pthread_mutex_unlock(&cache->lock);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+struct RomImage* acquire_rom_image(struct RomCache* cache, const char* path, RomError* error) {
+    pthread_mutex_lock(&cache->lock);
+    for (struct RomImage* image = cache->images; image != NULL; image = image->next) {
+        if (strcmp(image->path, path) == 0) {
+            atomic_fetch_add(&image->refs, 1);
+            pthread_mutex_unlock(&cache->lock);
+            return image;
+        }
+    }
+
+    struct RomImage* image = load_rom_image(path, error);
+    if (image != NULL) {
+        image->cache = cache;
+        image->next  = cache->images;
+        cache->images = image;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return image;
+}
+
+struct RomImage* load_rom_image(const char* path, RomError* error) {
+    usize size;
+    bool mapped;
+    const byte* data = map_file(path, &size, &mapped, error);
+    if (data == NULL) {
+        return NULL;
+    }
+    return new_rom_image(path, data, size, mapped, error);
+}
+
+struct RomImage* create_rom_image(const byte* data, usize size, RomError* error) {
+    byte* copy = malloc(size);
+    if (copy == NULL) {
+        *error = ROM_OUT_OF_MEMORY;
+        return NULL;
+    }
+    memcpy(copy, data, size);
+    return new_rom_image("<memory>", copy, size, false, error);
+}
+
+struct RomImage* retain_rom_image(struct RomImage* image) {
+    atomic_fetch_add(&image->refs, 1);
+    return image;
+}
+
+void release_rom_image(struct RomImage* image) {
+    if (image == NULL) {
+        return;
+    }
+    struct RomCache* cache = image->cache;
+    if (cache == NULL) {
+        if (atomic_fetch_sub(&image->refs, 1) == 1) {
+            destroy_rom_image(image);
+        }
+        return;
+    }
+
+    // References other than the last are dropped without the lock
+    size_t refs = atomic_load(&image->refs);
+    while (refs > 1) {
+        if (atomic_compare_exchange_weak(&image->refs, &refs, refs - 1)) {
+            return;
+        }
+    }
+
+    // The last one is dropped under it, so acquire_rom_image cannot hand out an image that is being destroyed
+    pthread_mutex_lock(&cache->lock);
+    if (atomic_fetch_sub(&image->refs, 1) == 1) {
+        struct RomImage** link = &cache->images;
+        while (*link != image) {
+            link = &(*link)->next;
+        }
+        *link = image->next;
+        destroy_rom_image(image);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+RomError parse_rom_header(const byte* data, usize size, struct RomInfo* info) {
+    INESHeader header;
+    memset(info, 0, sizeof(struct RomInfo));
+    if (size < INES_HEADER_SIZE) {
+        return ROM_TRUNCATED;
+    }
+    memcpy(&header, data, INES_HEADER_SIZE);
+    if (strncmp((char*)header.nes_id, NES_MAGIC, 4) != 0) {
+        return ROM_BAD_MAGIC;
+    }
+
+    info->vertical_mirroring = (header.flags6 & BIT_0) != 0;
+    info->battery            = (header.flags6 & BIT_1) != 0;
+    info->trainer            = (header.flags6 & BIT_2) != 0;
+    info->four_screen        = (header.flags6 & BIT_3) != 0;
+    info->mapper_id          = (header.flags7 & 0xf0) | (header.flags6 >> 4);
+    info->console_type       = header.flags7 & 0x03;
+    uint64_t prg_rom_size;
+    uint64_t chr_rom_size;
+
+    if ((header.flags7 & 0x0c) == 0x08) {
+        info->format        = FORMAT_NES20;
+        info->mapper_id    |= (header.flags8 & 0x0f) << 8;
+        info->submapper     = header.flags8 >> 4;
+        prg_rom_size        = rom_size(header.prg_banks, header.flags9 & 0x0f, 0x4000);
+        chr_rom_size        = rom_size(header.chr_banks, header.flags9 >> 4, 0x2000);
+        info->prg_ram_size   = ram_size(header.flags10 & 0x0f);
+        info->prg_nvram_size = ram_size(header.flags10 >> 4);
+        info->chr_ram_size   = ram_size(header.flags11 & 0x0f);
+        info->chr_nvram_size = ram_size(header.flags11 >> 4);
+        info->timing        = header.flags12 & 0x03;
+        if (info->console_type == 0x03) {
+            info->console_type = header.flags13 & 0x0f;
+        }
+    } else {
+        info->format       = FORMAT_INES;
+        prg_rom_size       = header.prg_banks * 0x4000;
+        chr_rom_size       = header.chr_banks * 0x2000;
+        info->timing       = (header.flags9 & BIT_0) ? TIMING_PAL : TIMING_NTSC;
+
+        // Old dumping tools left signatures in bytes 12-15, which also garbles the upper mapper nibble
+        if (header.flags12 || header.flags13 || header.flags14 || header.flags15) {
+            info->mapper_id &= 0x0f;
+        }
+        const usize work_ram = (header.flags8 ? header.flags8 : 1) * 0x2000;
+        if (info->battery) {
+            info->prg_nvram_size = work_ram;
+        } else {
+            info->prg_ram_size = work_ram;
+        }
+        info->chr_ram_size = chr_rom_size ? 0 : 0x2000;
+    }
+
+    // Header sizes can claim far more than usize holds, so they are measured against the file in 64 bits.
+    // A truncated file still reports what its header claims, saturated, for listings.
+    const uint64_t prg_offset = INES_HEADER_SIZE + (info->trainer ? TRAINER_SIZE : 0);
+    info->prg_rom_size = prg_rom_size < UINT32_MAX ? (usize)prg_rom_size : UINT32_MAX;
+    info->chr_rom_size = chr_rom_size < UINT32_MAX ? (usize)chr_rom_size : UINT32_MAX;
+    if (prg_rom_size == 0 || prg_offset + prg_rom_size + chr_rom_size > size) {
+        return ROM_TRUNCATED;
+    }
+    info->trainer_offset = INES_HEADER_SIZE;
+    info->prg_offset     = (usize)prg_offset;
+    info->chr_offset     = (usize)(prg_offset + prg_rom_size);
+    return ROM_OK;
+}
+
+const char* rom_error_string(RomError error) {
+    switch (error) {
+        case ROM_OK:                 return "no error";
+        case ROM_NOT_FOUND:          return "file not found";
+        case ROM_IO_ERROR:           return "could not read file";
+        case ROM_OUT_OF_MEMORY:      return "out of memory";
+        case ROM_BAD_MAGIC:          return "not an iNES file";
+        case ROM_TRUNCATED:          return "file is shorter than its header claims";
+        case ROM_UNSUPPORTED_MAPPER: return "mapper not implemented";
+        case ROM_TOO_LARGE:          return "file is too large";
+        case ROM_UNSUPPORTED_SIZE:   return "ROM or RAM size not supported by the mapper";
+        default:                     return "unknown error";
+    }
+}
+
+static struct RomImage* new_rom_image(const char* path, const byte* data, usize size, bool mapped, RomError* error) {
+    struct RomImage* image = malloc(sizeof(struct RomImage));
+    if (image == NULL) {
+        unmap_rom_data(data, size, mapped);
+        *error = ROM_OUT_OF_MEMORY;
+        return NULL;
+    }
+    *error = parse_rom_header(data, size, &image->info);
+    if (*error != ROM_OK) {
+        LOG(ERROR, "Could not load '%s': %s", path, rom_error_string(*error));
+        unmap_rom_data(data, size, mapped);
+        free(image);
+        return NULL;
+    }
+    image->path   = strdup(path);
+    image->data   = data;
+    image->size   = size;
+    image->mapped = mapped;
+    image->cache  = NULL;
+    image->next   = NULL;
+    atomic_init(&image->refs, 1);
+    return image;
+}
+
+static void destroy_rom_image(struct RomImage* image) {
+    unmap_rom_data(image->data, image->size, image->mapped);
+    free(image->path);
+    free(image);
+}
+
+static void unmap_rom_data(const byte* data, usize size, bool mapped) {
+    if (mapped) {
+        munmap((void*)data, size);
+    } else {
+        free((void*)data);
+    }
+}
+
+static const byte* map_file(const char* path, usize* size, bool* mapped, RomError* error) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG(ERROR, "File '%s' is not found.", path);
+        *error = ROM_NOT_FOUND;
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        *error = ROM_IO_ERROR;
+        return NULL;
+    }
+    if (st.st_size == 0 || (uint64_t)st.st_size > UINT32_MAX) {
+        close(fd);
+        *error = st.st_size == 0 ? ROM_TRUNCATED : ROM_TOO_LARGE;
+        return NULL;
+    }
+    *size = (usize)st.st_size;
+
+    // Pages are faulted in on first use and shared by every process mapping the file
+    void* data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+        close(fd);
+        *mapped = true;
+        return data;
+    }
+
+    // Fall back to a plain read for files that cannot be mapped
+    *mapped = false;
+    data = malloc(*size);
+    if (data == NULL) {
+        close(fd);
+        *error = ROM_OUT_OF_MEMORY;
+        return NULL;
+    }
+    usize offset = 0;
+    while (offset < *size) {
+        const ssize_t count = read(fd, (byte*)data + offset, *size - offset);
+        if (count <= 0) {
+            free(data);
+            close(fd);
+            *error = ROM_IO_ERROR;
+            return NULL;
+        }
+        offset += count;
+    }
+    close(fd);
+    return data;
+}
+
+static uint64_t rom_size(byte lsb, byte msb, usize unit) {
+    if (msb == 0x0f) {
+        // Exponent-multiplier notation: 2^E * (MM * 2 + 1) bytes. Past 2^31 no file could hold it anyway,
+        // so larger exponents all report 4GB rather than overflow
+        const usize exponent = lsb >> 2;
+        const uint64_t multiplier = (lsb & 0x03) * 2 + 1;
+        return exponent < 32 ? ((uint64_t)1 << exponent) * multiplier : (uint64_t)1 << 32;
+    }
+    return ((uint64_t)msb << 8 | lsb) * unit;
+}
+
+static usize ram_size(byte shift) {
+    return shift ? (usize)64 << shift : 0;
+}
\ No newline at end of file
@@ -0,0 +1,518 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rom_index.h"
+#include "mapper.h"
+#include "thread_pool.h"
+#include "log.h"
+
+// A file found by the directory walk, with what stat said about it
+typedef struct IndexFile {
+    char* path;
+    uint64_t size;
+    int64_t mtime;
+} IndexFile;
+
+typedef struct IndexWalk {
+    struct IndexFile* files;
+    usize count;
+    usize capacity;
+} IndexWalk;
+
+typedef struct HashJob {
+    const char* path;
+    struct RomIndexEntry* entry;
+} HashJob;
+
+static bool walk_directory(struct IndexWalk* walk, const char* directory);
+static bool add_file(struct IndexWalk* walk, const char* path, const struct stat* st);
+static bool is_rom_file(const char* name);
+static int64_t file_mtime(const struct stat* st);
+static int compare_files(const void* a, const void* b);
+static int compare_fixes(const void* a, const void* b);
+
+static void hash_rom(void* context);
+static const struct RomFix* find_fix(const struct RomFix* fixes, usize count, usize crc32);
+static bool parse_fix(char* line, struct RomFix* fix);
+static bool write_index(const char* path, const struct RomIndexEntry* entries, usize count,
+                        const struct IndexFile* files);
+static double elapsed_seconds(const struct timespec* start);
+
+bool open_rom_index(struct RomIndex* index, const char* path) {
+    memset(index, 0, sizeof(struct RomIndex));
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct RomIndexHeader) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    // Nothing is copied out, so the file is checked once here and then trusted
+    const struct RomIndexHeader* header = data;
+    const usize entries_size = header->count * sizeof(struct RomIndexEntry);
+    if (header->magic != ROM_INDEX_MAGIC || header->version != ROM_INDEX_VERSION ||
+        header->entry_size != sizeof(struct RomIndexEntry) || header->count > st.st_size / sizeof(struct RomIndexEntry) ||
+        sizeof(*header) + entries_size + header->strings_size != (usize)st.st_size ||
+        (header->strings_size && ((const char*)data)[st.st_size - 1] != '\0')) {
+        LOG(ERROR, "ROM index '%s' is not compatible with this build", path);
+        munmap(data, st.st_size);
+        return false;
+    }
+    // Lookups index the strings blindly, so a path past their end means the file is corrupt
+    const struct RomIndexEntry* entries = (const struct RomIndexEntry*)((const byte*)data + sizeof(*header));
+    for (usize i = 0; i < header->count; i++) {
+        if (entries[i].path >= header->strings_size) {
+            LOG(ERROR, "ROM index '%s' is corrupt: entry %u points past its paths", path, i);
+            munmap(data, st.st_size);
+            return false;
+        }
+    }
+    index->data    = data;
+    index->size    = st.st_size;
+    index->entries = entries;
+    index->count   = header->count;
+    index->strings = (const char*)(index->data + sizeof(*header) + entries_size);
+    return true;
+}
+
+void close_rom_index(struct RomIndex* index) {
+    if (index->data != NULL) {
+        munmap((void*)index->data, index->size);
+    }
+    memset(index, 0, sizeof(struct RomIndex));
+}
+
+const struct RomIndexEntry* find_rom_index_entry(const struct RomIndex* index, const char* path) {
+    usize low = 0;
+    usize high = index->count;
+    while (low < high) {
+        const usize middle = low + (high - low) / 2;
+        const int order = strcmp(get_rom_index_path(index, &index->entries[middle]), path);
+        if (order == 0) {
+            return &index->entries[middle];
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return NULL;
+}
+
+const char* get_rom_index_path(const struct RomIndex* index, const struct RomIndexEntry* entry) {
+    return index->strings + entry->path;
+}
+
+bool apply_rom_index(const struct RomIndex* index, struct RomImage* image) {
+    // Paths are indexed in canonical form, and an entry only counts while the file is unchanged
+    char path[PATH_MAX];
+    struct stat st;
+    if (realpath(image->path, path) == NULL || stat(path, &st) != 0) {
+        return false;
+    }
+    const struct RomIndexEntry* entry = find_rom_index_entry(index, path);
+    if (entry == NULL || entry->size != (uint64_t)st.st_size || entry->mtime != file_mtime(&st)) {
+        LOG(INFO, "'%s' is not in the ROM index or changed since it was scanned", image->path);
+        return false;
+    }
+    if (entry->fix.fields) {
+        apply_rom_fix(&entry->fix, &image->info);
+        LOG(INFO, "Corrected header of '%s' (CRC32 %08x)", image->path, entry->crc32);
+    }
+    return true;
+}
+
+bool load_rom_fixes(const char* path, struct RomFix** fixes, usize* count) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        LOG(ERROR, "File '%s' is not found.", path);
+        return false;
+    }
+
+    // Each line reads: <crc32> <field>=<value>...
+    char line[512];
+    usize capacity = 0;
+    bool success = true;
+    *fixes = NULL;
+    *count = 0;
+    while (success && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct RomFix* grown = realloc(*fixes, capacity * sizeof(struct RomFix));
+            if (grown == NULL) {
+                success = false;
+                break;
+            }
+            *fixes = grown;
+        }
+        success = parse_fix(line, &(*fixes)[*count]);
+        if (!success) {
+            LOG(ERROR, "Malformed header fix: %s", line);
+            break;
+        }
+        (*count)++;
+    }
+    fclose(file);
+    if (!success) {
+        free(*fixes);
+        *fixes = NULL;
+        *count = 0;
+    }
+    return success;
+}
+
+void apply_rom_fix(const struct RomFix* fix, struct RomInfo* info) {
+    if (fix->fields & FIX_MAPPER) {
+        info->mapper_id = fix->mapper_id;
+    }
+    if (fix->fields & FIX_SUBMAPPER) {
+        info->submapper = fix->submapper;
+    }
+    if (fix->fields & FIX_MIRRORING) {
+        info->vertical_mirroring = fix->vertical_mirroring;
+        info->four_screen = fix->four_screen;
+    }
+    if (fix->fields & FIX_TIMING) {
+        info->timing = fix->timing;
+    }
+    // Work RAM is battery-backed or not as a whole, so a battery fix moves it between the two sizes
+    if (fix->fields & (FIX_BATTERY | FIX_PRG_RAM)) {
+        const usize size = (fix->fields & FIX_PRG_RAM) ? fix->prg_ram_size : info->prg_ram_size + info->prg_nvram_size;
+        if (fix->fields & FIX_BATTERY) {
+            info->battery = fix->battery;
+        }
+        info->prg_nvram_size = info->battery ? size : 0;
+        info->prg_ram_size = info->battery ? 0 : size;
+    }
+}
+
+bool update_rom_index(const char* index_path, const char* directory, const struct RomFix* fixes, usize fix_count,
+                      usize workers, struct RomIndexStats* stats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(stats, 0, sizeof(struct RomIndexStats));
+
+    char root[PATH_MAX];
+    if (realpath(directory, root) == NULL) {
+        LOG(ERROR, "Directory '%s' is not found.", directory);
+        return false;
+    }
+    struct IndexWalk walk = { NULL, 0, 0 };
+    bool success = walk_directory(&walk, root);
+    if (walk.count) {
+        qsort(walk.files, walk.count, sizeof(struct IndexFile), compare_files);
+    }
+
+    // Files whose size and mtime match the previous index keep its entry; the rest are hashed in parallel
+    struct RomIndex previous;
+    const bool have_previous = open_rom_index(&previous, index_path);
+    struct RomIndexEntry* entries = calloc(walk.count ? walk.count : 1, sizeof(struct RomIndexEntry));
+    struct HashJob* jobs = calloc(walk.count ? walk.count : 1, sizeof(struct HashJob));
+    struct ThreadPool pool;
+    if (success && (entries == NULL || jobs == NULL || !init_thread_pool(&pool, workers))) {
+        LOG(ERROR, "Could not allocate the ROM index");
+        success = false;
+    }
+    for (usize i = 0; success && i < walk.count; i++) {
+        const struct IndexFile* file = &walk.files[i];
+        const struct RomIndexEntry* old = have_previous ? find_rom_index_entry(&previous, file->path) : NULL;
+        if (old != NULL && old->size == file->size && old->mtime == file->mtime) {
+            entries[i] = *old;
+            stats->reused++;
+            continue;
+        }
+        entries[i].size  = file->size;
+        entries[i].mtime = file->mtime;
+        jobs[i].path  = file->path;
+        jobs[i].entry = &entries[i];
+        submit_task(&pool, hash_rom, &jobs[i]);
+        stats->hashed++;
+        stats->bytes += file->size;
+    }
+    if (success) {
+        wait_thread_pool(&pool);
+        free_thread_pool(&pool);
+    }
+
+    // Fixes are matched afresh every time, so editing the table never calls for a rescan
+    struct RomFix* sorted = NULL;
+    if (success && fix_count) {
+        sorted = malloc(fix_count * sizeof(struct RomFix));
+        if (sorted == NULL) {
+            success = false;
+        } else {
+            memcpy(sorted, fixes, fix_count * sizeof(struct RomFix));
+            qsort(sorted, fix_count, sizeof(struct RomFix), compare_fixes);
+        }
+    }
+    for (usize i = 0; success && i < walk.count; i++) {
+        struct RomIndexEntry* entry = &entries[i];
+        const struct RomFix* fix = entry->status == ROM_OK ? find_fix(sorted, fix_count, entry->crc32) : NULL;
+        struct RomInfo info = entry->info;
+        memset(&entry->fix, 0, sizeof(struct RomFix));
+        if (fix != NULL) {
+            entry->fix = *fix;
+            apply_rom_fix(fix, &info);
+            stats->fixed++;
+        }
+        entry->supported = entry->status == ROM_OK && is_mapper_supported(info.mapper_id);
+        stats->unsupported += !entry->supported;
+    }
+    free(sorted);
+    if (have_previous) {
+        close_rom_index(&previous);
+    }
+
+    if (success) {
+        success = write_index(index_path, entries, walk.count, walk.files);
+    }
+    stats->files = walk.count;
+    stats->seconds = elapsed_seconds(&start);
+    for (usize i = 0; i < walk.count; i++) {
+        free(walk.files[i].path);
+    }
+    free(walk.files);
+    free(jobs);
+    free(entries);
+    return success;
+}
+
+void report_rom_index(const struct RomIndex* index, FILE* out) {
+    // Mappers marked with * come from the fix table rather than the header
+    fprintf(out, "%-8s %-7s %-7s %-7s %-11s %s\n", "crc32", "mapper", "prg KB", "chr KB", "status", "path");
+    for (usize i = 0; i < index->count; i++) {
+        const struct RomIndexEntry* entry = &index->entries[i];
+        struct RomInfo info = entry->info;
+        apply_rom_fix(&entry->fix, &info);
+        char mapper[16];
+        snprintf(mapper, sizeof(mapper), "%u%s", info.mapper_id, entry->fix.fields ? "*" : "");
+        const char* status = entry->status != ROM_OK ? "bad" : entry->supported ? "ok" : "unsupported";
+        fprintf(out, "%08x %-7s %-7u %-7u %-11s %s\n", entry->crc32, mapper, info.prg_rom_size / 1024,
+                info.chr_rom_size / 1024, status, get_rom_index_path(index, entry));
+    }
+}
+
+static bool walk_directory(struct IndexWalk* walk, const char* directory) {
+    DIR* dir = opendir(directory);
+    if (dir == NULL) {
+        LOG(ERROR, "Could not open directory '%s'", directory);
+        return false;
+    }
+    bool success = true;
+    char path[PATH_MAX];
+    const struct dirent* item;
+    while (success && (item = readdir(dir)) != NULL) {
+        if (item->d_name[0] == '.') {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s/%s", directory, item->d_name) >= (int)sizeof(path)) {
+            continue;
+        }
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            success = walk_directory(walk, path);
+        } else if (S_ISREG(st.st_mode) && is_rom_file(item->d_name)) {
+            success = add_file(walk, path, &st);
+        }
+    }
+    closedir(dir);
+    return success;
+}
+
+static bool add_file(struct IndexWalk* walk, const char* path, const struct stat* st) {
+    if (walk->count == walk->capacity) {
+        const usize capacity = walk->capacity ? walk->capacity * 2 : 256;
+        struct IndexFile* grown = realloc(walk->files, capacity * sizeof(struct IndexFile));
+        if (grown == NULL) {
+            return false;
+        }
+        walk->files = grown;
+        walk->capacity = capacity;
+    }
+    struct IndexFile* file = &walk->files[walk->count];
+    if ((file->path = strdup(path)) == NULL) {
+        return false;
+    }
+    file->size  = (uint64_t)st->st_size;
+    file->mtime = file_mtime(st);
+    walk->count++;
+    return true;
+}
+
+static bool is_rom_file(const char* name) {
+    const char* extension = strrchr(name, '.');
+    return extension != NULL && strcasecmp(extension, ".nes") == 0;
+}
+
+static int64_t file_mtime(const struct stat* st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static int compare_files(const void* a, const void* b) {
+    return strcmp(((const struct IndexFile*)a)->path, ((const struct IndexFile*)b)->path);
+}
+
+static int compare_fixes(const void* a, const void* b) {
+    const usize left = ((const struct RomFix*)a)->crc32;
+    const usize right = ((const struct RomFix*)b)->crc32;
+    return (left > right) - (left < right);
+}
+
+static void hash_rom(void* context) {
+    const struct HashJob* job = context;
+    struct RomIndexEntry* entry = job->entry;
+    entry->status = ROM_IO_ERROR;
+    const int fd = open(job->path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (entry->size == 0) {
+        close(fd);
+        entry->status = ROM_TRUNCATED;
+        return;
+    }
+    void* data = mmap(NULL, entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+
+    // The file is read front to back exactly once per checksum, so the kernel may read ahead freely
+    madvise(data, entry->size, MADV_SEQUENTIAL);
+    const usize body = entry->size > INES_HEADER_SIZE ? INES_HEADER_SIZE : (usize)entry->size;
+    entry->crc32 = crc32_checksum((const byte*)data + body, entry->size - body, 0);
+    sha1_digest((const byte*)data + body, entry->size - body, entry->sha1);
+    entry->status = parse_rom_header(data, entry->size, &entry->info);
+    munmap(data, entry->size);
+}
+
+static const struct RomFix* find_fix(const struct RomFix* fixes, usize count, usize crc32) {
+    const struct RomFix key = { .crc32 = crc32 };
+    return count ? bsearch(&key, fixes, count, sizeof(struct RomFix), compare_fixes) : NULL;
+}
+
+static bool parse_fix(char* line, struct RomFix* fix) {
+    memset(fix, 0, sizeof(struct RomFix));
+    char* save = NULL;
+    const char* token = strtok_r(line, " \t\r\n", &save);
+    char* end;
+    if (token == NULL) {
+        return false;
+    }
+    fix->crc32 = (usize)strtoul(token, &end, 16);
+    if (*end != '\0') {
+        return false;
+    }
+    while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+        const char* value = strchr(token, '=');
+        if (value == NULL) {
+            return false;
+        }
+        value++;
+        if (strncmp(token, "mapper=", 7) == 0) {
+            fix->mapper_id = (word)strtoul(value, NULL, 10);
+            fix->fields |= FIX_MAPPER;
+        } else if (strncmp(token, "submapper=", 10) == 0) {
+            fix->submapper = (byte)strtoul(value, NULL, 10);
+            fix->fields |= FIX_SUBMAPPER;
+        } else if (strncmp(token, "mirroring=", 10) == 0) {
+            fix->vertical_mirroring = strcmp(value, "vertical") == 0;
+            fix->four_screen = strcmp(value, "four") == 0;
+            if (!fix->vertical_mirroring && !fix->four_screen && strcmp(value, "horizontal") != 0) {
+                return false;
+            }
+            fix->fields |= FIX_MIRRORING;
+        } else if (strncmp(token, "battery=", 8) == 0) {
+            fix->battery = strtoul(value, NULL, 10) != 0;
+            fix->fields |= FIX_BATTERY;
+        } else if (strncmp(token, "timing=", 7) == 0) {
+            static const char* TIMINGS[] = { "ntsc", "pal", "multi", "dendy" };
+            usize timing = 0;
+            while (timing < 4 && strcmp(value, TIMINGS[timing]) != 0) {
+                timing++;
+            }
+            if (timing == 4) {
+                return false;
+            }
+            fix->timing = (RomTiming)timing;
+            fix->fields |= FIX_TIMING;
+        } else if (strncmp(token, "prg_ram=", 8) == 0) {
+            fix->prg_ram_size = (usize)strtoul(value, NULL, 10);
+            fix->fields |= FIX_PRG_RAM;
+        } else {
+            return false;
+        }
+    }
+    return fix->fields != 0;
+}
+
+static bool write_index(const char* path, const struct RomIndexEntry* entries, usize count,
+                        const struct IndexFile* files) {
+    // Written beside the old index and renamed over it, so readers never map a half-written file
+    char temporary[PATH_MAX];
+    if (snprintf(temporary, sizeof(temporary), "%s.tmp", path) >= (int)sizeof(temporary)) {
+        return false;
+    }
+    FILE* file = fopen(temporary, "wb");
+    if (file == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", temporary);
+        return false;
+    }
+
+    struct RomIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic      = ROM_INDEX_MAGIC;
+    header.version    = ROM_INDEX_VERSION;
+    header.entry_size = sizeof(struct RomIndexEntry);
+    header.count      = count;
+    for (usize i = 0; i < count; i++) {
+        header.strings_size += strlen(files[i].path) + 1;
+    }
+    bool success = fwrite(&header, sizeof(header), 1, file) == 1;
+    usize offset = 0;
+    for (usize i = 0; success && i < count; i++) {
+        struct RomIndexEntry entry = entries[i];
+        entry.path = offset;
+        offset += strlen(files[i].path) + 1;
+        success = fwrite(&entry, sizeof(entry), 1, file) == 1;
+    }
+    for (usize i = 0; success && i < count; i++) {
+        success = fwrite(files[i].path, strlen(files[i].path) + 1, 1, file) == 1;
+    }
+    success = fclose(file) == 0 && success;
+    if (!success || rename(temporary, path) != 0) {
+        LOG(ERROR, "Could not write ROM index '%s'", path);
+        unlink(temporary);
+        return false;
+    }
+    return true;
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
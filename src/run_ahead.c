@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "run_ahead.h"
+#include "emulator.h"
+#include "state.h"
+#include "log.h"
+
+static void record_input(struct RunAhead* run_ahead, const struct Emulator* emulator);
+static double elapsed_seconds(const struct timespec* start);
+
+bool init_run_ahead(struct RunAhead* run_ahead, byte frames) {
+    memset(run_ahead, 0, sizeof(struct RunAhead));
+    run_ahead->frames = frames > RUN_AHEAD_MAX_FRAMES ? RUN_AHEAD_MAX_FRAMES : frames;
+    run_ahead->state_capacity = get_max_state_size();
+    run_ahead->state = malloc(run_ahead->state_capacity);
+    if (run_ahead->state == NULL) {
+        LOG(ERROR, "Could not allocate %u bytes for run-ahead", run_ahead->state_capacity);
+        return false;
+    }
+    return true;
+}
+
+void free_run_ahead(struct RunAhead* run_ahead) {
+    free(run_ahead->state);
+    memset(run_ahead, 0, sizeof(struct RunAhead));
+}
+
+void run_frame_ahead(struct RunAhead* run_ahead, struct Emulator* emulator) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    record_input(run_ahead, emulator);
+
+    run_frame(emulator);
+    run_ahead->emulated++;
+    if (run_ahead->frames > 0) {
+        // Nothing in between is presented, so only the final frame gets converted to RGBA
+        const usize size = save_state(emulator, run_ahead->state, run_ahead->state_capacity);
+        // Speculative frames are thrown away, so they stay out of the trace, the audio and the save file
+        struct TraceRing* trace = emulator->cpu.trace;
+        struct Blip* blip = emulator->apu.blip;
+        struct Battery* battery = emulator->cpu_bus.battery;
+        emulator->cpu.trace = NULL;
+        emulator->apu.blip = NULL;
+        emulator->cpu_bus.battery = NULL;
+        for (byte i = 0; i < run_ahead->frames; i++) {
+            run_frame(emulator);
+        }
+        emulator->cpu.trace = trace;
+        emulator->apu.blip = blip;
+        emulator->cpu_bus.battery = battery;
+        get_screen_buffer(&emulator->ppu);
+        load_state(emulator, run_ahead->state, size);
+        run_ahead->emulated += run_ahead->frames;
+    }
+
+    const double seconds = elapsed_seconds(&start);
+    run_ahead->displayed++;
+    run_ahead->seconds += seconds;
+    if (seconds > run_ahead->worst_seconds) {
+        run_ahead->worst_seconds = seconds;
+    }
+    if (seconds > RUN_AHEAD_FRAME_TIME) {
+        run_ahead->over_budget++;
+    }
+}
+
+void report_run_ahead(const struct RunAhead* run_ahead, FILE* out) {
+    if (run_ahead->displayed == 0) {
+        return;
+    }
+    const double average = run_ahead->seconds / run_ahead->displayed;
+    const double per_frame = run_ahead->seconds / run_ahead->emulated;
+    const double hit_rate = run_ahead->predictions ? 100.0 * run_ahead->hits / run_ahead->predictions : 100.0;
+    fprintf(out, "run-ahead: %u frames, %u displayed, %.1f%% input hit rate\n",
+            run_ahead->frames, run_ahead->displayed, hit_rate);
+    fprintf(out, "run-ahead: %.3f ms per displayed frame (worst %.3f ms, %u over budget), "
+                 "%.3f ms per emulated frame (%.1fx real time)\n",
+            average * 1000.0, run_ahead->worst_seconds * 1000.0, run_ahead->over_budget,
+            per_frame * 1000.0, RUN_AHEAD_FRAME_TIME / per_frame);
+}
+
+static void record_input(struct RunAhead* run_ahead, const struct Emulator* emulator) {
+    // Every earlier frame within the window guessed that this frame's input would match its own
+    const word input = emulator->cpu_bus.pad1.status | (emulator->cpu_bus.pad2.status << 8);
+    const usize window = run_ahead->input_count < run_ahead->frames ? run_ahead->input_count : run_ahead->frames;
+    for (usize i = 1; i <= window; i++) {
+        const usize index = (run_ahead->input_count - i) % (RUN_AHEAD_MAX_FRAMES + 1);
+        run_ahead->hits += run_ahead->inputs[index] == input;
+    }
+    run_ahead->predictions += window;
+    run_ahead->inputs[run_ahead->input_count++ % (RUN_AHEAD_MAX_FRAMES + 1)] = input;
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
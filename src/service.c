@@ -0,0 +1,498 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "service.h"
+#include "emulator.h"
+#include "state.h"
+#include "log.h"
+
+typedef enum RequestState {
+    REQUEST_READY,
+    REQUEST_PENDING,
+    REQUEST_FAILED,
+} RequestState;
+
+static void accept_connection(struct Service* service);
+static void close_connection(struct Connection* connection);
+static RequestState read_request(struct Connection* connection);
+static void serve_request(void* context);
+static ServiceStatus execute_request(struct Connection* connection, struct Session* session,
+                                     struct ServiceResponse* response, struct ServiceStats* stats);
+static bool send_response(int fd, const struct ServiceResponse* response, const void* payload, int shared_fd);
+
+static struct Session* create_session(struct Connection* connection, ServiceStatus* status);
+static void destroy_session(struct Session* session);
+static struct Session* find_session(struct Connection* connection, usize id);
+static ServiceStatus load_session_rom(struct Service* service, struct Session* session, const char* path);
+static void step_session(struct Session* session, usize frames, const byte* inputs, usize length);
+
+static uint64_t thread_cpu_nanoseconds(void);
+
+bool init_service(struct Service* service, const char* path, usize workers) {
+    memset(service, 0, sizeof(struct Service));
+    service->listen_fd = -1;
+    service->wake_fds[0] = service->wake_fds[1] = -1;
+    atomic_init(&service->next_session, 1);
+    atomic_init(&service->stop, false);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        LOG(ERROR, "Socket path '%s' is too long", path);
+        return false;
+    }
+    strcpy(address.sun_path, path);
+
+    // A socket left behind by an earlier run is replaced
+    unlink(path);
+    service->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (service->listen_fd < 0 || bind(service->listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(service->listen_fd, SOMAXCONN) != 0) {
+        LOG(ERROR, "Could not listen on '%s'", path);
+        free_service(service);
+        return false;
+    }
+    service->path = strdup(path);
+
+    // Workers wake the poll loop through this pipe when a connection can be read from again
+    if (pipe(service->wake_fds) != 0) {
+        LOG(ERROR, "Could not create the wake pipe");
+        free_service(service);
+        return false;
+    }
+    fcntl(service->wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(service->wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    init_rom_cache(&service->roms);
+    if (!init_thread_pool(&service->pool, workers)) {
+        free_rom_cache(&service->roms);
+        free_service(service);
+        return false;
+    }
+    LOG(INFO, "Serving on '%s' with %u workers", path, service->pool.workers);
+    return true;
+}
+
+void free_service(struct Service* service) {
+    if (service->pool.threads != NULL) {
+        wait_thread_pool(&service->pool);
+        free_thread_pool(&service->pool);
+        while (service->connections != NULL) {
+            struct Connection* connection = service->connections;
+            service->connections = connection->next;
+            close_connection(connection);
+        }
+        free_rom_cache(&service->roms);
+    }
+    for (usize i = 0; i < 2; i++) {
+        if (service->wake_fds[i] >= 0) {
+            close(service->wake_fds[i]);
+        }
+    }
+    if (service->listen_fd >= 0) {
+        close(service->listen_fd);
+    }
+    if (service->path != NULL) {
+        unlink(service->path);
+        free(service->path);
+    }
+    memset(service, 0, sizeof(struct Service));
+}
+
+void run_service(struct Service* service) {
+    struct pollfd* fds = NULL;
+    struct Connection** polled = NULL;
+    usize capacity = 0;
+
+    while (!atomic_load(&service->stop)) {
+        // Busy connections stay out of the set until their worker has replied
+        usize count = 2;
+        for (struct Connection* connection = service->connections; connection != NULL; connection = connection->next) {
+            count++;
+        }
+        if (count > capacity) {
+            capacity = count * 2;
+            free(fds);
+            free(polled);
+            fds = malloc(capacity * sizeof(struct pollfd));
+            polled = malloc(capacity * sizeof(struct Connection*));
+            if (fds == NULL || polled == NULL) {
+                LOG(ERROR, "Could not allocate the poll set");
+                break;
+            }
+        }
+        fds[0] = (struct pollfd){ .fd = service->listen_fd, .events = POLLIN };
+        fds[1] = (struct pollfd){ .fd = service->wake_fds[0], .events = POLLIN };
+        usize used = 2;
+        for (struct Connection* connection = service->connections; connection != NULL; connection = connection->next) {
+            if (!atomic_load(&connection->busy)) {
+                polled[used] = connection;
+                fds[used++] = (struct pollfd){ .fd = connection->fd, .events = POLLIN };
+            }
+        }
+
+        if (poll(fds, used, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG(ERROR, "Polling client sockets failed");
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            byte drain[64];
+            while (read(service->wake_fds[0], drain, sizeof(drain)) > 0) {
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_connection(service);
+        }
+        for (usize i = 2; i < used; i++) {
+            if (!fds[i].revents) {
+                continue;
+            }
+            struct Connection* connection = polled[i];
+            const RequestState state = read_request(connection);
+            if (state == REQUEST_PENDING) {
+                continue;
+            }
+            if (state == REQUEST_READY) {
+                atomic_store(&connection->busy, true);
+                submit_task(&service->pool, serve_request, connection);
+                continue;
+            }
+            struct Connection** link = &service->connections;
+            while (*link != connection) {
+                link = &(*link)->next;
+            }
+            *link = connection->next;
+            close_connection(connection);
+        }
+    }
+    free(fds);
+    free(polled);
+}
+
+void stop_service(struct Service* service) {
+    // Only touches an atomic and the pipe, so it may be called from a signal handler
+    atomic_store(&service->stop, true);
+    const byte wake = 1;
+    if (write(service->wake_fds[1], &wake, 1) < 0) {
+        return;
+    }
+}
+
+static void accept_connection(struct Service* service) {
+    const int fd = accept(service->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    struct Connection* connection = calloc(1, sizeof(struct Connection));
+    if (connection == NULL) {
+        close(fd);
+        return;
+    }
+    connection->fd = fd;
+    connection->service = service;
+    atomic_init(&connection->busy, false);
+    connection->next = service->connections;
+    service->connections = connection;
+}
+
+static void close_connection(struct Connection* connection) {
+    // Sessions belong to the connection that created them and end with it
+    while (connection->sessions != NULL) {
+        struct Session* session = connection->sessions;
+        connection->sessions = session->next;
+        destroy_session(session);
+    }
+    close(connection->fd);
+    free(connection);
+}
+
+static RequestState read_request(struct Connection* connection) {
+    // Takes whatever has arrived without waiting, so a client sending a request in pieces holds up nobody
+    // else. Only reads are non-blocking; replies are small and sent from the workers.
+    struct ServiceRequest* request = &connection->request;
+    const usize header = sizeof(struct ServiceRequest);
+    while (true) {
+        const bool in_header = connection->received < header;
+        const usize total = in_header ? header : header + request->length;
+        if (connection->received == total) {
+            break;
+        }
+        byte* buffer = in_header ? (byte*)request + connection->received
+                                 : connection->payload + (connection->received - header);
+        const ssize_t count = recv(connection->fd, buffer, total - connection->received, MSG_DONTWAIT);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return REQUEST_PENDING;
+        }
+        if (count <= 0) {
+            return REQUEST_FAILED;
+        }
+        connection->received += (usize)count;
+        if (connection->received == header &&
+            (request->magic != SERVICE_MAGIC || request->length > SERVICE_MAX_PAYLOAD)) {
+            LOG(ERROR, "Dropping a client that sent a malformed request");
+            return REQUEST_FAILED;
+        }
+    }
+    connection->received = 0;
+    connection->payload[request->length] = '\0';
+    return REQUEST_READY;
+}
+
+static void serve_request(void* context) {
+    struct Connection* connection = context;
+    const struct ServiceRequest* request = &connection->request;
+    struct ServiceResponse response = { SERVICE_OK, request->session, 0, 0 };
+    struct ServiceStats stats;
+    ServiceStatus status = SERVICE_OK;
+    int shared_fd = -1;
+
+    // Time spent emulating is charged to the session on this worker's CPU clock
+    const uint64_t start = thread_cpu_nanoseconds();
+    struct Session* session = NULL;
+    if (request->command == SERVICE_CREATE) {
+        session = create_session(connection, &status);
+        if (session != NULL) {
+            response.session = session->id;
+            response.value = session->shared_size;
+            shared_fd = session->shared_fd;
+        }
+    } else if ((session = find_session(connection, request->session)) == NULL) {
+        status = SERVICE_NO_SESSION;
+    } else {
+        status = execute_request(connection, session, &response, &stats);
+        if (request->command == SERVICE_DESTROY) {
+            session = NULL;
+        }
+    }
+    if (session != NULL) {
+        session->stats.requests++;
+        session->stats.cpu_nanoseconds += thread_cpu_nanoseconds() - start;
+    }
+    response.status = status;
+
+    const bool sent = send_response(connection->fd, &response, response.length ? &stats : NULL, shared_fd);
+    if (!sent) {
+        // The poll loop sees the hang-up and closes the connection
+        shutdown(connection->fd, SHUT_RDWR);
+    }
+    atomic_store(&connection->busy, false);
+    const byte wake = 1;
+    if (write(connection->service->wake_fds[1], &wake, 1) < 0) {
+        return;
+    }
+}
+
+static ServiceStatus execute_request(struct Connection* connection, struct Session* session,
+                                     struct ServiceResponse* response, struct ServiceStats* stats) {
+    const struct ServiceRequest* request = &connection->request;
+    struct Emulator* emulator = session->emulator;
+    switch (request->command) {
+        case SERVICE_LOAD:
+            return load_session_rom(connection->service, session, (const char*)connection->payload);
+        case SERVICE_STEP:
+            step_session(session, request->argument, connection->payload, request->length);
+            response->value = request->argument;
+            return is_out_of_memory(emulator) ? SERVICE_OUT_OF_MEMORY : SERVICE_OK;
+        case SERVICE_FRAME:
+            if (request->argument) {
+                memcpy(session->shared + SERVICE_FRAME_OFFSET, get_screen_buffer(&emulator->ppu), SERVICE_FRAME_SIZE);
+                response->value = SERVICE_FRAME_SIZE;
+            } else {
+                memcpy(session->shared + SERVICE_FRAME_OFFSET, emulator->ppu.frame->pixels, SCREEN_SIZE);
+                response->value = SCREEN_SIZE;
+            }
+            return SERVICE_OK;
+        case SERVICE_RAM:
+            read_pages(&emulator->cpu_bus.ram, session->shared + SERVICE_RAM_OFFSET);
+            response->value = RAM_SIZE;
+            return SERVICE_OK;
+        case SERVICE_SAVE:
+            response->value = save_state(emulator, session->shared + SERVICE_STATE_OFFSET,
+                                         session->shared_size - SERVICE_STATE_OFFSET);
+            return response->value ? SERVICE_OK : SERVICE_STATE_ERROR;
+        case SERVICE_RESTORE:
+            if (request->argument > session->shared_size - SERVICE_STATE_OFFSET) {
+                return SERVICE_STATE_ERROR;
+            }
+            memcpy(session->restore, session->shared + SERVICE_STATE_OFFSET, request->argument);
+            return load_state(emulator, session->restore, request->argument) ? SERVICE_OK : SERVICE_STATE_ERROR;
+        case SERVICE_STATS:
+            *stats = session->stats;
+            response->length = sizeof(struct ServiceStats);
+            return SERVICE_OK;
+        case SERVICE_DESTROY: {
+            struct Session** link = &connection->sessions;
+            while (*link != session) {
+                link = &(*link)->next;
+            }
+            *link = session->next;
+            destroy_session(session);
+            return SERVICE_OK;
+        }
+        default:
+            return SERVICE_BAD_REQUEST;
+    }
+}
+
+static bool send_response(int fd, const struct ServiceResponse* response, const void* payload, int shared_fd) {
+    struct iovec parts[2] = {
+        { (void*)response, sizeof(struct ServiceResponse) },
+        { (void*)payload, response->length },
+    };
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = payload != NULL ? 2 : 1;
+
+    // The shared block's descriptor rides along with the reply to CREATE
+    union {
+        struct cmsghdr header;
+        char buffer[CMSG_SPACE(sizeof(int))];
+    } control;
+    if (shared_fd >= 0) {
+        memset(&control, 0, sizeof(control));
+        message.msg_control = control.buffer;
+        message.msg_controllen = sizeof(control.buffer);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(header), &shared_fd, sizeof(int));
+    }
+    const usize total = sizeof(struct ServiceResponse) + (payload != NULL ? response->length : 0);
+    return sendmsg(fd, &message, MSG_NOSIGNAL) == (ssize_t)total;
+}
+
+static struct Session* create_session(struct Connection* connection, ServiceStatus* status) {
+    struct Service* service = connection->service;
+    struct Session* session = calloc(1, sizeof(struct Session));
+    if (session == NULL) {
+        *status = SERVICE_OUT_OF_MEMORY;
+        return NULL;
+    }
+    session->id = atomic_fetch_add(&service->next_session, 1);
+    session->shared_fd = -1;
+    if ((*status = load_session_rom(service, session, (const char*)connection->payload)) != SERVICE_OK) {
+        destroy_session(session);
+        return NULL;
+    }
+
+    // The name only lives long enough to open the block; after that the descriptors are all that refer to it
+    char name[64];
+    snprintf(name, sizeof(name), "/oldnesd-%d-%u", (int)getpid(), session->id);
+    session->shared_size = SERVICE_STATE_OFFSET + get_max_state_size();
+    session->shared_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (session->shared_fd >= 0) {
+        shm_unlink(name);
+    }
+    void* shared = MAP_FAILED;
+    if (session->shared_fd >= 0 && ftruncate(session->shared_fd, session->shared_size) == 0) {
+        shared = mmap(NULL, session->shared_size, PROT_READ | PROT_WRITE, MAP_SHARED, session->shared_fd, 0);
+    }
+    if (shared == MAP_FAILED) {
+        LOG(ERROR, "Could not create shared memory for session %u", session->id);
+        destroy_session(session);
+        *status = SERVICE_OUT_OF_MEMORY;
+        return NULL;
+    }
+    session->shared = shared;
+    if ((session->restore = malloc(get_max_state_size())) == NULL) {
+        destroy_session(session);
+        *status = SERVICE_OUT_OF_MEMORY;
+        return NULL;
+    }
+    session->next = connection->sessions;
+    connection->sessions = session;
+    return session;
+}
+
+static void destroy_session(struct Session* session) {
+    if (session->stats.requests) {
+        LOG(INFO, "Session %u ended after %llu frames and %.3f s of CPU time", session->id,
+            (unsigned long long)session->stats.frames, session->stats.cpu_nanoseconds / 1e9);
+    }
+    if (session->shared != NULL) {
+        munmap(session->shared, session->shared_size);
+    }
+    if (session->shared_fd >= 0) {
+        close(session->shared_fd);
+    }
+    free(session->restore);
+    if (session->emulator != NULL) {
+        free_emulator(session->emulator);
+        free(session->emulator);
+    }
+    free(session);
+}
+
+static struct Session* find_session(struct Connection* connection, usize id) {
+    for (struct Session* session = connection->sessions; session != NULL; session = session->next) {
+        if (session->id == id) {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+static ServiceStatus load_session_rom(struct Service* service, struct Session* session, const char* path) {
+    // Sessions running the same game share one read-only copy of it
+    RomError error;
+    struct RomImage* rom = acquire_rom_image(&service->roms, path, &error);
+    if (rom == NULL) {
+        return SERVICE_ROM_ERROR;
+    }
+    struct Emulator* emulator = calloc(1, sizeof(struct Emulator));
+    if (emulator == NULL) {
+        release_rom_image(rom);
+        return SERVICE_OUT_OF_MEMORY;
+    }
+    const bool loaded = init_emulator(emulator, rom);
+    release_rom_image(rom);
+    if (!loaded) {
+        free(emulator);
+        return SERVICE_ROM_ERROR;
+    }
+
+    // The running game is only replaced once the new one has started, so a bad path leaves the session as it was
+    if (session->emulator != NULL) {
+        free_emulator(session->emulator);
+        free(session->emulator);
+    }
+    session->emulator = emulator;
+    return SERVICE_OK;
+}
+
+static void step_session(struct Session* session, usize frames, const byte* inputs, usize length) {
+    struct CPUBus* bus = &session->emulator->cpu_bus;
+    const usize pairs = length / 2;
+    for (usize frame = 0; frame < frames; frame++) {
+        if (pairs) {
+            const byte* pads = inputs + 2 * (frame < pairs ? frame : pairs - 1);
+            set_controller(&bus->pad1, pads[0]);
+            set_controller(&bus->pad2, pads[1]);
+        }
+        run_frame(session->emulator);
+    }
+    session->stats.frames += frames;
+}
+
+static uint64_t thread_cpu_nanoseconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
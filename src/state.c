@@ -0,0 +1,240 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "state.h"
+#include "emulator.h"
+#include "hash.h"
+#include "log.h"
+
+// Each section is a contiguous run of plain fields that ends where the struct's paged memory and links begin.
+// The framebuffer sits in front of the PPU section and ROM data is only referenced, so neither is copied.
+// Paged memory follows the plain sections, flattened page by page; four-screen VRAM runs 2KB longer.
+// Sections include their structs' padding, which init_emulator zeroes and forks and loads copy
+// byte for byte, so equal machines save and hash equally.
+#define CPU_SECTION_SIZE     offsetof(struct CPU, bus)
+#define PPU_SECTION_OFFSET   offsetof(struct PPU, oam_cache)
+#define PPU_SECTION_SIZE     (offsetof(struct PPU, oam) - PPU_SECTION_OFFSET)
+#define APU_SECTION_SIZE     offsetof(struct APU, blip)
+#define CPU_BUS_SECTION_SIZE offsetof(struct CPUBus, ram)
+#define PPU_BUS_SECTION_SIZE offsetof(struct PPUBus, vram)
+#define MAPPER_SECTION_SIZE  sizeof(struct MapperState)
+#define MEMORY_SECTION_SIZE  (RAM_SIZE + VRAM_SIZE + OAM_SIZE)
+
+#define SECTIONS_SIZE (CPU_SECTION_SIZE + PPU_SECTION_SIZE + APU_SECTION_SIZE + CPU_BUS_SECTION_SIZE + \
+                       PPU_BUS_SECTION_SIZE + MAPPER_SECTION_SIZE + MEMORY_SECTION_SIZE)
+
+static word state_flags(const struct Emulator* emulator);
+static bool check_sections(const byte* sections, word flags);
+static bool is_flag(const bool* field);
+static uint64_t hash_pages(const struct PageTable* table, uint64_t hash);
+
+usize get_state_size(const struct Emulator* emulator) {
+    const word flags = state_flags(emulator);
+    usize size = sizeof(struct StateHeader) + SECTIONS_SIZE;
+    if (flags & STATE_CHR_RAM) {
+        size += get_page_table_size(&emulator->mapper.chr_ram);
+    }
+    if (flags & STATE_PRG_RAM) {
+        size += get_page_table_size(&emulator->cpu_bus.prg_ram);
+    }
+    if (flags & STATE_FOUR_SCREEN) {
+        size += FOUR_SCREEN_VRAM_SIZE - VRAM_SIZE;
+    }
+    return size;
+}
+
+usize get_max_state_size(void) {
+    return sizeof(struct StateHeader) + SECTIONS_SIZE + CHR_RAM_SIZE + PRG_RAM_SIZE + FOUR_SCREEN_VRAM_SIZE - VRAM_SIZE;
+}
+
+usize save_state(const struct Emulator* emulator, byte* buffer, usize capacity) {
+    const usize size = get_state_size(emulator);
+    if (capacity < size) {
+        return 0;
+    }
+
+    const struct StateHeader header = {
+        .magic    = STATE_MAGIC,
+        .version  = STATE_VERSION,
+        .flags    = state_flags(emulator),
+        .size     = size,
+        .sections = SECTIONS_SIZE,
+    };
+    byte* ptr = buffer;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+    memcpy(ptr, &emulator->cpu, CPU_SECTION_SIZE);
+    ptr += CPU_SECTION_SIZE;
+    memcpy(ptr, (const byte*)&emulator->ppu + PPU_SECTION_OFFSET, PPU_SECTION_SIZE);
+    ptr += PPU_SECTION_SIZE;
+    memcpy(ptr, &emulator->apu, APU_SECTION_SIZE);
+    ptr += APU_SECTION_SIZE;
+    memcpy(ptr, &emulator->cpu_bus, CPU_BUS_SECTION_SIZE);
+    ptr += CPU_BUS_SECTION_SIZE;
+    memcpy(ptr, &emulator->ppu_bus, PPU_BUS_SECTION_SIZE);
+    ptr += PPU_BUS_SECTION_SIZE;
+    memcpy(ptr, &emulator->mapper.state, MAPPER_SECTION_SIZE);
+    ptr += MAPPER_SECTION_SIZE;
+    read_pages(&emulator->cpu_bus.ram, ptr);
+    ptr += RAM_SIZE;
+    read_pages(&emulator->ppu_bus.vram, ptr);
+    ptr += get_page_table_size(&emulator->ppu_bus.vram);
+    read_pages(&emulator->ppu.oam, ptr);
+    ptr += OAM_SIZE;
+    if (header.flags & STATE_CHR_RAM) {
+        read_pages(&emulator->mapper.chr_ram, ptr);
+        ptr += get_page_table_size(&emulator->mapper.chr_ram);
+    }
+    if (header.flags & STATE_PRG_RAM) {
+        read_pages(&emulator->cpu_bus.prg_ram, ptr);
+    }
+    return size;
+}
+
+bool load_state(struct Emulator* emulator, const byte* buffer, usize size) {
+    struct StateHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION ||
+        header.sections != SECTIONS_SIZE || header.size > size) {
+        LOG(ERROR, "Save state is not compatible with this build");
+        return false;
+    }
+    // CHR-RAM, PRG-RAM and four-screen VRAM are sized by the cartridge, so a state only loads into an
+    // emulator running the same kind
+    struct PageTable* chr_ram = &emulator->mapper.chr_ram;
+    struct PageTable* prg_ram = &emulator->cpu_bus.prg_ram;
+    struct PageTable* vram = &emulator->ppu_bus.vram;
+    const word sized = STATE_CHR_RAM | STATE_PRG_RAM | STATE_FOUR_SCREEN;
+    const usize expected = sizeof(header) + SECTIONS_SIZE - VRAM_SIZE + get_page_table_size(vram) +
+                           ((header.flags & STATE_CHR_RAM) ? get_page_table_size(chr_ram) : 0) +
+                           ((header.flags & STATE_PRG_RAM) ? get_page_table_size(prg_ram) : 0);
+    if (header.size != expected || (header.flags & sized) != (state_flags(emulator) & sized)) {
+        return false;
+    }
+    if (!check_sections(buffer + sizeof(header), header.flags)) {
+        LOG(ERROR, "Save state is damaged");
+        return false;
+    }
+
+    const byte* ptr = buffer + sizeof(header);
+    memcpy(&emulator->cpu, ptr, CPU_SECTION_SIZE);
+    ptr += CPU_SECTION_SIZE;
+    memcpy((byte*)&emulator->ppu + PPU_SECTION_OFFSET, ptr, PPU_SECTION_SIZE);
+    ptr += PPU_SECTION_SIZE;
+    memcpy(&emulator->apu, ptr, APU_SECTION_SIZE);
+    ptr += APU_SECTION_SIZE;
+    memcpy(&emulator->cpu_bus, ptr, CPU_BUS_SECTION_SIZE);
+    ptr += CPU_BUS_SECTION_SIZE;
+    memcpy(&emulator->ppu_bus, ptr, PPU_BUS_SECTION_SIZE);
+    ptr += PPU_BUS_SECTION_SIZE;
+    memcpy(&emulator->mapper.state, ptr, MAPPER_SECTION_SIZE);
+    ptr += MAPPER_SECTION_SIZE;
+
+    // Only pages that differ from the state are written, so forks keep sharing the rest
+    write_pages(&emulator->cpu_bus.ram, ptr);
+    ptr += RAM_SIZE;
+    write_pages(vram, ptr);
+    ptr += get_page_table_size(vram);
+    write_pages(&emulator->ppu.oam, ptr);
+    ptr += OAM_SIZE;
+
+    struct Mapper* mapper = &emulator->mapper;
+    if (header.flags & STATE_CHR_RAM) {
+        write_pages(chr_ram, ptr);
+        ptr += get_page_table_size(chr_ram);
+    }
+    // Loaded battery RAM reaches the save file at the next frame end
+    if (header.flags & STATE_PRG_RAM) {
+        write_pages(prg_ram, ptr);
+        emulator->cpu_bus.prg_ram_dirty = ~(usize)0;
+    }
+    // Nametable offsets index VRAM, so they are derived from the checked mirroring rather than loaded
+    mapper->restore(mapper);
+    set_mirroring(&emulator->ppu_bus);
+    return true;
+}
+
+uint64_t hash_state(const struct Emulator* emulator) {
+    // Covers exactly what save_state writes, section by section, without building the buffer
+    uint64_t hash = hash64(&emulator->cpu, CPU_SECTION_SIZE, 0);
+    hash = hash64((const byte*)&emulator->ppu + PPU_SECTION_OFFSET, PPU_SECTION_SIZE, hash);
+    hash = hash64(&emulator->apu, APU_SECTION_SIZE, hash);
+    hash = hash64(&emulator->cpu_bus, CPU_BUS_SECTION_SIZE, hash);
+    hash = hash64(&emulator->ppu_bus, PPU_BUS_SECTION_SIZE, hash);
+    hash = hash64(&emulator->mapper.state, MAPPER_SECTION_SIZE, hash);
+    hash = hash_pages(&emulator->cpu_bus.ram, hash);
+    hash = hash_pages(&emulator->ppu_bus.vram, hash);
+    hash = hash_pages(&emulator->ppu.oam, hash);
+    hash = hash_pages(&emulator->mapper.chr_ram, hash);
+    return hash_pages(&emulator->cpu_bus.prg_ram, hash);
+}
+
+struct FrameHash hash_frame(const struct Emulator* emulator) {
+    byte ram[RAM_SIZE];
+    byte vram[FOUR_SCREEN_VRAM_SIZE];
+    read_pages(&emulator->cpu_bus.ram, ram);
+    read_pages(&emulator->ppu_bus.vram, vram);
+    return (struct FrameHash){
+        .screen = hash64_wide(emulator->ppu.frame->pixels, SCREEN_SIZE, 0),
+        .ram    = hash64_wide(ram, RAM_SIZE, 0),
+        .vram   = hash64_wide(vram, get_page_table_size(&emulator->ppu_bus.vram), 0),
+    };
+}
+
+// Fields that index tables or memory, or select between cases, are range checked before anything is loaded.
+// Everything else in the sections takes any value without reaching outside the emulator.
+static bool check_sections(const byte* sections, word flags) {
+    struct PPU ppu;
+    struct APU apu;
+    struct MapperState state;
+    const byte* ptr = sections + CPU_SECTION_SIZE;
+    memcpy((byte*)&ppu + PPU_SECTION_OFFSET, ptr, PPU_SECTION_SIZE);
+    ptr += PPU_SECTION_SIZE;
+    memcpy(&apu, ptr, APU_SECTION_SIZE);
+    ptr += APU_SECTION_SIZE + CPU_BUS_SECTION_SIZE + PPU_BUS_SECTION_SIZE;
+    memcpy(&state, ptr, MAPPER_SECTION_SIZE);
+
+    if (ppu.oam_cache_len > OAM_CACHE_SIZE || ppu.fine_x > 7 ||
+        ppu.scanline > SCANLINE_FRAME_END || ppu.cycle > SCANLINE_CYCLE_END) {
+        return false;
+    }
+    for (usize i = 0; i < ppu.oam_cache_len; i++) {
+        if (ppu.oam_cache[i] % 4 != 0) {
+            return false;
+        }
+    }
+    for (usize i = 0; i < 2; i++) {
+        const struct Pulse* pulse = &apu.pulse[i];
+        if (pulse->index != i || pulse->duty > 3 || pulse->step > 7 || pulse->sweep_shift > 7) {
+            return false;
+        }
+    }
+    if (apu.triangle.step > 31 || apu.noise.period > 15 || apu.dmc.rate > 15 ||
+        apu.dmc.bits < 1 || apu.dmc.bits > 8 || !is_flag(&apu.five_step) || apu.frame_step > (apu.five_step ? 4 : 3)) {
+        return false;
+    }
+    // Four-screen mirroring addresses the cartridge's extra 2KB, which only four-screen states carry
+    return (usize)state.mirroring <= FOUR_SCREEN && (state.mirroring == FOUR_SCREEN) == ((flags & STATE_FOUR_SCREEN) != 0);
+}
+
+static bool is_flag(const bool* field) {
+    // A bool used as an index is checked as the byte that was loaded, which may be neither 0 nor 1
+    byte value;
+    memcpy(&value, field, sizeof(value));
+    return value <= 1;
+}
+
+static uint64_t hash_pages(const struct PageTable* table, uint64_t hash) {
+    for (usize i = 0; i < table->count; i++) {
+        hash = hash64(get_page(table, i), PAGE_SIZE, hash);
+    }
+    return hash;
+}
+
+static word state_flags(const struct Emulator* emulator) {
+    return (emulator->mapper.chr_ram.count ? STATE_CHR_RAM : 0) | (emulator->cpu_bus.prg_ram.count ? STATE_PRG_RAM : 0) |
+           (emulator->ppu_bus.vram.count > VRAM_SIZE / PAGE_SIZE ? STATE_FOUR_SCREEN : 0);
+}
\ No newline at end of file
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+#include "log.h"
+
+typedef struct Worker {
+    struct ThreadPool* pool;
+    usize index;
+} Worker;
+
+static _Thread_local struct Worker* current_worker = NULL;
+
+static void* worker_main(void* argument);
+static void stop_workers(struct ThreadPool* pool, usize started, usize queues);
+static bool find_task(struct ThreadPool* pool, usize index, struct Task* task);
+
+static bool init_queue(struct TaskQueue* queue);
+static void free_queue(struct TaskQueue* queue);
+static bool push_tail(struct TaskQueue* queue, struct Task task);
+static bool pop_tail(struct TaskQueue* queue, struct Task* task);
+static bool pop_head(struct TaskQueue* queue, struct Task* task);
+
+bool init_thread_pool(struct ThreadPool* pool, usize workers) {
+    if (workers == 0) {
+        workers = get_cpu_count();
+    }
+    pool->workers    = workers;
+    pool->next_queue = 0;
+    pool->stop       = false;
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    pool->queues  = calloc(workers, sizeof(struct TaskQueue));
+    pool->threads = calloc(workers, sizeof(pthread_t));
+    if (pool->queues == NULL || pool->threads == NULL) {
+        LOG(ERROR, "Could not allocate thread pool with %u workers", workers);
+        stop_workers(pool, 0, 0);
+        return false;
+    }
+    for (usize i = 0; i < workers; i++) {
+        if (!init_queue(&pool->queues[i])) {
+            LOG(ERROR, "Could not allocate task queue %u", i);
+            stop_workers(pool, 0, i + 1);
+            return false;
+        }
+    }
+    for (usize i = 0; i < workers; i++) {
+        struct Worker* worker = malloc(sizeof(struct Worker));
+        if (worker != NULL) {
+            worker->pool  = pool;
+            worker->index = i;
+        }
+        if (worker == NULL || pthread_create(&pool->threads[i], NULL, worker_main, worker) != 0) {
+            LOG(ERROR, "Could not start worker %u", i);
+            free(worker);
+            stop_workers(pool, i, workers);
+            return false;
+        }
+    }
+    return true;
+}
+
+void free_thread_pool(struct ThreadPool* pool) {
+    wait_thread_pool(pool);
+    stop_workers(pool, pool->workers, pool->workers);
+}
+
+void submit_task(struct ThreadPool* pool, TaskFunction function, void* context) {
+    const struct Task task = { function, context };
+
+    // Workers keep follow-up tasks local and let idle threads steal them
+    usize index;
+    if (current_worker != NULL && current_worker->pool == pool) {
+        index = current_worker->index;
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        index = pool->next_queue++ % pool->workers;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    // A task that cannot be queued runs right here rather than being lost
+    atomic_fetch_add(&pool->pending, 1);
+    if (!push_tail(&pool->queues[index], task)) {
+        function(context);
+        if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_cond_broadcast(&pool->idle);
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void wait_thread_pool(struct ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) != 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+usize get_cpu_count(void) {
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (usize)count : 1;
+}
+
+static void* worker_main(void* argument) {
+    current_worker = argument;
+    struct ThreadPool* pool = current_worker->pool;
+    const usize index = current_worker->index;
+
+    struct Task task;
+    while (true) {
+        if (find_task(pool, index, &task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            task.function(task.context);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->idle);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        while (atomic_load(&pool->queued) == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        const bool stop = pool->stop && atomic_load(&pool->queued) == 0;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            break;
+        }
+    }
+    free(current_worker);
+    current_worker = NULL;
+    return NULL;
+}
+
+static void stop_workers(struct ThreadPool* pool, usize started, usize queues) {
+    // Also unwinds a pool that failed part way through init_thread_pool
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (usize i = 0; i < started; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    for (usize i = 0; i < queues; i++) {
+        free_queue(&pool->queues[i]);
+    }
+    free(pool->threads);
+    free(pool->queues);
+    pool->threads = NULL;
+    pool->queues  = NULL;
+    pthread_cond_destroy(&pool->idle);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+static bool find_task(struct ThreadPool* pool, usize index, struct Task* task) {
+    if (pop_tail(&pool->queues[index], task)) {
+        return true;
+    }
+    for (usize i = 1; i < pool->workers; i++) {
+        if (pop_head(&pool->queues[(index + i) % pool->workers], task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool init_queue(struct TaskQueue* queue) {
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->head = queue->tail = 0;
+    queue->capacity = 64;
+    queue->tasks = malloc(queue->capacity * sizeof(struct Task));
+    return queue->tasks != NULL;
+}
+
+static void free_queue(struct TaskQueue* queue) {
+    free(queue->tasks);
+    pthread_mutex_destroy(&queue->lock);
+}
+
+static bool push_tail(struct TaskQueue* queue, struct Task task) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail == queue->capacity) {
+        // Compact live tasks to the front before growing
+        const usize count = queue->tail - queue->head;
+        if (queue->head > queue->capacity / 2) {
+            memmove(queue->tasks, queue->tasks + queue->head, count * sizeof(struct Task));
+        } else {
+            struct Task* tasks = malloc(queue->capacity * 2 * sizeof(struct Task));
+            if (tasks == NULL) {
+                pthread_mutex_unlock(&queue->lock);
+                return false;
+            }
+            memcpy(tasks, queue->tasks + queue->head, count * sizeof(struct Task));
+            free(queue->tasks);
+            queue->tasks = tasks;
+            queue->capacity *= 2;
+        }
+        queue->head = 0;
+        queue->tail = count;
+    }
+    queue->tasks[queue->tail++] = task;
+    pthread_mutex_unlock(&queue->lock);
+    return true;
+}
+
+static bool pop_tail(struct TaskQueue* queue, struct Task* task) {
+    pthread_mutex_lock(&queue->lock);
+    const bool found = queue->tail > queue->head;
+    if (found) {
+        *task = queue->tasks[--queue->tail];
+        if (queue->head == queue->tail) {
+            queue->head = queue->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool pop_head(struct TaskQueue* queue, struct Task* task) {
+    pthread_mutex_lock(&queue->lock);
+    const bool found = queue->tail > queue->head;
+    if (found) {
+        *task = queue->tasks[queue->head++];
+        if (queue->head == queue->tail) {
+            queue->head = queue->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
\ No newline at end of file
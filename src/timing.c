@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timing.h"
+#include "log.h"
+
+static const char* SECTION_NAMES[] = {
+    [TIMING_INPUT]   = "input",
+    [TIMING_CPU]     = "cpu",
+    [TIMING_PPU]     = "ppu",
+    [TIMING_PRESENT] = "present",
+    [TIMING_PACING]  = "pacing",
+};
+
+static double measure_ticks_per_ms(void);
+static int compare_times(const void* a, const void* b);
+
+bool init_frame_timing(struct FrameTiming* timing, const char* csv_path) {
+    memset(timing, 0, sizeof(struct FrameTiming));
+    timing->ticks_per_ms = measure_ticks_per_ms();
+    if (csv_path != NULL) {
+        timing->csv = fopen(csv_path, "w");
+        if (timing->csv == NULL) {
+            LOG(ERROR, "Could not open '%s' for writing", csv_path);
+            return false;
+        }
+        fprintf(timing->csv, "frame");
+        for (usize i = 0; i < TIMING_SECTIONS; i++) {
+            fprintf(timing->csv, ",%s_ms", SECTION_NAMES[i]);
+        }
+        fprintf(timing->csv, "\n");
+    }
+    return true;
+}
+
+void free_frame_timing(struct FrameTiming* timing) {
+    if (timing->csv != NULL) {
+        fclose(timing->csv);
+    }
+    memset(timing, 0, sizeof(struct FrameTiming));
+}
+
+uint64_t lap_frame_timing(struct FrameTiming* timing, TimingSection section, uint64_t start) {
+    if (timing == NULL) {
+        return 0;
+    }
+    const uint64_t now = read_ticks();
+    timing->current[section] += now - start;
+    return now;
+}
+
+uint64_t lap_emulation_timing(struct FrameTiming* timing, uint64_t start) {
+    if (timing == NULL) {
+        return 0;
+    }
+    // run_frame has already split its own time, whatever else happened around it goes to the CPU.
+    // Emulation runs once per frame, so everything in the two sections so far came from here
+    const uint64_t now = read_ticks();
+    const uint64_t split = timing->current[TIMING_CPU] + timing->current[TIMING_PPU];
+    const uint64_t elapsed = now - start;
+    timing->current[TIMING_CPU] += elapsed > split ? elapsed - split : 0;
+    return now;
+}
+
+void split_frame_timing(struct FrameTiming* timing, uint64_t start) {
+    const uint64_t elapsed = read_ticks() - start;
+    const uint64_t sampled = timing->sampled_cpu + timing->sampled_ppu;
+    const uint64_t ppu = sampled ? (uint64_t)((double)elapsed * timing->sampled_ppu / sampled) : 0;
+    timing->current[TIMING_PPU] += ppu;
+    timing->current[TIMING_CPU] += elapsed - ppu;
+    timing->sampled_cpu = 0;
+    timing->sampled_ppu = 0;
+}
+
+void end_frame_timing(struct FrameTiming* timing) {
+    if (timing == NULL) {
+        return;
+    }
+    memcpy(timing->history[timing->frames % TIMING_HISTORY], timing->current, sizeof(timing->current));
+    if (timing->csv != NULL) {
+        fprintf(timing->csv, "%u", timing->frames);
+        for (usize i = 0; i < TIMING_SECTIONS; i++) {
+            fprintf(timing->csv, ",%.4f", timing->current[i] / timing->ticks_per_ms);
+        }
+        fprintf(timing->csv, "\n");
+    }
+    memset(timing->current, 0, sizeof(timing->current));
+    timing->frames++;
+}
+
+double get_frame_time(const struct FrameTiming* timing, usize frames_ago, TimingSection section) {
+    if (frames_ago >= timing->frames || frames_ago >= TIMING_HISTORY) {
+        return 0.0;
+    }
+    // Passing TIMING_SECTIONS gives the whole frame
+    const uint64_t* frame = timing->history[(timing->frames - 1 - frames_ago) % TIMING_HISTORY];
+    uint64_t ticks = 0;
+    for (usize i = 0; i < TIMING_SECTIONS; i++) {
+        ticks += (section == TIMING_SECTIONS || section == i) ? frame[i] : 0;
+    }
+    return ticks / timing->ticks_per_ms;
+}
+
+double get_timing_percentile(const struct FrameTiming* timing, TimingSection section, double percentile) {
+    const usize count = timing->frames < TIMING_HISTORY ? timing->frames : TIMING_HISTORY;
+    if (count == 0) {
+        return 0.0;
+    }
+    double times[TIMING_HISTORY];
+    for (usize i = 0; i < count; i++) {
+        times[i] = get_frame_time(timing, i, section);
+    }
+    qsort(times, count, sizeof(double), compare_times);
+    const usize index = (usize)(percentile / 100.0 * (count - 1) + 0.5);
+    return times[index < count ? index : count - 1];
+}
+
+void report_frame_timing(const struct FrameTiming* timing, FILE* out) {
+    if (timing->frames == 0) {
+        return;
+    }
+    const usize count = timing->frames < TIMING_HISTORY ? timing->frames : TIMING_HISTORY;
+    fprintf(out, "timing: last %u of %u frames, milliseconds per frame\n", count, timing->frames);
+    fprintf(out, "  %-8s %8s %8s %8s\n", "section", "p50", "p99", "max");
+    for (usize i = 0; i <= TIMING_SECTIONS; i++) {
+        fprintf(out, "  %-8s %8.3f %8.3f %8.3f\n", timing_section_string(i),
+                get_timing_percentile(timing, i, 50.0),
+                get_timing_percentile(timing, i, 99.0),
+                get_timing_percentile(timing, i, 100.0));
+    }
+}
+
+const char* timing_section_string(TimingSection section) {
+    return section < TIMING_SECTIONS ? SECTION_NAMES[section] : "frame";
+}
+
+static double measure_ticks_per_ms(void) {
+    // Ticks are nanoseconds unless they come from the time stamp counter, which has to be
+    // measured against the monotonic clock; 10ms is enough for well under 1% error
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const uint64_t first = read_ticks();
+    double elapsed_ms;
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_nsec - start.tv_nsec) / 1e6;
+    } while (elapsed_ms < 10.0);
+    return (read_ticks() - first) / elapsed_ms;
+#else
+    return 1e6;
+#endif
+}
+
+static int compare_times(const void* a, const void* b) {
+    const double left = *(const double*)a;
+    const double right = *(const double*)b;
+    return (left > right) - (left < right);
+}
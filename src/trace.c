@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "cpu_opcodes.h"
+#include "emulator.h"
+#include "log.h"
+
+#define TRACE_DOT_MASK   ((1u << TRACE_DOT_BITS) - 1)
+#define TRACE_CYCLE_MASK ((1u << TRACE_CYCLE_BITS) - 1)
+
+static const int CRASH_SIGNALS[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+static struct TraceRing* crash_ring;
+static const char* crash_path;
+
+static void write_crash_dump(int number);
+static bool write_all(int fd, const void* data, usize size);
+
+struct TraceRing* create_trace_ring(usize records) {
+    usize size = 1;
+    while (size < records) {
+        size <<= 1;
+    }
+    struct TraceRing* ring = calloc(1, sizeof(struct TraceRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->records = malloc(size * sizeof(struct TraceRecord));
+    if (ring->records == NULL) {
+        LOG(ERROR, "Could not allocate %u trace records", size);
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    return ring;
+}
+
+void free_trace_ring(struct TraceRing* ring) {
+    if (ring == NULL) {
+        return;
+    }
+    if (crash_ring == ring) {
+        crash_ring = NULL;
+    }
+    free(ring->records);
+    free(ring);
+}
+
+void trace_instruction(struct TraceRing* ring, const struct CPU* cpu, word pc, byte opcode) {
+    const struct PPU* ppu = &cpu->bus->emulator->ppu;
+    // execute_cpu has already counted the cycle the instruction starts on
+    const uint64_t cycle = cpu->cycles - 1;
+    struct TraceRecord* record = &ring->records[ring->count++ & ring->mask];
+    record->pc = pc;
+    record->opcode = opcode;
+    record->operands[0] = peek_cpu_memory(cpu->bus, pc + 1);
+    record->operands[1] = peek_cpu_memory(cpu->bus, pc + 2);
+    record->a = cpu->a;
+    record->x = cpu->x;
+    record->y = cpu->y;
+    record->p = cpu->status.value;
+    record->sp = cpu->sp;
+    record->scanline = ppu->scanline;
+    record->cycle_dot = (uint32_t)(cycle << TRACE_DOT_BITS) | (ppu->cycle & TRACE_DOT_MASK);
+    ring->last_cycle = cycle;
+}
+
+bool save_trace(const struct TraceRing* ring, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", path);
+        return false;
+    }
+    // Oldest record first; once the ring has wrapped that is the one about to be overwritten
+    const usize size = ring->mask + 1;
+    const usize count = ring->count < size ? ring->count : size;
+    const usize start = ring->count < size ? 0 : ring->count & ring->mask;
+    const struct TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, count, ring->last_cycle };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && fwrite(ring->records + start, sizeof(struct TraceRecord), count - start, file) == count - start;
+    written = written && fwrite(ring->records, sizeof(struct TraceRecord), start, file) == start;
+    fclose(file);
+    if (!written) {
+        LOG(ERROR, "Could not write trace '%s'", path);
+    }
+    return written;
+}
+
+void dump_trace_on_crash(struct TraceRing* ring, const char* path) {
+    crash_ring = ring;
+    crash_path = path;
+    for (usize i = 0; i < sizeof(CRASH_SIGNALS) / sizeof(CRASH_SIGNALS[0]); i++) {
+        signal(CRASH_SIGNALS[i], write_crash_dump);
+    }
+}
+
+bool load_trace(const char* path, struct TraceHeader* header, struct TraceRecord** records) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        LOG(ERROR, "File '%s' is not found.", path);
+        return false;
+    }
+    *records = NULL;
+    // Dumps come off disk after a crash, so the record count is held to what the file can contain
+    // before it sizes an allocation
+    struct stat st;
+    bool loaded = fstat(fileno(file), &st) == 0 && (uint64_t)st.st_size >= sizeof(struct TraceHeader) &&
+                  fread(header, sizeof(struct TraceHeader), 1, file) == 1 &&
+                  header->magic == TRACE_MAGIC && header->version == TRACE_VERSION &&
+                  header->records <= ((uint64_t)st.st_size - sizeof(struct TraceHeader)) / sizeof(struct TraceRecord);
+    if (loaded) {
+        *records = malloc((header->records ? header->records : 1) * sizeof(struct TraceRecord));
+        loaded = *records != NULL &&
+                 fread(*records, sizeof(struct TraceRecord), header->records, file) == header->records;
+    }
+    fclose(file);
+    if (!loaded) {
+        LOG(ERROR, "'%s' is not a trace this build can read", path);
+        free(*records);
+        *records = NULL;
+    }
+    return loaded;
+}
+
+void unwrap_trace_cycles(const struct TraceRecord* records, usize count, uint64_t last_cycle, uint64_t* cycles) {
+    // Instructions are at most a few hundred cycles apart, so the truncated counts step back unambiguously
+    if (count == 0) {
+        return;
+    }
+    cycles[count - 1] = last_cycle;
+    for (usize i = count - 1; i > 0; i--) {
+        const uint32_t later = records[i].cycle_dot >> TRACE_DOT_BITS;
+        const uint32_t earlier = records[i - 1].cycle_dot >> TRACE_DOT_BITS;
+        cycles[i - 1] = cycles[i] - ((later - earlier) & TRACE_CYCLE_MASK);
+    }
+}
+
+void format_trace_record(char* out, usize size, const struct TraceRecord* record, uint64_t cycle) {
+    // Same columns as nestest.log, less the memory contents it prints after some operands
+    const byte bytes[3] = { record->opcode, record->operands[0], record->operands[1] };
+    static const char* const HEX_FORMATS[] = { "%02X", "%02X %02X", "%02X %02X %02X" };
+    char hex[9];
+    char text[32];
+    snprintf(hex, sizeof(hex), HEX_FORMATS[OPERAND_SIZES[INSTRUCTIONS[record->opcode].address_mode]],
+             bytes[0], bytes[1], bytes[2]);
+    disassemble(text, sizeof(text), record->pc, bytes);
+    snprintf(out, size, "%04X  %-8s  %-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%llu",
+             record->pc, hex, text, record->a, record->x, record->y, record->p, record->sp,
+             record->scanline, record->cycle_dot & TRACE_DOT_MASK, (unsigned long long)cycle);
+}
+
+static void write_crash_dump(int number) {
+    // Only async-signal-safe calls from here on
+    const struct TraceRing* ring = crash_ring;
+    if (ring != NULL) {
+        const int fd = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            const usize size = ring->mask + 1;
+            const usize count = ring->count < size ? ring->count : size;
+            const usize start = ring->count < size ? 0 : ring->count & ring->mask;
+            const struct TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, count, ring->last_cycle };
+            if (write_all(fd, &header, sizeof(header)) &&
+                write_all(fd, ring->records + start, (count - start) * sizeof(struct TraceRecord))) {
+                write_all(fd, ring->records, start * sizeof(struct TraceRecord));
+            }
+            close(fd);
+        }
+    }
+    signal(number, SIG_DFL);
+    raise(number);
+}
+
+static bool write_all(int fd, const void* data, usize size) {
+    const byte* bytes = data;
+    while (size > 0) {
+        const ssize_t written = write(fd, bytes, size);
+        if (written <= 0) {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
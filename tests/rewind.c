@@ -0,0 +1,139 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "oldnes.h"
+#include "rewind.h"
+#include "log.h"
+
+#define FRAMES 400
+
+// NROM program that scatters increments over RAM and every 256 of them rewrites CHR-RAM with a random
+// number of non-zero pages, so keyframes range from one to nine kilobytes and deltas vary as widely.
+// The history then wraps at odd offsets with entries from the previous lap still in its tail.
+static const byte PROGRAM[] = {
+    0x78,             // C000 SEI
+    0xa9, 0x01,       // C001 LDA #$01
+    0x85, 0x00,       // C003 STA $00
+    0xa5, 0x00,       // C005 LDA $00
+    0x0a,             // C007 ASL A
+    0x90, 0x02,       // C008 BCC $C00C
+    0x49, 0x1d,       // C00A EOR #$1D
+    0x85, 0x00,       // C00C STA $00
+    0xaa,             // C00E TAX
+    0xfe, 0x00, 0x03, // C00F INC $0300,X
+    0xe6, 0x01,       // C012 INC $01
+    0xd0, 0xef,       // C014 BNE $C005
+    0xa9, 0x00,       // C016 LDA #$00
+    0x8d, 0x06, 0x20, // C018 STA $2006
+    0x8d, 0x06, 0x20, // C01B STA $2006
+    0xa5, 0x00,       // C01E LDA $00
+    0x29, 0x1f,       // C020 AND #$1F
+    0xaa,             // C022 TAX
+    0xe8,             // C023 INX
+    0xa0, 0x00,       // C024 LDY #$00
+    0xc8,             // C026 INY
+    0x8c, 0x07, 0x20, // C027 STY $2007
+    0xd0, 0xfa,       // C02A BNE $C026
+    0xca,             // C02C DEX
+    0xd0, 0xf7,       // C02D BNE $C026
+    0xa5, 0x00,       // C02F LDA $00
+    0x29, 0x1f,       // C031 AND #$1F
+    0x49, 0x1f,       // C033 EOR #$1F
+    0xf0, 0x0c,       // C035 BEQ $C043
+    0xaa,             // C037 TAX
+    0xa9, 0x00,       // C038 LDA #$00
+    0x8d, 0x07, 0x20, // C03A STA $2007
+    0xc8,             // C03D INY
+    0xd0, 0xfa,       // C03E BNE $C03A
+    0xca,             // C040 DEX
+    0xd0, 0xf7,       // C041 BNE $C03A
+    0x4c, 0x05, 0xc0, // C043 JMP $C005
+    0x40,             // C046 RTI
+};
+
+static byte* build_rom(usize* size) {
+    *size = 16 + 0x4000;
+    byte* rom = calloc(*size, 1);
+    if (rom == NULL) {
+        return NULL;
+    }
+    memcpy(rom, "NES\x1a\x01\x00", 6);
+    byte* prg = rom + 16;
+    memcpy(prg, PROGRAM, sizeof(PROGRAM));
+    const byte vectors[] = { 0x46, 0xc0, 0x00, 0xc0, 0x46, 0xc0 };
+    memcpy(prg + 0x3ffa, vectors, sizeof(vectors));
+    return rom;
+}
+
+// Captures while running, rewinds part of the way, captures again, then rewinds through everything
+// left and checks that each restore is the state captured on that frame
+static bool check_round_trip(const byte* rom, usize rom_size, usize budget_states, usize interval) {
+    struct Emulator* emulator = oldnes_create();
+    if (emulator == NULL || !oldnes_load_rom(emulator, rom, rom_size)) {
+        oldnes_destroy(emulator);
+        return false;
+    }
+    const usize state_size = oldnes_state_size(emulator);
+    byte* states = malloc((usize)FRAMES * 2 * state_size);
+    byte* restored = malloc(state_size);
+    struct RewindBuffer rewind;
+    if (states == NULL || restored == NULL || !init_rewind(&rewind, budget_states * state_size, interval)) {
+        free(states);
+        free(restored);
+        oldnes_destroy(emulator);
+        return false;
+    }
+
+    bool ok = true;
+    usize depth = 0;
+    usize rewound = 0;
+    for (usize pass = 0; pass < 2 && ok; pass++) {
+        for (usize frame = 0; frame < FRAMES; frame++) {
+            oldnes_run_frame(emulator);
+            capture_rewind(&rewind, emulator);
+            oldnes_save_state(emulator, states + depth++ * state_size, state_size);
+        }
+        const usize steps = pass == 0 ? FRAMES / 3 : depth;
+        for (usize i = 0; i < steps && rewind_emulator(&rewind, emulator); i++, rewound++) {
+            oldnes_save_state(emulator, restored, state_size);
+            if (memcmp(restored, states + --depth * state_size, state_size) != 0) {
+                PRINTF("budget %u states, interval %u: restore %u does not match its capture\n",
+                       budget_states, interval, rewound);
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (ok && rewound == 0) {
+        PRINTF("budget %u states, interval %u: nothing could be rewound\n", budget_states, interval);
+        ok = false;
+    }
+
+    free_rewind(&rewind);
+    free(states);
+    free(restored);
+    oldnes_destroy(emulator);
+    return ok;
+}
+
+int main(void) {
+    usize rom_size;
+    byte* rom = build_rom(&rom_size);
+    if (rom == NULL) {
+        return EXIT_FAILURE;
+    }
+    const usize budgets[] = { 3, 5, 10, 40 };
+    const usize intervals[] = { 1, 2, 4, 8, 60 };
+    usize failures = 0;
+    for (usize i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+        for (usize j = 0; j < sizeof(intervals) / sizeof(intervals[0]); j++) {
+            failures += !check_round_trip(rom, rom_size, budgets[i], intervals[j]);
+        }
+    }
+    free(rom);
+    if (failures != 0) {
+        PRINTF("%u rewind round trips failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
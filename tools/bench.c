@@ -0,0 +1,363 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator.h"
+#include "cpu_opcodes.h"
+#include "log.h"
+
+#define PRG_SIZE 0x4000
+#define CHR_SIZE 0x2000
+#define ROM_SIZE (16 + PRG_SIZE + CHR_SIZE)
+
+#define DEFAULT_CYCLES 2000000
+#define DEFAULT_FRAMES 600
+#define BUS_ACCESSES   4000000
+
+#define SCRATCH_POINTER 0x10
+#define SCRATCH_ZPG     0x80
+#define SCRATCH_ABS     0x0200
+
+typedef struct BenchResult {
+    char name[64];
+    double seconds;
+    usize iterations;
+    double cycles;
+    double frames;
+} BenchResult;
+
+typedef struct Bench {
+    const char* filter;
+    usize cycles;
+    usize frames;
+    struct BenchResult* results;
+    usize count;
+} Bench;
+
+static void usage(const char* program) {
+    PRINTF("Usage: %s [--cycles=N] [--frames=N] [--filter=text] [--output=file] [rom...]\n", program);
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static bool wanted(const struct Bench* bench, const char* name) {
+    return bench->filter == NULL || strstr(name, bench->filter) != NULL;
+}
+
+static struct BenchResult* add_result(struct Bench* bench, const char* name) {
+    bench->results = realloc(bench->results, (bench->count + 1) * sizeof(struct BenchResult));
+    struct BenchResult* result = &bench->results[bench->count++];
+    memset(result, 0, sizeof(struct BenchResult));
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    return result;
+}
+
+// NROM image with the program at $8000, every vector pointing at the given handlers and a noisy CHR-ROM
+static struct RomImage* build_rom(const byte* program, usize size, word reset, word nmi) {
+    byte* data = calloc(1, ROM_SIZE);
+    memcpy(data, "NES\x1a", 4);
+    data[4] = PRG_SIZE / 0x4000;
+    data[5] = CHR_SIZE / 0x2000;
+
+    byte* prg = data + 16;
+    memcpy(prg, program, size);
+    prg[0x3ffa] = nmi & 0xff;
+    prg[0x3ffb] = nmi >> 8;
+    prg[0x3ffc] = reset & 0xff;
+    prg[0x3ffd] = reset >> 8;
+    prg[0x3ffe] = reset & 0xff;
+    prg[0x3fff] = reset >> 8;
+
+    usize seed = 0x2545f491;
+    byte* chr = prg + PRG_SIZE;
+    for (usize i = 0; i < CHR_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        chr[i] = (byte)(seed >> 16);
+    }
+
+    RomError error;
+    struct RomImage* rom = create_rom_image(data, ROM_SIZE, &error);
+    free(data);
+    return rom;
+}
+
+static bool start_emulator(struct Emulator* emulator, struct RomImage* rom) {
+    memset(emulator, 0, sizeof(struct Emulator));
+    const bool loaded = rom != NULL && init_emulator(emulator, rom);
+    release_rom_image(rom);
+    return loaded;
+}
+
+static bool benchmarkable(const struct Instruction* instr) {
+    // Control flow and stack frames would leave the repeated block
+    switch (instr->operation) {
+        case XXX:
+        case BRK:
+        case JMP:
+        case JSR:
+        case RTI:
+        case RTS:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static void bench_opcode(struct Bench* bench, const struct Instruction* instr) {
+    char name[64];
+    snprintf(name, sizeof(name), "cpu/%02x_%s_%s", instr->opcode,
+             OPERATION_NAMES[instr->operation], ADDRESS_MODE_NAMES[instr->address_mode]);
+    if (!wanted(bench, name)) {
+        return;
+    }
+
+    // The instruction repeated back to back, then a jump to the top. Operands keep every access in RAM.
+    byte program[PRG_SIZE];
+    const byte length = 1 + OPERAND_SIZES[instr->address_mode];
+    usize size = 0;
+    while (size + length + 3 < PRG_SIZE - 0x100) {
+        program[size++] = instr->opcode;
+        switch (instr->address_mode) {
+            case ZPG:
+            case ZPX:
+            case ZPY:
+                program[size++] = SCRATCH_ZPG;
+                break;
+            case IDX:
+            case IDY:
+                program[size++] = SCRATCH_POINTER;
+                break;
+            case ABS:
+            case ABX:
+            case ABY:
+                program[size++] = SCRATCH_ABS & 0xff;
+                program[size++] = SCRATCH_ABS >> 8;
+                break;
+            case IMM:
+            case REL:
+                program[size++] = 0x00;
+                break;
+            default:
+                break;
+        }
+    }
+    program[size++] = 0x4c;
+    program[size++] = 0x00;
+    program[size++] = 0x80;
+
+    static struct Emulator emulator;
+    if (!start_emulator(&emulator, build_rom(program, size, 0x8000, 0x8000))) {
+        return;
+    }
+    write_cpu_memory(&emulator.cpu_bus, SCRATCH_POINTER, SCRATCH_ABS & 0xff);
+    write_cpu_memory(&emulator.cpu_bus, SCRATCH_POINTER + 1, SCRATCH_ABS >> 8);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (usize i = 0; i < bench->cycles; i++) {
+        execute_cpu(&emulator.cpu);
+    }
+    struct BenchResult* result = add_result(bench, name);
+    result->seconds = elapsed_seconds(&start);
+    result->cycles = bench->cycles;
+    result->iterations = bench->cycles / instr->cycles;
+    free_emulator(&emulator);
+}
+
+static void bench_bus(struct Bench* bench) {
+    static const byte program[] = { 0x4c, 0x00, 0x80 };
+    static struct Emulator emulator;
+    if (!start_emulator(&emulator, build_rom(program, sizeof(program), 0x8000, 0x8000))) {
+        return;
+    }
+    struct CPUBus* cpu_bus = &emulator.cpu_bus;
+    struct PPUBus* ppu_bus = &emulator.ppu_bus;
+    struct timespec start;
+    volatile byte sink = 0;
+
+    #define BUS_BENCH(label, body)                               \
+        if (wanted(bench, label)) {                              \
+            clock_gettime(CLOCK_MONOTONIC, &start);              \
+            for (usize i = 0; i < BUS_ACCESSES; i++) {           \
+                body;                                            \
+            }                                                    \
+            struct BenchResult* result = add_result(bench, label); \
+            result->seconds = elapsed_seconds(&start);           \
+            result->iterations = BUS_ACCESSES;                   \
+        }
+    BUS_BENCH("bus/cpu_read_ram", sink += read_cpu_memory(cpu_bus, i & 0x1fff))
+    BUS_BENCH("bus/cpu_write_ram", write_cpu_memory(cpu_bus, i & 0x1fff, (byte)i))
+    BUS_BENCH("bus/cpu_read_prg", sink += read_cpu_memory(cpu_bus, 0x8000 | (i & 0x7fff)))
+    BUS_BENCH("bus/cpu_read_ppustat", sink += read_cpu_memory(cpu_bus, PPUSTAT))
+    BUS_BENCH("bus/ppu_read_chr", sink += read_ppu_memory(ppu_bus, i & 0x1fff))
+    BUS_BENCH("bus/ppu_read_nametable", sink += read_ppu_memory(ppu_bus, 0x2000 | (i & 0xfff)))
+    BUS_BENCH("bus/ppu_write_nametable", write_ppu_memory(ppu_bus, 0x2000 | (i & 0xfff), (byte)i))
+    #undef BUS_BENCH
+    (void)sink;
+    free_emulator(&emulator);
+}
+
+static void bench_ppu(struct Bench* bench) {
+    if (!wanted(bench, "ppu/render_frame")) {
+        return;
+    }
+    static const byte program[] = { 0x4c, 0x00, 0x80 };
+    static struct Emulator emulator;
+    if (!start_emulator(&emulator, build_rom(program, sizeof(program), 0x8000, 0x8000))) {
+        return;
+    }
+
+    // Every tile, attribute, palette entry and sprite gets something to draw
+    struct PPU* ppu = &emulator.ppu;
+    for (word address = 0x2000; address < 0x3000; address++) {
+        write_ppu_memory(ppu->bus, address, (byte)(address * 7));
+    }
+    for (word address = 0x3f00; address < 0x3f20; address++) {
+        write_ppu_memory(ppu->bus, address, (byte)(address & 0x3f));
+    }
+    for (word i = 0; i < 64; i++) {
+        write_oam(ppu, (byte)(i * 3 + 8));
+        write_oam(ppu, (byte)i);
+        write_oam(ppu, (byte)(i & 0xe3));
+        write_oam(ppu, (byte)(i * 4));
+    }
+    set_mask(ppu, 0x1e);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (usize frame = 0; frame < bench->frames; frame++) {
+        ppu->render = false;
+        while (!ppu->render) {
+            execute_ppu(ppu);
+        }
+    }
+    struct BenchResult* result = add_result(bench, "ppu/render_frame");
+    result->seconds = elapsed_seconds(&start);
+    result->frames = bench->frames;
+    result->iterations = bench->frames;
+    free_emulator(&emulator);
+}
+
+static void run_system(struct Bench* bench, const char* name, struct RomImage* rom) {
+    static struct Emulator emulator;
+    if (!start_emulator(&emulator, rom)) {
+        return;
+    }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const uint64_t cycles = emulator.cpu.cycles;
+    for (usize frame = 0; frame < bench->frames; frame++) {
+        run_frame(&emulator);
+    }
+    struct BenchResult* result = add_result(bench, name);
+    result->seconds = elapsed_seconds(&start);
+    result->frames = bench->frames;
+    result->cycles = emulator.cpu.cycles - cycles;
+    result->iterations = bench->frames;
+    free_emulator(&emulator);
+}
+
+static void bench_system(struct Bench* bench) {
+    if (!wanted(bench, "system/synthetic")) {
+        return;
+    }
+    // Rendering on, NMI bumps a counter into the scroll registers while the main loop spins
+    static const byte program[] = {
+        0xa9, 0x80,       // $8000 LDA #$80
+        0x8d, 0x00, 0x20, //       STA $2000
+        0xa9, 0x1e,       //       LDA #$1e
+        0x8d, 0x01, 0x20, //       STA $2001
+        0xe6, 0x01,       // $800a INC $01
+        0x4c, 0x0a, 0x80, //       JMP $800a
+        0xe6, 0x00,       // $800f INC $00 (NMI)
+        0xa5, 0x00,       //       LDA $00
+        0x8d, 0x05, 0x20, //       STA $2005
+        0x8d, 0x05, 0x20, //       STA $2005
+        0x40,             //       RTI
+    };
+    run_system(bench, "system/synthetic", build_rom(program, sizeof(program), 0x8000, 0x800f));
+}
+
+static void write_json(const struct Bench* bench, FILE* out) {
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (usize i = 0; i < bench->count; i++) {
+        const struct BenchResult* result = &bench->results[i];
+        const double seconds = result->seconds > 0 ? result->seconds : 1e-12;
+        fprintf(out, "    {\"name\": \"%s\", \"iterations\": %u, \"seconds\": %.6f, \"ns_per_op\": %.3f",
+                result->name, result->iterations, result->seconds, seconds * 1e9 / result->iterations);
+        if (result->cycles > 0) {
+            fprintf(out, ", \"cycles_per_sec\": %.0f", result->cycles / seconds);
+        }
+        if (result->frames > 0) {
+            fprintf(out, ", \"frames_per_sec\": %.2f, \"ns_per_frame\": %.0f",
+                    result->frames / seconds, seconds * 1e9 / result->frames);
+        }
+        fprintf(out, "}%s\n", i + 1 < bench->count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char* argv[]) {
+    struct Bench bench = { NULL, DEFAULT_CYCLES, DEFAULT_FRAMES, NULL, 0 };
+    const char* output = "oldnes_bench.json";
+    const char** roms = calloc(argc, sizeof(const char*));
+    usize rom_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--cycles=", 9) == 0) {
+            bench.cycles = strtoul(argv[i] + 9, NULL, 10);
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            bench.frames = strtoul(argv[i] + 9, NULL, 10);
+        } else if (strncmp(argv[i], "--filter=", 9) == 0) {
+            bench.filter = argv[i] + 9;
+        } else if (strncmp(argv[i], "--output=", 9) == 0) {
+            output = argv[i] + 9;
+        } else if (argv[i][0] != '-') {
+            roms[rom_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            free(roms);
+            return EXIT_FAILURE;
+        }
+    }
+
+    for (usize opcode = 0; opcode < 0x100; opcode++) {
+        if (benchmarkable(&INSTRUCTIONS[opcode])) {
+            bench_opcode(&bench, &INSTRUCTIONS[opcode]);
+        }
+    }
+    bench_bus(&bench);
+    bench_ppu(&bench);
+    bench_system(&bench);
+    for (usize i = 0; i < rom_count; i++) {
+        char name[64];
+        const char* base = strrchr(roms[i], '/');
+        snprintf(name, sizeof(name), "system/%s", base ? base + 1 : roms[i]);
+        RomError error;
+        struct RomImage* rom = load_rom_image(roms[i], &error);
+        if (rom != NULL && wanted(&bench, name)) {
+            run_system(&bench, name, rom);
+        } else {
+            release_rom_image(rom);
+        }
+    }
+    free(roms);
+
+    FILE* out = strcmp(output, "-") == 0 ? stdout : fopen(output, "w");
+    if (out == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", output);
+        free(bench.results);
+        return EXIT_FAILURE;
+    }
+    write_json(&bench, out);
+    if (out != stdout) {
+        fclose(out);
+        PRINTF("%u benchmarks written to %s\n", bench.count, output);
+    }
+    free(bench.results);
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "service.h"
+#include "log.h"
+
+static struct Service service;
+
+static void usage(const char* program) {
+    PRINTF("Usage: %s [--threads=N] <socket path>\n", program);
+}
+
+static void handle_signal(int number) {
+    (void)number;
+    stop_service(&service);
+}
+
+int main(int argc, char* argv[]) {
+    usize threads = 0;
+    const char* socket_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = strtoul(argv[i] + 10, NULL, 10);
+        } else if (argv[i][0] != '-' && socket_path == NULL) {
+            socket_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (socket_path == NULL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!init_service(&service, socket_path, threads)) {
+        return EXIT_FAILURE;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    run_service(&service);
+    free_service(&service);
+    return 0;
+}
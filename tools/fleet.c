@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fleet.h"
+#include "log.h"
+
+static void usage(const char* program) {
+    PRINTF("Usage: %s [--threads=N] [--slice=N] <fleet config>\n", program);
+    PRINTF("       %s [--threads=N] [--slice=N] --instances=M --frames=N <rom> [input script]\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    usize threads   = 0;
+    usize slice     = 0;
+    usize instances = 0;
+    usize frames    = 0;
+    const char* positional[2] = { NULL, NULL };
+    usize positional_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = strtoul(argv[i] + 10, NULL, 10);
+        } else if (strncmp(argv[i], "--slice=", 8) == 0) {
+            slice = strtoul(argv[i] + 8, NULL, 10);
+        } else if (strncmp(argv[i], "--instances=", 12) == 0) {
+            instances = strtoul(argv[i] + 12, NULL, 10);
+        } else if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = strtoul(argv[i] + 9, NULL, 10);
+        } else if (argv[i][0] != '-' && positional_count < 2) {
+            positional[positional_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (positional_count == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Fleet fleet;
+    if (!init_fleet(&fleet, threads, slice)) {
+        return EXIT_FAILURE;
+    }
+    bool loaded = true;
+    if (instances) {
+        for (usize i = 0; i < instances && loaded; i++) {
+            loaded = add_fleet_instance(&fleet, positional[0], frames, positional[1]);
+        }
+    } else {
+        loaded = load_fleet_config(&fleet, positional[0]);
+    }
+    if (!loaded) {
+        free_fleet(&fleet);
+        return EXIT_FAILURE;
+    }
+
+    run_fleet(&fleet);
+    report_fleet(&fleet, stdout);
+    free_fleet(&fleet);
+    return 0;
+}
\ No newline at end of file
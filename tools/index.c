@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rom_index.h"
+#include "log.h"
+
+static void usage(const char* program) {
+    PRINTF("Usage: %s [--threads=N] [--fixes=file] [--list] <index file> [rom directory]\n", program);
+}
+
+int main(int argc, char* argv[]) {
+    usize threads = 0;
+    const char* fixes_path = NULL;
+    bool list = false;
+    const char* positional[2] = { NULL, NULL };
+    usize positional_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = strtoul(argv[i] + 10, NULL, 10);
+        } else if (strncmp(argv[i], "--fixes=", 8) == 0) {
+            fixes_path = argv[i] + 8;
+        } else if (strcmp(argv[i], "--list") == 0) {
+            list = true;
+        } else if (argv[i][0] != '-' && positional_count < 2) {
+            positional[positional_count++] = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (positional_count == 0 || (positional[1] == NULL && !list)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (positional[1] != NULL) {
+        struct RomFix* fixes = NULL;
+        usize fix_count = 0;
+        if (fixes_path != NULL && !load_rom_fixes(fixes_path, &fixes, &fix_count)) {
+            return EXIT_FAILURE;
+        }
+        struct RomIndexStats stats;
+        const bool updated = update_rom_index(positional[0], positional[1], fixes, fix_count, threads, &stats);
+        free(fixes);
+        if (!updated) {
+            return EXIT_FAILURE;
+        }
+        PRINTF("%u files: %u unchanged, %u hashed (%.1f MB), %u with header fixes, %u not playable, in %.3f s\n",
+               stats.files, stats.reused, stats.hashed, stats.bytes / 1e6, stats.fixed, stats.unsupported,
+               stats.seconds);
+    }
+
+    if (list) {
+        struct RomIndex index;
+        if (!open_rom_index(&index, positional[0])) {
+            LOG(ERROR, "Could not open ROM index '%s'", positional[0]);
+            return EXIT_FAILURE;
+        }
+        report_rom_index(&index, stdout);
+        close_rom_index(&index);
+    }
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "emulator.h"
+#include "movie.h"
+#include "state.h"
+#include "profiler.h"
+#include "bus_stats.h"
+#include "trace.h"
+#include "capture.h"
+#include "log.h"
+
+static void usage(const char* program) {
+    PRINTF("Usage: %s [--frames=N] [--movie=file] [--hash-frames=file] [--bus-stats=file] [--trace=file]\n"
+           "       [--dump-video=file.y4m] [--dump-audio=file.wav] [--sav=file] <rom>\n", program);
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+int main(int argc, char* argv[]) {
+    usize frames = 0;
+    const char* movie_path = NULL;
+    const char* hash_path = NULL;
+    const char* bus_stats_path = NULL;
+    const char* trace_path = NULL;
+    const char* video_path = NULL;
+    const char* audio_path = NULL;
+    const char* sav_path = NULL;
+    const char* rom_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--frames=", 9) == 0) {
+            frames = strtoul(argv[i] + 9, NULL, 10);
+        } else if (strncmp(argv[i], "--movie=", 8) == 0) {
+            movie_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--hash-frames=", 14) == 0) {
+            hash_path = argv[i] + 14;
+        } else if (strncmp(argv[i], "--bus-stats=", 12) == 0) {
+            bus_stats_path = argv[i] + 12;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--dump-video=", 13) == 0) {
+            video_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--dump-audio=", 13) == 0) {
+            audio_path = argv[i] + 13;
+        } else if (strncmp(argv[i], "--sav=", 6) == 0) {
+            sav_path = argv[i] + 6;
+        } else if (argv[i][0] != '-' && rom_path == NULL) {
+            rom_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (rom_path == NULL || (movie_path == NULL && frames == 0)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+#ifndef OLDNES_BUS_STATS
+    if (bus_stats_path != NULL) {
+        LOG(ERROR, "--bus-stats needs a build configured with OLDNES_BUS_STATS");
+        return EXIT_FAILURE;
+    }
+#endif
+
+    RomError error;
+    struct RomImage* rom = load_rom_image(rom_path, &error);
+    if (rom == NULL) {
+        return EXIT_FAILURE;
+    }
+    static struct Emulator emulator;
+    const bool loaded = init_emulator(&emulator, rom);
+    release_rom_image(rom);
+    if (!loaded) {
+        return EXIT_FAILURE;
+    }
+
+    if (sav_path != NULL && !attach_battery(&emulator.cpu_bus, sav_path)) {
+        free_emulator(&emulator);
+        return EXIT_FAILURE;
+    }
+
+    struct Movie movie;
+    init_movie(&movie);
+    if (movie_path != NULL) {
+        if (!load_movie(&movie, movie_path) || !start_playback(&movie, &emulator)) {
+            free_movie(&movie);
+            free_emulator(&emulator);
+            return EXIT_FAILURE;
+        }
+        if (frames == 0 || frames > movie.frames) {
+            frames = movie.frames;
+        }
+    }
+
+#ifdef OLDNES_PROFILE
+    emulator.cpu.profiler = create_profiler();
+#endif
+    // The last TRACE_RECORDS instructions, written out at the end or if the emulator crashes
+    if (trace_path != NULL) {
+        emulator.cpu.trace = create_trace_ring(TRACE_RECORDS);
+        dump_trace_on_crash(emulator.cpu.trace, trace_path);
+    }
+#ifdef OLDNES_BUS_STATS
+    emulator.cpu_bus.stats = create_bus_stats();
+    emulator.ppu_bus.stats = emulator.cpu_bus.stats;
+#endif
+
+    // One FrameHash record per frame, in frame order
+    FILE* hashes = NULL;
+    if (hash_path != NULL && (hashes = fopen(hash_path, "wb")) == NULL) {
+        LOG(ERROR, "Could not open '%s' for writing", hash_path);
+        free_movie(&movie);
+        free_emulator(&emulator);
+        return EXIT_FAILURE;
+    }
+    // Converting and writing happen on the capture thread, so dumping keeps the loop uncapped
+    struct Capture capture;
+    const bool capturing = video_path != NULL || audio_path != NULL;
+    if (capturing && !start_capture(&capture, video_path, audio_path, APU_SAMPLE_RATE)) {
+        if (hashes != NULL) {
+            fclose(hashes);
+        }
+        free_movie(&movie);
+        free_emulator(&emulator);
+        return EXIT_FAILURE;
+    }
+
+    // Uncapped: frames run back to back with nothing presented
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool matched = true;
+    usize frame = 0;
+    for (; frame < frames && matched; frame++) {
+        if (movie_path != NULL) {
+            apply_movie_input(&movie, frame, &emulator);
+        }
+        run_frame(&emulator);
+        if (capturing) {
+            capture_frame(&capture, &emulator);
+        }
+        if (hashes != NULL) {
+            const struct FrameHash hash = hash_frame(&emulator);
+            fwrite(&hash, sizeof(hash), 1, hashes);
+        }
+        if (movie_path != NULL) {
+            matched = verify_frame(&movie, frame, &emulator, stdout);
+        }
+    }
+    if (hashes != NULL) {
+        fclose(hashes);
+    }
+    if (capturing) {
+        stop_capture(&capture);
+    }
+    const double seconds = elapsed_seconds(&start);
+
+    const double fps = seconds > 0 ? frame / seconds : 0;
+    PRINTF("%u frames in %.3f s (%.1f fps, %.1fx real time)%s\n", frame, seconds, fps, fps / 60.0988,
+           movie_path == NULL ? "" : matched ? ", movie verified" : "");
+    if (capturing) {
+        report_capture(&capture, stdout);
+    }
+#ifdef OLDNES_PROFILE
+    report_profile(emulator.cpu.profiler, stdout, PROFILE_TOP);
+    free_profiler(emulator.cpu.profiler);
+#endif
+#ifdef OLDNES_BUS_STATS
+    report_bus_stats(emulator.cpu_bus.stats, stdout);
+    if (bus_stats_path != NULL) {
+        save_bus_stats(emulator.cpu_bus.stats, bus_stats_path);
+    }
+    free_bus_stats(emulator.cpu_bus.stats);
+#endif
+    if (emulator.cpu.trace != NULL) {
+        save_trace(emulator.cpu.trace, trace_path);
+        free_trace_ring(emulator.cpu.trace);
+    }
+    free_movie(&movie);
+    free_emulator(&emulator);
+    return matched ? 0 : EXIT_FAILURE;
+}
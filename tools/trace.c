@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "log.h"
+
+static void usage(const char* program) {
+    PRINTF("Usage: %s [--last=N] <trace>\n", program);
+    PRINTF("Prints a binary trace from oldnes_run or the front end as nestest.log text\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* path = NULL;
+    usize last = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--last=", 7) == 0) {
+            last = strtoul(argv[i] + 7, NULL, 10);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (path == NULL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct TraceHeader header;
+    struct TraceRecord* records;
+    if (!load_trace(path, &header, &records)) {
+        return EXIT_FAILURE;
+    }
+    const usize count = header.records;
+    uint64_t* cycles = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (cycles == NULL) {
+        free(records);
+        return EXIT_FAILURE;
+    }
+    unwrap_trace_cycles(records, count, header.last_cycle, cycles);
+
+    char line[128];
+    for (usize i = last && last < count ? count - last : 0; i < count; i++) {
+        format_trace_record(line, sizeof(line), &records[i], cycles[i]);
+        PRINTF("%s\n", line);
+    }
+    free(cycles);
+    free(records);
+    return 0;
+}